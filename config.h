@@ -10,6 +10,40 @@
 #define MF_OLED_FEATHERWING
   // Comment out if you don't have such a display.
 
+// #define MF_TELEMETRY
+  // The USB serial port carries JSON lines, one per event, for host
+  // software, rather than text for people to read.
+
+// #define MF_AUTO_START
+  // Start flashing as soon as a target is attached, no button needed.
+  // Attachment is detected with TARGET_SENSE, if defined, otherwise by
+  // probing for a target over SWD every half second.
+
+// #define MF_STREAM
+  // Accept images streamed from the host over the USB serial port, and
+  // flash them directly, without storing them on the drive. For
+  // development: see tools/stream-flash.py.
+
+// #define MF_MSC_TRACE
+  // Send a line over the USB serial port for every read, write and flush
+  // of the drive by the host, to capture how an OS copies files, for
+  // replaying on a computer. For development: see tools/storage-bench.
+
+// #define MF_MEMORY_REPORT
+  // Report how RAM is used: static data, heap, and the deepest the stack
+  // has gone, at startup and whenever the heap or stack grows (`memory` in
+  // telemetry). SAMD boards only.
+
+// #define MF_SWD_TRACE
+  // Keep a trace of the last SWD transactions, and when one fails while
+  // flashing, write it to swd-trace.bin on the drive, between units. See
+  // tools/swd-trace.py to read it.
+
+// #define MF_PROFILE
+  // Sample where the programmer spends its time, about a thousand times a
+  // second, and time the known hot spots, sending both over the USB serial
+  // port. For development: see tools/profile.py. SAMD21 boards only.
+
 // CONFIGURATION MACROS
 
 #if 0  // enable these to define specific pins
@@ -18,6 +52,34 @@
   #define TARGET_SWRST 12
 #endif
 
+#if 0  // enable to sense target attachment for MF_AUTO_START
+  #define TARGET_SENSE 13
+    // connect to the target's GND on the connector, but not to the
+    // programmer's GND: it is pulled low only when a target is attached
+#endif
+
+#if 0  // enable one of these to confirm the target runs after flashing
+  #define TARGET_RUN_MAILBOX  0x20000000
+  #define TARGET_RUN_MAGIC    0x600DB007
+    // the flashed firmware writes TARGET_RUN_MAGIC to this RAM address
+  #define TARGET_RUN_PIN      13
+    // the flashed firmware drives the target pin connected to this high
+#endif
+
+#if 0  // enable to test recovery from SWD errors while flashing, on hardware
+  #define FAULT_INJECT_EVERY  100
+    // every this many page reads or writes is treated as having failed;
+    // tools/swd-sim injects real faults on the wire instead
+#endif
+
+#ifndef SWD_CLOCK
+  #define SWD_CLOCK  50   // as given to the DAP library; lowered on errors
+#endif
+
+#ifndef TARGET_RUN_TIMEOUT
+  #define TARGET_RUN_TIMEOUT  3000  // ms to wait for the target to start
+#endif
+
 // default pin assignments per board
 #if defined(ADAFRUIT_FEATHER_M0_EXPRESS) || defined(ADAFRUIT_FEATHER_M4_EXPRESS)
   #ifndef TARGET_SWDIO
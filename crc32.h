@@ -0,0 +1,12 @@
+#ifndef _CRC32_H_
+#define _CRC32_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// Standard CRC-32 (as used by zip, and by `crc32` on the command line).
+// To checksum data in pieces, pass the result of one call into the next.
+
+uint32_t crc32(const uint8_t* buf, size_t len, uint32_t crc = 0);
+
+#endif // _CRC32_H_
@@ -9,6 +9,11 @@
 #include <Adafruit_TinyUSB.h>
 #include <Adafruit_SleepyDog.h>
 
+#include "config.h"
+#include "crc32.h"
+#include "msc_trace.h"
+#include "serialization.h"
+
 namespace {
 
   // On-board external flash (QSPI or SPI) macros should already
@@ -57,21 +62,37 @@ namespace FileManager {
 
 namespace {
 
+  void traceMsc(MscTrace::Op op, uint32_t lba, uint32_t bufsize,
+      uint32_t startedAt) {
+#ifdef MF_MSC_TRACE
+    MscTrace::record(op, lba, bufsize/512, startedAt);
+#endif
+  }
+
   int32_t msc_read_cb (uint32_t lba, void* buffer, uint32_t bufsize)
   {
-    return flash.readBlocks(lba, (uint8_t*) buffer, bufsize/512) ? bufsize : -1;
+    auto startedAt = micros();
+    int32_t r =
+      flash.readBlocks(lba, (uint8_t*) buffer, bufsize/512) ? bufsize : -1;
+    traceMsc(MscTrace::Op::read, lba, bufsize, startedAt);
+    return r;
   }
 
   int32_t msc_write_cb (uint32_t lba, uint8_t* buffer, uint32_t bufsize)
   {
-    return flash.writeBlocks(lba, buffer, bufsize/512) ? bufsize : -1;
+    auto startedAt = micros();
+    int32_t r = flash.writeBlocks(lba, buffer, bufsize/512) ? bufsize : -1;
+    traceMsc(MscTrace::Op::write, lba, bufsize, startedAt);
+    return r;
   }
 
   void msc_flush_cb (void)
   {
+    auto startedAt = micros();
     flash.syncBlocks();
     fatfs.cacheClear();
     noteFileSystemChange();
+    traceMsc(MscTrace::Op::flush, 0, 0, startedAt);
   }
 
   bool setupMSC() {
@@ -240,7 +261,10 @@ namespace FileManager {
 
 
     noteFileSystemChange();
+    return true;
+  }
 
+  bool startUSB(Interface& intf) {
     if (!setupMSC()) {
       intf.errorMsg("Failed to setup USB drive.");
       return false;
@@ -250,15 +274,182 @@ namespace FileManager {
   }
 
   bool loop(Interface& intf) {
+#ifdef MF_MSC_TRACE
+    MscTrace::send();
+#endif
+    return true;
+  }
+}
+
+/* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+
+bool BlockFile::create(const char* path, uint32_t size) {
+  if (open(path) && blockCount * blockSize >= size)
     return true;
+
+  fatfs.remove(path);
+
+  FatFile file;
+  if (!file.createContiguous(fatfs.vwd(), path, size))
+    return false;
+  file.close();
+  flash.syncBlocks();
+
+  return open(path);
+}
+
+bool BlockFile::open(const char* path) {
+  close();
+
+  FatFile file;
+  if (!file.open(fatfs.vwd(), path, O_RDONLY))
+    return false;
+
+  uint32_t bgnBlock, endBlock;
+  if (file.contiguousRange(&bgnBlock, &endBlock)) {
+    firstBlock = bgnBlock;
+    blockCount = min(endBlock - bgnBlock + 1, file.fileSize() / blockSize);
   }
+  file.close();
+
+  return isOpen();
+}
+
+bool BlockFile::read(uint32_t block, uint8_t* buf) {
+  if (block >= blockCount) return false;
+  return flash.readBlocks(firstBlock + block, buf, 1);
+}
+
+bool BlockFile::write(uint32_t block, const uint8_t* buf) {
+  if (block >= blockCount) return false;
+  return flash.writeBlocks(firstBlock + block, buf, 1) && flash.syncBlocks();
+}
+
+bool BlockFile::writeBack(uint32_t block, const uint8_t* buf) {
+  if (block >= blockCount) return false;
+  return flash.writeBlocks(firstBlock + block, buf, 1);
+}
+
+bool BlockFile::sync() {
+  return flash.syncBlocks();
 }
 
 /* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
 
 namespace {
-  FatFile bootFile;
-  FatFile appFile;
+
+  // One of the binaries to flash. Once found, it is kept open, along with
+  // what is known about it, until the file system changes.
+
+  struct Binary {
+    FatFile file;
+    size_t size = 0;
+    char name[64];
+
+    bool contiguous = false;
+    uint32_t flashAddr = 0;   // of the data, if contiguous
+    size_t pos = 0;
+
+    bool isOpen() const { return file.isOpen(); }
+
+    void close() {
+      file.close();
+      size = 0;
+      name[0] = '\0';
+      contiguous = false;
+      pos = 0;
+    }
+
+    void open(FatFile& f) {
+      file = f;
+      size = file.fileSize();
+      if (!file.getName(name, sizeof(name)))
+        name[0] = '\0';    // too long to show anyway
+
+      uint32_t bgnBlock = 0, endBlock = 0;
+      contiguous = file.contiguousRange(&bgnBlock, &endBlock);
+      flashAddr = bgnBlock * 512;
+
+      rewind();
+    }
+
+    void rewind() {
+      file.rewind();
+      pos = 0;
+    }
+
+    int read(uint8_t* buf, size_t len) {
+      len = min(len, size - pos);
+      if (len == 0)
+        return 0;
+
+      if (contiguous) {
+        // Straight from the flash chip: It is safe to bypass the file system
+        // as it is synced, and the file can't change without a rescan.
+        if (flash.readBuffer(flashAddr + pos, buf, len) != len)
+          return -1;
+      } else {
+        auto r = file.read(buf, len);
+        if (r < 0) return r;
+        len = r;
+      }
+
+      pos += len;
+      return len;
+    }
+  };
+
+  // A set of binaries to flash: those in the root directory, if any, and
+  // those in each subdirectory that has them. All are found, opened and
+  // checked when the drive is scanned, so switching between them is
+  // immediate.
+
+  struct Profile {
+    char name[32];
+    Binary boot;
+    Binary app;
+    uint32_t crc = 0;
+
+    void close() {
+      boot.close();
+      app.close();
+      name[0] = '\0';
+      crc = 0;
+    }
+
+    void rewind() {
+      boot.rewind();
+      app.rewind();
+    }
+
+    int readNextBlock(uint8_t* buf, size_t bufsize) {
+      if (boot.isOpen()) {
+        auto r = boot.read(buf, bufsize);
+        if (r < 0) return r;
+        if (r == bufsize) return r;
+
+        if (app.isOpen()) {
+          buf += r;
+          bufsize -= r;
+
+          auto s = app.read(buf, bufsize);
+          if (s < 0) return s;
+
+          r += s;
+        }
+
+        return r;
+      }
+      return 0;
+    }
+  };
+
+  const int maxProfiles = 8;
+  Profile profiles[maxProfiles];
+  int profileCount = 0;
+  int activeProfile = 0;    // profiles[0] is empty if there are none
+
+  Profile& active() { return profiles[activeProfile]; }
 
 
   bool matchBinFileName(const char* prefix, FatFile& file) {
@@ -273,36 +464,90 @@ namespace {
       && nameStr.endsWith(".bin");
   }
 
+  void scanDir(Interface& intf, FatFile& dir, Profile& profile) {
+    FatFile file;
+    while (file.openNext(&dir, O_RDONLY)) {
+      if (file.isDir()) {
+        // only the root is searched for subdirectories
+      } else if (matchBinFileName("boot", file)) {
+        if (!profile.boot.isOpen()) {
+          profile.boot.open(file);
+        } else {
+          intf.errorMsgf("%s: multiple boot .bin files", profile.name);
+        }
+      } else if (matchBinFileName("app", file)) {
+        if (!profile.app.isOpen()) {
+          profile.app.open(file);
+        } else {
+          intf.errorMsgf("%s: multiple app .bin files", profile.name);
+        }
+      }
+      file.close();
+    }
+
+    if (dir.getError()) {
+      intf.errorMsgf("%s: openNext failed", profile.name);
+    }
+  }
+
+  void checkProfile(Profile& profile) {
+    uint8_t buf[256];
+    int r;
+    profile.rewind();
+    while ((r = profile.readNextBlock(buf, sizeof(buf))) > 0)
+      profile.crc = crc32(buf, r, profile.crc);
+    profile.rewind();
+  }
 }
 
 
-FilesToFlash::FilesToFlash(Interface& intf) {
+void FilesToFlash::scan(Interface& intf) {
   intf.clearMsg();
 
-  bootFile.close();
-  appFile.close();
+  char activeName[sizeof(Profile::name)];
+  strcpy(activeName, active().name);
+
+  for (auto& profile : profiles)
+    profile.close();
+  profileCount = 0;
+  activeProfile = 0;
 
   FatFile root;
   if (!root.open("/")) {
     intf.errorMsg("open root failed");
   }
 
-  FatFile file;
-  while (file.openNext(&root, O_RDONLY)) {
-    if (matchBinFileName("boot", file)) {
-      if (!bootFile.isOpen()) {
-        bootFile = file;
-      } else {
-        intf.errorMsg("multiple boot .bin files found");
-      }
-    } else if (matchBinFileName("app", file)) {
-      if (!appFile.isOpen()) {
-        appFile = file;
-      } else {
-        intf.errorMsg("multiple app .bin files found");
+  strcpy(profiles[0].name, "/");
+  scanDir(intf, root, profiles[0]);
+  if (profiles[0].boot.isOpen())
+    profileCount += 1;
+  else
+    profiles[0].close();
+
+  root.rewind();
+  FatFile dir;
+  while (dir.openNext(&root, O_RDONLY)) {
+    char name[sizeof(Profile::name)];
+    if (dir.isDir() && !dir.isHidden()
+        && dir.getName(name, sizeof(name))
+        && name[0] != '.') {
+      if (profileCount == maxProfiles) {
+        // every slot holds a profile, so there's none to scan this one into
+        intf.errorMsgf("too many profiles, max %d", maxProfiles);
+        dir.close();
+        break;
       }
+
+      Profile& profile = profiles[profileCount];
+      strcpy(profile.name, name);
+      scanDir(intf, dir, profile);
+
+      if (profile.boot.isOpen())
+        profileCount += 1;
+      else
+        profile.close();
     }
-    file.close();
+    dir.close();
   }
 
   if (root.getError()) {
@@ -310,68 +555,59 @@ FilesToFlash::FilesToFlash(Interface& intf) {
   }
   root.close();
 
-  if (!bootFile.isOpen()) {
+  if (profileCount == 0) {
     intf.errorMsg("no boot .bin file found");
   }
+
+  for (int i = 0; i < profileCount; ++i) {
+    checkProfile(profiles[i]);
+    if (strcmp(profiles[i].name, activeName) == 0)
+      activeProfile = i;    // stay with the profile selected, if still there
+  }
+
+  patchesOkay_ = Serialization::load(intf, imageSize());
+}
+
+void FilesToFlash::selectProfile(Interface& intf, int delta) {
+  if (profileCount < 2) {
+    intf.statusMsg("no other profiles");
+    return;
+  }
+
+  intf.clearMsg();
+  activeProfile = (activeProfile + delta + profileCount) % profileCount;
+  patchesOkay_ = Serialization::load(intf, imageSize());
+  report(intf);
 }
 
 FilesToFlash::~FilesToFlash() {
-  bootFile.close();
-  appFile.close();
+  for (auto& profile : profiles)
+    profile.close();
 }
 
 bool FilesToFlash::okayToFlash() {
-  return bootFile.isOpen();
+  return active().boot.isOpen() && patchesOkay_;
 }
 
 size_t FilesToFlash::imageSize() {
-  return
-    (bootFile.isOpen() ? bootFile.fileSize() : 0)
-    + (appFile.isOpen() ? appFile.fileSize() : 0);
+  return active().boot.size + active().app.size;
+}
+
+uint32_t FilesToFlash::imageCrc() {
+  return active().crc;
 }
 
 void FilesToFlash::rewind() {
-  if (bootFile.isOpen())  bootFile.rewind();
-  if (appFile.isOpen()) appFile.rewind();
+  active().rewind();
 }
 
 int FilesToFlash::readNextBlock(uint8_t* buf, size_t bufsize) {
-  if (bootFile.isOpen()) {
-    auto r = bootFile.read(buf, bufsize);
-    if (r < 0) return r;
-    if (r == bufsize) return r;
-
-    if (appFile.isOpen()) {
-      buf += r;
-      bufsize -= r;
-
-      auto s = appFile.read(buf, bufsize);
-      if (s < 0) return s;
-
-      r += s;
-    }
-
-    return r;
-  }
-  return 0;
+  return active().readNextBlock(buf, bufsize);
 }
 
 void FilesToFlash::report(Interface& intf) {
-  size_t bootSize = 0;
-  size_t appSize = 0;
-
-  char bootName[512];
-  char appName[512];
-
-  if (bootFile.isOpen()) {
-      bootSize = bootFile.fileSize();
-      bootFile.getName(bootName, sizeof(bootName));
-  }
-
-  if (appFile.isOpen()) {
-      appSize = appFile.fileSize();
-      appFile.getName(appName, sizeof(appName));
-  }
-
-  intf.binaries(bootSize, bootName, appSize, appName);
+  Profile& p = active();
+  if (profileCount > 1)
+    intf.statusMsgf("profile %s, %d of %d", p.name, activeProfile + 1, profileCount);
+  intf.binaries(p.boot.size, p.boot.name, p.app.size, p.app.name);
 }
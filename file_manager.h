@@ -4,28 +4,74 @@
 #include <cstddef>
 #include <cstdint>
 
+#include "image_source.h"
 #include "interface.h"
 
 
 namespace FileManager {
   bool setup(Interface&);
+  bool startUSB(Interface&);
+    // Files that need to be created before the host mounts the drive must
+    // be created between these two calls.
   bool loop(Interface&);
 
   bool changed();
   bool changing();
 }
 
-struct FilesToFlash {
-  FilesToFlash(Interface&);
+// A file preallocated as one contiguous run of blocks. It is read and
+// rewritten in place, a block at a time, without touching the FAT or the
+// directory, so it is safe to update while the host has the drive mounted.
+
+class BlockFile {
+public:
+  static const size_t blockSize = 512;
+
+  bool create(const char* path, uint32_t size);
+    // before FileManager::startUSB(), or, to replace a file the host has
+    // deleted, when the host isn't FileManager::changing() the drive
+  bool open(const char* path);
+  void close() { blockCount = 0; }
+
+  bool isOpen() const { return blockCount > 0; }
+  uint32_t blocks() const { return blockCount; }
+
+  bool read(uint32_t block, uint8_t* buf);
+  bool write(uint32_t block, const uint8_t* buf);
+    // written through to the flash chip
+
+  bool writeBack(uint32_t block, const uint8_t* buf);
+  bool sync();
+    // For a run of blocks: writeBack() leaves them in the flash chip's
+    // cache, which erases each sector once for all its blocks rather than
+    // once for each, and sync() writes out what is left there.
+
+private:
+  uint32_t firstBlock = 0;
+  uint32_t blockCount = 0;
+};
+
+// The binaries to flash. These are found, opened, sized and checksummed
+// by scan(), and then kept ready for each unit to be flashed. Only call
+// scan() again when FileManager::changed().
+
+struct FilesToFlash : public ImageSource {
   ~FilesToFlash();
 
+  void scan(Interface&);
   bool okayToFlash();
 
   void report(Interface&);
+  void selectProfile(Interface&, int delta);
+    // moves to another set of binaries, when there is more than one
 
   size_t imageSize();
+  uint32_t imageCrc();
   void rewind();
   int readNextBlock(uint8_t* buf, size_t blockSize);
+
+private:
+  bool patchesOkay_ = false;
 };
 
 
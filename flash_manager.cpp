@@ -3,6 +3,15 @@
 #include <Adafruit_DAP.h>
 
 #include "config.h"
+#include "crc32.h"
+#include "link_bench.h"
+#include "link_health.h"
+#include "production_log.h"
+#include "profiler.h"
+#include "serial_out.h"
+#include "serialization.h"
+#include "swd_trace.h"
+#include "target_history.h"
 
 
 namespace {
@@ -41,18 +50,301 @@ namespace {
     }
   }
 
+  #define BUFSIZE 512       // the largest page of any family
+
+
+  // Target families differ in the DAP class that drives them, in how their
+  // flash is programmed, and in the layout of their fuses (the user row).
+  // The fuses that matter here are in the first 8 bytes of the user row,
+  // and on the SAMx5, in the region lock word after them: they are handled
+  // as those three words, the last of which is all ones on the SAMD2x.
+
+  struct Fuses {
+    uint32_t word[3];
+
+    bool erased() const {
+      return word[0] == 0xffffffff && word[1] == 0xffffffff
+        && word[2] == 0xffffffff;
+    }
+    bool operator==(const Fuses& f) const {
+      return memcmp(word, f.word, sizeof(word)) == 0;
+    }
+    bool operator!=(const Fuses& f) const { return !(*this == f); }
+  };
+
+  class Family {
+  public:
+    virtual Adafruit_DAP& dap() = 0;
+    virtual uint32_t programStart() = 0;
+
+    virtual size_t pageSize() = 0;    // unit read and written
+    virtual size_t eraseSize() = 0;   // erased by writing the first page
+    virtual void readBlock(uint32_t addr, uint8_t* buf) = 0;
+    virtual void programBlock(uint32_t addr, const uint8_t* buf) = 0;
+
+    virtual const uint32_t* serialAddrs() = 0;
+      // of the four words of the 128 bit serial number
+
+    virtual void fuseRead() = 0;
+    virtual void fuseWrite() = 0;
+    virtual size_t fuseSize() = 0;    // bytes moved by either
+    virtual Fuses fuses() = 0;
+    virtual void setFuses(const Fuses&) = 0;
+
+    virtual bool planFuses(
+      const Fuses& current, Fuses& forProgramming, Fuses& final) = 0;
+      // returns false if there is nothing sensible to plan from
+    virtual bool protects(const Fuses&) = 0;
+      // if the fuses protect any of the flash
+  };
+
+  class FamilySAMD2x : public Family {
+  public:
+    Adafruit_DAP& dap() { return dap_; }
+    uint32_t programStart() { return dap_.program_start(); }
+
+    size_t pageSize() { return 256; }     // a row, erased and written whole
+    size_t eraseSize() { return 256; }
+    void readBlock(uint32_t addr, uint8_t* buf) { dap_.readBlock(addr, buf); }
+    void programBlock(uint32_t addr, const uint8_t* buf) {
+      dap_.programBlock(addr, buf);
+    }
+
+    const uint32_t* serialAddrs() {
+      // four words, not contiguous, in NVM
+      static const uint32_t addrs[4] =
+        { 0x0080A00C, 0x0080A040, 0x0080A044, 0x0080A048 };
+      return addrs;
+    }
+
+    void fuseRead() { dap_.fuseRead(); }
+    void fuseWrite() { dap_.fuseWrite(); }
+    size_t fuseSize() { return sizeof(dap_._USER_ROW); }
+    Fuses fuses() {
+      auto& row = dap_._USER_ROW;
+      return { { row.reg32[0], row.reg32[1], 0xffffffff } };
+    }
+    void setFuses(const Fuses& f) {
+      auto& row = dap_._USER_ROW;
+      row.reg32[0] = f.word[0];
+      row.reg32[1] = f.word[1];
+    }
+
+    bool planFuses(const Fuses& current, Fuses& forProgramming, Fuses& final) {
+      auto& row = dap_._USER_ROW;
+
+      setFuses(current);
+      if (current.erased()) {
+        // Fuses are all ones, so set to some "reasonable" value.
+        // The value comes from Adafruit's UF2 bootloader.
+        row.reg64 = 0xFFFFFC5DD8E0C7FFUL;
+      }
+      row.bit.BOOTPROT = 7;   // unprotect the boot area
+      row.bit.LOCK = 0xffff;  // unprotect all the regions
+      forProgramming = fuses();
+
+      row.bit.BOOTPROT = 2;   // protect the boot area (8k)
+      final = fuses();
+
+      setFuses(current);
+      return true;
+    }
+
+    bool protects(const Fuses& f) {
+      auto& row = dap_._USER_ROW;
+      auto saved = fuses();
+      setFuses(f);
+      bool p = row.bit.BOOTPROT != 7 || row.bit.LOCK != 0xffff;
+      setFuses(saved);
+      return p;
+    }
+
+  private:
+    Adafruit_DAP_SAM dap_;
+  };
+
+  class FamilySAMx5 : public Family {
+  public:
+    Adafruit_DAP& dap() { return dap_; }
+    uint32_t programStart() { return dap_.program_start(); }
+
+    size_t pageSize() { return 512; }
+    size_t eraseSize() { return 8192; }   // a block
+    void readBlock(uint32_t addr, uint8_t* buf) {
+      dap_.readBlock(addr, buf, pageSize());
+    }
+    void programBlock(uint32_t addr, const uint8_t* buf) {
+      dap_.programBlock(addr, buf, pageSize());
+        // erases the block first if addr is at its start
+    }
+
+    const uint32_t* serialAddrs() {
+      static const uint32_t addrs[4] =
+        { 0x008061FC, 0x00806010, 0x00806014, 0x00806018 };
+      return addrs;
+    }
+
+    void fuseRead() { dap_.fuseRead(); }
+    void fuseWrite() { dap_.fuseWrite(); }
+    size_t fuseSize() { return sizeof(dap_._USER_ROW); }
+    // The region locks are bits 64-95 of the user row, by the datasheet:
+    // they are taken from there, not from the library's NVM_LOCKS field.
+    static const int locksWord = 2;
+
+    Fuses fuses() {
+      auto& row = dap_._USER_ROW;
+      return { { row.reg32[0], row.reg32[1], row.reg32[locksWord] } };
+    }
+    void setFuses(const Fuses& f) {
+      auto& row = dap_._USER_ROW;
+      row.reg32[0] = f.word[0];
+      row.reg32[1] = f.word[1];
+      row.reg32[locksWord] = f.word[2];
+    }
+
+    bool planFuses(const Fuses& current, Fuses& forProgramming, Fuses& final) {
+      if (current.erased())
+        return false;
+          // The rest of the user page holds factory calibration, which
+          // is lost too: there is no good value to restore.
+
+      auto& row = dap_._USER_ROW;
+      setFuses(current);
+      row.bit.NVM_BOOT = 15;                  // unprotect the boot area
+      row.reg32[locksWord] = 0xffffffff;      // unprotect all the regions
+      forProgramming = fuses();
+
+      row.bit.NVM_BOOT = 13;                  // protect the boot area (16k)
+      final = fuses();
+
+      setFuses(current);
+      return true;
+    }
+
+    bool protects(const Fuses& f) {
+      auto& row = dap_._USER_ROW;
+      auto saved = fuses();
+      setFuses(f);
+      bool p = row.bit.NVM_BOOT != 15 || f.word[2] != 0xffffffff;
+      setFuses(saved);
+      return p;
+    }
+
+  private:
+    Adafruit_DAP_SAMx5 dap_;
+  };
+
+  // Flashing is done in steps, each of which is a bounded amount of work:
+  // connecting, a fuse operation, or a single block. This lets the main
+  // loop service USB and the interfaces between steps.
+
   class Flasher {
     public:
-      Flasher(Interface& intf);
+      Flasher(Interface& intf, ImageSource& image);
       ~Flasher();
 
-      bool start();
-      bool program(FilesToFlash& ftf);
+      bool step();      // returns false once finished
+      void abort(const char* why);
+      const FlashStats& report();
 
     private:
       Interface& intf;
+      ImageSource& image;
+      const bool serialize;   // apply Serialization patches to the image
+
+      FamilySAMD2x samd2x;
+      FamilySAMx5 samx5;
+      Family* target = &samd2x;   // until the device ID says otherwise
+      bool selected = false;
+      bool faulted = false;   // set by any error reported by the DAP library
+
+      enum struct State {
+        connect,    // connect to, reset, and select the target
+        fuses,      // unprotect the flash, which may need a restart
+        program,    // a block at a time
+        verify,     // a block at a time
+        confirm,    // a known target: check its flash by CRC, instead
+        finish,     // protect the boot area, and restart the target
+        handshake,  // wait for the target to show it is running
+        reconnect,  // wait for a target that went away to come back
+        done,
+        failed,
+      };
+      State state = State::connect;
+      State failedIn;             // once failed, the state it failed in
+      bool restarted = false;
+      bool confirming = false;    // only checking a target seen before
+      TargetHistory::Entry known;
+      bool crcStarted = false;
+      uint32_t crcExpected;
+      uint32_t crcUntil;
+      static const uint32_t crcTimeout = 2000;    // ms
+
+      // recovery from errors while programming and verifying
+      static const int maxPageRetries = 3;
+      static const int maxBlockRetries = 6;   // of all the pages in a block
+      static const uint32_t reconnectTimeout = 10000;   // ms
+      bool pagePending = false;   // bufFile holds the page at addr, not done
+      size_t pageLen = 0;         // bytes of the image in it
+      uint32_t resumeAddr = 0;    // pages before this needn't be done again
+      uint32_t rewriteEnd = 0;    // if set, only rewriting up to here
+      bool rereading = false;     // the page at addr read back wrong once
+      uint32_t retryAddr = 0;
+      int pageRetries = 0;
+      uint32_t retryBlock = 0;
+      int blockRetries = 0;
+      State resumeState;
+      uint32_t reconnectUntil = 0;
+      uint32_t reconnectNextAt = 0;
+      uint32_t injectCount = 0;
+      bool retry();
+      bool recover();
+      bool rewrite();
+      bool targetReset();
+      bool resetSeen();
+      void restartPass(uint32_t from);
+      bool verifyFrom(uint32_t from);
+      void injectFault();
+
+      Fuses fusesForProgramming;
+      Fuses fusesFinal;
+
+      bool connect(Adafruit_DAP& dap);
+      bool stepConnect();
+      bool stepFuses();
+      bool stepProgram();
+      bool stepVerify();
+      bool stepConfirm();
+      bool stepFinish();
+      bool stepHandshake();
+      bool stepReconnect();
+
+      bool release();
+      bool finished();
+      uint32_t handshakeUntil = 0;
+      uint32_t handshakeNextAt = 0;
 
-      Adafruit_DAP_SAM dap;
+      uint32_t startAddr;
+      uint32_t addr;
+      uint8_t bufFile[BUFSIZE];
+      uint8_t bufFlash[BUFSIZE];
+
+      ProgressThrottle progress;
+
+      FlashStats stats;
+      uint32_t startAt;
+      uint32_t phaseAt;
+      void phaseDone(uint32_t& phaseTime);
+      uint32_t& phaseTime(State in);
+
+      int readImage(size_t len);
+      uint32_t readWord(uint32_t addr);
+      void writeWord(uint32_t addr, uint32_t data);
+      void readBlock(uint32_t addr, uint8_t* buf);
+      void programBlock(uint32_t addr, const uint8_t* buf);
+      void fuseRead();
+      void fuseWrite();
+      void readSerial();
 
       static Flasher* current;
 
@@ -62,10 +354,20 @@ namespace {
 
   Flasher* Flasher::current = NULL;
 
-  Flasher::Flasher(Interface& intf) : intf(intf) {
+  Flasher::Flasher(Interface& intf, ImageSource& image)
+    : intf(intf), image(image), serialize(image.patchable()),
+      progress(intf, image.imageSize())
+  {
     current = this;
 
-    dap.begin(TARGET_SWCLK, TARGET_SWDIO, TARGET_SWRST, &error);
+    memset(&stats, 0, sizeof(stats));
+    startAt = phaseAt = micros();
+
+    stats.imageSize = image.imageSize();
+    stats.imageCrc = image.imageCrc();
+
+    samd2x.dap().begin(TARGET_SWCLK, TARGET_SWDIO, TARGET_SWRST, &error);
+    samx5.dap().begin(TARGET_SWCLK, TARGET_SWDIO, TARGET_SWRST, &error);
   }
 
   Flasher::~Flasher() {
@@ -73,170 +375,855 @@ namespace {
       current = NULL;
        // cleared first, as we don't report errors at this point
 
-    dap.dap_set_clock(50);
-    dap.deselect();
+    auto& dap = target->dap();
+    dap.dap_set_clock(LinkHealth::clock());
+    if (selected)
+      dap.deselect();
     dap.dap_disconnect();
   }
 
-  bool Flasher::start() {
-    bool doAgain = false;
-    do {
-      if (! dap.dap_disconnect())                     return dap_error();
-      if (! dap.dap_connect())                        return dap_error();
-      if (! dap.dap_transfer_configure(0, 128, 128))  return dap_error();
-      if (! dap.dap_swd_configure(0))                 return dap_error();
-      if (! dap.dap_reset_link())                     return dap_error();
-      if (! dap.dap_swj_clock(50))                    return dap_error();
-      if (! dap.dap_reset_target_hw())                return dap_error();
-      if (! dap.dap_reset_link())                     return dap_error();
-      if (! dap.dap_target_prepare())                 return dap_error();
-
-      uint32_t dsu_did;
-      if (! dap.select(&dsu_did)) {
-        if (dsu_did == 0)
-          intf.errorMsg("No target device connected");
-        else
-          intf.errorMsgf("Unknown device 0x%x", dsu_did);
-        return false;
+  bool Flasher::step() {
+    bool ok = true;
+    switch (state) {
+      case State::connect:  ok = stepConnect();   break;
+      case State::fuses:    ok = stepFuses();     break;
+      case State::program:  ok = stepProgram();   break;
+      case State::verify:   ok = stepVerify();    break;
+      case State::confirm:  ok = stepConfirm();   break;
+      case State::finish:   ok = stepFinish();    break;
+      case State::handshake: ok = stepHandshake(); break;
+      case State::reconnect: ok = stepReconnect(); break;
+      case State::done:
+      case State::failed:   return false;
+    }
+    if (!ok) {
+      failedIn = state;
+      state = State::failed;
+    }
+    return state != State::done && state != State::failed;
+  }
+
+  void Flasher::abort(const char* why) {
+    intf.errorMsg(why);
+    if (state != State::failed)
+      failedIn = state;
+    state = State::failed;
+  }
+
+  bool Flasher::connect(Adafruit_DAP& dap) {
+    SwdTrace::Call call(SwdTrace::Op::connect);
+    if (! dap.dap_disconnect())                     return dap_error();
+    if (! dap.dap_connect())                        return dap_error();
+    if (! dap.dap_transfer_configure(0, 128, 128))  return dap_error();
+    if (! dap.dap_swd_configure(0))                 return dap_error();
+    if (! dap.dap_reset_link())                     return dap_error();
+    if (! dap.dap_swj_clock(LinkHealth::clock()))   return dap_error();
+    if (! dap.dap_reset_target_hw())                return dap_error();
+    if (! dap.dap_reset_link())                     return dap_error();
+    if (! dap.dap_target_prepare())                 return dap_error();
+    return true;
+  }
+
+  bool Flasher::stepConnect() {
+    if (! connect(target->dap()))                   return false;
+
+    if (!restarted) {
+      // The DSU is at the same address in all families, and the processor
+      // field of its device ID tells them apart: 1 is a Cortex-M0+, 6 an M4.
+      const uint32_t DSU_DID = 0x41002018;
+      auto did = readWord(DSU_DID);
+      Family* family = (did >> 28) == 6 ? static_cast<Family*>(&samx5) : &samd2x;
+      if (family != target) {
+        target->dap().dap_disconnect();
+        target = family;
+        if (! connect(target->dap()))               return false;
       }
-      intf.statusMsgf(
-        "->%s, %dk", dap.target_device.name, sizeInK(dap.target_device.flash_size));
+    }
 
-      dap.fuseRead(); // fuse operations don't return a result (!)
-      intf.statusMsgf("fuses: 0x%08x 0x%08x", dap._USER_ROW.reg32[1], dap._USER_ROW.reg32[0]);
+    auto& dap = target->dap();
+    uint32_t dsu_did;
+    {
+      SwdTrace::Call call(SwdTrace::Op::select);
+      selected = dap.select(&dsu_did);
+      call.data = dsu_did;
+    }
+    stats.deviceId = dsu_did;
+    if (selected && !restarted)
+      LinkHealth::start(dsu_did);
+    if (! selected) {
+      if (dsu_did == 0)
+        intf.errorMsg("No target device connected");
+      else
+        intf.errorMsgf("Unknown device 0x%x", dsu_did);
+      return false;
+    }
+    intf.statusMsgf(
+      "->%s, %dk", dap.target_device.name, sizeInK(dap.target_device.flash_size));
+    targetReset();    // as it just was, by connecting: only later ones matter
+    readSerial();
+    if (!restarted) {
+      if (serialize && !Serialization::prepare(intf, stats.serial))
+        return false;
 
-      bool fuseReset = dap._USER_ROW.reg64 == 0xffffffffffffffffUL;
-      if (fuseReset) {
-        // Fuses are all ones, so set to some "reasonable" value.
-        // The value comes from Adafruit's UF2 bootloader.
-        dap._USER_ROW.reg64 = 0xFFFFFC5DD8E0C7FFUL;
+      // Serialized images differ per unit, so can't be confirmed this way
+      confirming = !(serialize && Serialization::active())
+        && TargetHistory::lookup(stats.serial, known)
+        && known.imageCrc == image.imageCrc();
+    }
+    phaseDone(restarted ? stats.fuseTime : stats.connectTime);
+      // reconnecting after a fuse write is part of the fuse work
+
+    state = State::fuses;
+    return true;
+  }
+
+  // The fuses (the user row) are planned from a single read: the value
+  // needed while programming, with the boot area and all regions unprotected,
+  // and the final value, with the boot area protected. Writes that wouldn't
+  // change anything are skipped.
+  //
+  // Protection in the user row only takes effect when the target restarts.
+  // So a restart is needed only if protection is in effect now. In
+  // particular, fuses that are all ones (erased) protect nothing, so they are
+  // written with reasonable values, and checked, without a restart.
+
+  bool Flasher::stepFuses() {
+    fuseRead();
+    auto current = target->fuses();
+    if (current.word[2] == 0xffffffff)
+      intf.statusMsgf("fuses: 0x%08x 0x%08x", current.word[1], current.word[0]);
+    else
+      intf.statusMsgf("fuses: 0x%08x 0x%08x, locks 0x%08x",
+        current.word[1], current.word[0], current.word[2]);
+
+    if (confirming) {
+      if (memcmp(current.word, known.fuses, sizeof(known.fuses)) == 0) {
+        // as it was left: check its flash, and leave the fuses alone
+        intf.statusMsgf("known target, checking");
+        fusesForProgramming = fusesFinal = current;
+        stats.confirmed = true;
+        phaseDone(stats.fuseTime);
+
+        startAddr = addr = target->programStart();
+        crcStarted = false;
+        state = State::confirm;
+        return true;
       }
-      bool fuseUnprotect =
-        dap._USER_ROW.bit.BOOTPROT != 7 || dap._USER_ROW.bit.LOCK != 0xffff;
-      if (fuseUnprotect) {
-        dap._USER_ROW.bit.BOOTPROT = 7;   // unprotect the boot area
-        dap._USER_ROW.bit.LOCK = 0xffff;  // unprotect all the regions
-        intf.statusMsgf("fuses set reasonably");
+      confirming = false;
+    }
+
+    if (restarted) {
+      // back after the restart, just check the write took
+      if (current != fusesForProgramming) {
+        intf.errorMsgf("fuse set failed");
+        return false;
+      }
+    } else {
+      if (!target->planFuses(current, fusesForProgramming, fusesFinal)) {
+        intf.errorMsgf("fuses erased, can't set");
+        return false;
       }
-      if (fuseReset || fuseUnprotect) {
-        if (doAgain) {
-          intf.errorMsgf("fuse set failed");
-          return false;
-        }
 
-        if (fuseReset)      intf.statusMsgf("resetting fuses");
-        if (fuseUnprotect)  intf.statusMsgf("unprotecting flash");
+      if (current != fusesForProgramming) {
+        bool protecting = target->protects(current);
 
-        dap.fuseWrite();
-        intf.statusMsgf("restarting target");
+        if (current.erased())                 intf.statusMsgf("resetting fuses");
+        if (protecting)                       intf.statusMsgf("unprotecting flash");
 
-        doAgain = true;
+        target->setFuses(fusesForProgramming);
+        fuseWrite();
 
-      } else {
-        doAgain = false;
-      }
-    } while (doAgain);
+        if (protecting) {
+          intf.statusMsgf("restarting target");
+          restarted = true;
+          state = State::connect;
+          return true;
+        }
 
-    return true;
-  }
+        fuseRead();
+        if (target->fuses() != fusesForProgramming) {
+          intf.errorMsgf("fuse set failed");
+          return false;
+        }
+      }
+    }
 
-  bool Flasher::program(FilesToFlash& ftf) {
-  #define BUFSIZE 256       //don't change!
-    uint8_t bufFile[BUFSIZE];
-    uint8_t bufFlash[BUFSIZE];
+    phaseDone(stats.fuseTime);
 
     // dap.erase();
     // intf.statusMsg("chip erased");
 
-    auto imageSize = ftf.imageSize();
-    auto startAddr = dap.program_start();
+    startAddr = addr = target->programStart();
+    image.rewind();
+    state = State::program;
+    return true;
+  }
 
-    auto addr = startAddr;
-    ftf.rewind();
-    do {
-      auto r = ftf.readNextBlock(bufFile, sizeof(bufFile));
+  bool Flasher::stepProgram() {
+    auto page = target->pageSize();
+    if (!pagePending) {
+      if (rewriteEnd != 0 && addr >= rewriteEnd)
+        return verifyFrom(resumeAddr);  // back to where it didn't verify
+
+      if (!image.ready(page))
+        return true;
+
+      auto r = readImage(page);
       if (r < 0) {
-        intf.errorMsg("error reading binaries");
+        intf.errorMsg("error reading image");
         return false;
       }
       if (r == 0)
-        break;
+        return verifyFrom(rewriteEnd != 0 ? resumeAddr : 0);
+      stats.storageRead += r;
 
-      dap.readBlock(addr, bufFlash);
-      if (memcmp(bufFile, bufFlash, r) != 0) {
-        dap.programBlock(addr, bufFile);
+      if (addr < resumeAddr) {
+        // already written, before an error sent us back to the start
+        addr += page;
+        return true;
       }
 
-      addr += sizeof(bufFile);  // must be in BUFSIZE chunks due to auto write
-      intf.progress(Burn::programming, addr, imageSize);
-      yield();
-    } while (true);
+      memset(bufFile + r, 0xff, page - r);    // pages are written whole
+      if (serialize)
+        Serialization::apply(addr, bufFile, r);
+      pageLen = r;
+      pagePending = true;
+    }
 
-    addr = startAddr;
-    ftf.rewind();
-    do {
-      auto r = ftf.readNextBlock(bufFile, sizeof(bufFile));
+    faulted = false;
+    if (page == target->eraseSize()) {
+      // Each write erases just what it writes: unchanged pages can be
+      // skipped. The whole page is compared, padding too, as a confirm
+      // later takes the CRC of all of it.
+      readBlock(addr, bufFlash);
+      if (!faulted && memcmp(bufFile, bufFlash, page) != 0) {
+        programBlock(addr, bufFile);
+      }
+    } else {
+      // Writing the first page of a block erases all of it, so all its pages
+      // must be written
+      programBlock(addr, bufFile);
+    }
+    injectFault();
+    bool reset = !faulted && targetReset();
+    if (faulted)
+      return recover();
+    if (reset)
+      return resetSeen();
+
+    pagePending = false;
+    addr += page;
+    if (rewriteEnd == 0)
+      progress.update(Burn::programming, addr - startAddr);
+    return true;
+  }
+
+  bool Flasher::stepVerify() {
+    auto page = target->pageSize();
+    if (!pagePending) {
+      if (!image.ready(page))
+        return true;
+
+      auto r = readImage(page);
       if (r < 0) {
-        intf.errorMsg("error reading binaries");
+        intf.errorMsg("error reading image");
         return false;
       }
-      if (r == 0)
-        break;
+      if (r == 0) {
+        phaseDone(stats.verifyTime);
 
-      dap.readBlock(addr, bufFlash);
+        progress.update(Burn::complete, stats.imageSize);
+        state = State::finish;
+        return true;
+      }
+      stats.storageRead += r;
 
-      if (memcmp(bufFile, bufFlash, r) != 0) {
-        intf.errorMsgf("mismatch @%08x", addr);
-        // hexdumpdiff("file", "flash", bufFile, bufFlash, addr, r);
-        return false;
+      if (addr < resumeAddr) {
+        // verified already, before a page was written again
+        addr += page;
+        return true;
       }
 
-      addr += sizeof(bufFile);
-      intf.progress(Burn::verifying, addr, imageSize);
-      yield();
-    } while (true);
+      if (serialize)
+        Serialization::apply(addr, bufFile, r);
+      pageLen = r;
+      pagePending = true;
+    }
+
+    faulted = false;
+    readBlock(addr, bufFlash);
+    injectFault();
+    if (faulted)
+      return recover();
+
+    if (memcmp(bufFile, bufFlash, pageLen) != 0) {
+      // Read data can be wrong with nothing seen on the wire: so the page
+      // is read again, and only if it is still wrong, written again.
+      if (!rereading) {
+        rereading = true;
+        return true;
+      }
+      rereading = false;
+      intf.statusMsgf("mismatch @%08x", addr);
+      // hexdumpdiff("file", "flash", bufFile, bufFlash, addr, pageLen);
+      return rewrite();
+    }
+    rereading = false;
+    pagePending = false;
+
+    addr += page;
+    progress.update(Burn::verifying, addr - startAddr);
+    return true;
+  }
 
-    intf.progress(Burn::complete, imageSize, imageSize);
+  // A target flashed before with these binaries is checked by having its
+  // DSU work out the CRC-32 of the flash they fill, which takes a few reads
+  // over SWD rather than reading it all back. The image is padded to whole
+  // pages, as it was written. Anything but a match, and it is flashed again
+  // in full.
 
-    intf.statusMsgf("protecting boot");
-    dap._USER_ROW.bit.BOOTPROT = 2;   // protect the boot area (8k)
-    dap.fuseWrite();
+  bool Flasher::stepConfirm() {
+    const uint32_t DSU_CTRLSTAT = 0x41002100;
+    const uint32_t DSU_ADDR = 0x41002104;
+    const uint32_t DSU_LENGTH = 0x41002108;
+    const uint32_t DSU_DATA = 0x4100210C;
+    const uint32_t CTRL_CRC = 1 << 2;
+    const uint32_t STATUSA_DONE = 1 << 8;
+    const uint32_t STATUSA_BERR = 1 << 10;
 
+    faulted = false;
+    if (!crcStarted) {
+      auto page = target->pageSize();
+      uint32_t len = (stats.imageSize + page - 1) / page * page;
+      memset(bufFlash, 0xff, page);
+      crcExpected = ~crc32(bufFlash, len - stats.imageSize, image.imageCrc());
+        // the DSU doesn't invert its result, as crc32() does
+
+      writeWord(DSU_CTRLSTAT, STATUSA_DONE | STATUSA_BERR);   // clear them
+      writeWord(DSU_ADDR, startAddr);
+      writeWord(DSU_LENGTH, len);
+      writeWord(DSU_DATA, 0xffffffff);
+      writeWord(DSU_CTRLSTAT, CTRL_CRC);
+      crcStarted = true;
+      crcUntil = millis() + crcTimeout;
+      if (!faulted)
+        return true;
+    }
+
+    bool match = false;
+    if (!faulted) {
+      auto status = readWord(DSU_CTRLSTAT);
+      if (!faulted && !(status & STATUSA_DONE)
+          && static_cast<int32_t>(millis() - crcUntil) < 0)
+        return true;    // still working
+      match = (status & STATUSA_DONE) && !(status & STATUSA_BERR)
+        && readWord(DSU_DATA) == crcExpected && !faulted;
+    }
+    phaseDone(stats.verifyTime);
+
+    if (match) {
+      progress.update(Burn::complete, stats.imageSize);
+      state = State::finish;
+      return true;
+    }
+
+    // changed since it was flashed, so flash it again in full
+    intf.statusMsgf("changed, reflashing");
+    confirming = false;
+    stats.confirmed = false;
+    state = State::fuses;
+    return true;
+  }
+
+  // An error while programming or verifying is most likely a glitch on the
+  // SWD lines: the link is reset, and the page is tried again, a few times.
+  // If the link can't be reset, the target has gone: it is waited for, and
+  // once the same target is back, work resumes from where it stopped.
+  //
+  // Each way of trying a page again counts against the same limits: one for
+  // the page, and one for its erase block, as errors on different pages of
+  // a block each send programming back to the block's start.
+
+  bool Flasher::retry() {
+    stats.retries += 1;
+    if (addr != retryAddr) {
+      retryAddr = addr;
+      pageRetries = 0;
+    }
+    auto block = addr - addr % target->eraseSize();
+    if (block != retryBlock) {
+      retryBlock = block;
+      blockRetries = 0;
+    }
+
+    pageRetries += 1;
+    blockRetries += 1;
+    if (pageRetries > maxPageRetries) {
+      intf.errorMsgf("failed @%08x, %d retries", addr, maxPageRetries);
+      return false;
+    }
+    if (blockRetries > maxBlockRetries) {
+      intf.errorMsgf("failed @%08x, %d retries in its block",
+        addr, maxBlockRetries);
+      return false;
+    }
+    return true;
+  }
+
+  void Flasher::restartPass(uint32_t from) {
+    // the pass starts again from the top, skipping the pages before from
+    resumeAddr = from;
+    addr = startAddr;
+    pagePending = false;
+    rereading = false;
+    image.rewind();
+  }
+
+  bool Flasher::verifyFrom(uint32_t from) {
+    phaseDone(stats.programTime);
+    rewriteEnd = 0;
+    restartPass(from);
+    state = State::verify;
+    return true;
+  }
+
+  bool Flasher::recover() {
+    if (!retry())
+      return false;
+
+    auto erase = target->eraseSize();
+    if (state == State::program && addr % erase != 0) {
+      // The write may have been partly done, and can't be done again without
+      // erasing: so redo the block from its start.
+      restartPass(addr - addr % erase);
+    }
+
+    auto& dap = target->dap();
+    faulted = false;
+    bool reset;
+    {
+      SwdTrace::Call call(SwdTrace::Op::resetLink);
+      reset = dap.dap_swj_clock(LinkHealth::clock())  // may have been lowered
+        && dap.dap_reset_link() && dap.dap_target_prepare();
+    }
+    if (reset && !faulted) {
+      intf.statusMsgf("retrying @%08x", retryAddr);
+      return true;
+    }
+
+    intf.statusMsgf("target lost, waiting");
+    resumeState = state;
+    reconnectUntil = millis() + reconnectTimeout;
+    state = State::reconnect;
+    return true;
+  }
+
+  // A page that reads back wrong, twice, is written again: with the rest of
+  // its erase block, from the start, as a write can't be redone without
+  // erasing. Verifying then carries on from the start of the block.
+
+  bool Flasher::rewrite() {
+    if (!retry())
+      return false;
+
+    phaseDone(stats.verifyTime);
+    auto erase = target->eraseSize();
+    auto from = addr - addr % erase;
+    rewriteEnd = from + erase;
+    restartPass(from);
+    state = State::program;
+    return true;
+  }
+
+  // A target that resets itself, say on a brown out, while a page is being
+  // written can lose some of it, with nothing seen on the wire. So once
+  // each page is written, DHCSR's S_RESET_ST, which a reset sets and reading
+  // clears, is checked. If the target has reset, the NVM controller has too,
+  // so the fuse step is done again, which sets it up for programming, and
+  // programming resumes from the start of the block being written.
+
+  bool Flasher::targetReset() {
+    const uint32_t DHCSR = 0xE000EDF0;
+    const uint32_t S_RESET_ST = 1 << 25;
+    return readWord(DHCSR) & S_RESET_ST;
+  }
+
+  bool Flasher::resetSeen() {
+    if (!retry())
+      return false;
+
+    intf.statusMsgf("target reset @%08x", addr);
+    phaseDone(stats.programTime);
+    auto erase = target->eraseSize();
+    restartPass(addr - addr % erase);
+    state = State::fuses;
+    return true;
+  }
+
+  bool Flasher::stepReconnect() {
+    // Each step tries once; the main loop keeps running in between.
+    if (static_cast<int32_t>(millis() - reconnectNextAt) < 0)
+      return true;
+    reconnectNextAt = millis() + 250;
+
+    if (static_cast<int32_t>(millis() - reconnectUntil) >= 0) {
+      state = resumeState;    // so errors are reported again
+      intf.errorMsg("target lost");
+      return false;
+    }
+
+    auto& dap = target->dap();
+    faulted = false;
+    if (!connect(dap))
+      return true;    // not back yet
+    uint32_t dsu_did;
+    {
+      SwdTrace::Call call(SwdTrace::Op::select);
+      bool ok = dap.select(&dsu_did);
+      call.data = dsu_did;
+      if (!ok || faulted)
+        return true;
+    }
+
+    bool reset = targetReset();
+      // always, as connecting resets it: and it may have lost power too
+    uint32_t serial[4];
+    auto addrs = target->serialAddrs();
+    for (int i = 0; i < 4; ++i)
+      serial[i] = readWord(addrs[i]);
+    fuseRead();
+
+    state = resumeState;
+    if (memcmp(serial, stats.serial, sizeof(serial)) != 0) {
+      intf.errorMsg("a different target was attached");
+      return false;
+    }
+    if (target->fuses() != fusesForProgramming) {
+      intf.errorMsg("target fuses changed");
+      return false;
+    }
+
+    stats.reconnects += 1;
+    intf.statusMsgf("target back, resuming");
+    if (reset && state == State::program)
+      return resetSeen();
+    return true;
+  }
+
+  void Flasher::injectFault() {
+#ifdef FAULT_INJECT_EVERY
+    if (++injectCount % FAULT_INJECT_EVERY == 0)
+      faulted = true;
+#endif
+  }
+
+  bool Flasher::stepFinish() {
+    if (fusesFinal != fusesForProgramming) {
+      intf.statusMsgf("protecting boot");
+      target->setFuses(fusesFinal);
+      fuseWrite();
+    }
+    memcpy(stats.fuses, fusesFinal.word, sizeof(stats.fuses));
+
+    auto& dap = target->dap();
     intf.statusMsgf("restarting target");
-    dap.dap_set_clock(50);
-    dap.deselect();
-    if (! dap.dap_reset_target_hw())                return dap_error();
+    dap.dap_set_clock(LinkHealth::clock());
+#ifdef TARGET_RUN_MAILBOX
+    writeWord(TARGET_RUN_MAILBOX, 0);   // so a stale value can't pass
+#endif
+    if (! release())                                return false;
+
+#if defined(TARGET_RUN_MAILBOX) || defined(TARGET_RUN_PIN)
+    intf.statusMsgf("waiting for target to start");
+    handshakeUntil = millis() + TARGET_RUN_TIMEOUT;
+    state = State::handshake;
+    return true;
+#else
+    return finished();
+#endif
+  }
+
+  // Releasing the target to run. A hardware reset isn't used: the connect
+  // sequence resets the target with SWCLK held low, and a SAMD21 reset that
+  // way stays in its reset extension phase until the debugger releases it.
+  // Instead, the debugger lets go of the core, and asks it to reset itself.
+
+  bool Flasher::release() {
+    auto& dap = target->dap();
+    const uint32_t DHCSR = 0xE000EDF0;
+    const uint32_t DEMCR = 0xE000EDFC;
+    const uint32_t AIRCR = 0xE000ED0C;
+    const uint32_t DSU_CTRLSTAT = 0x41002100;
+
+    writeWord(DEMCR, 0x00000000);           // no vector catch
+    writeWord(DHCSR, 0xA05F0000);           // no halt, no debug
+    writeWord(DSU_CTRLSTAT, 0x00000200);    // clear CRSTEXT
+    writeWord(AIRCR, 0x05FA0004);           // SYSRESETREQ
+    selected = false;
+    if (faulted)                                    return false;
+
     if (! dap.dap_disconnect())                     return dap_error();
+    return true;
+  }
+
+  bool Flasher::stepHandshake() {
+    // Each step checks once; the main loop keeps running in between.
+    if (static_cast<int32_t>(millis() - handshakeNextAt) < 0)
+      return true;
+    handshakeNextAt = millis() + 50;
+
+    bool running = false;
+#if defined(TARGET_RUN_MAILBOX)
+    // Connect without a reset, so the running target isn't disturbed
+    auto& dap = target->dap();
+    if (dap.dap_connect() && dap.dap_reset_link() && dap.dap_target_prepare()) {
+      running = readWord(TARGET_RUN_MAILBOX) == TARGET_RUN_MAGIC;
+      dap.dap_disconnect();
+    }
+    faulted = false;    // errors are expected while the target boots
+#elif defined(TARGET_RUN_PIN)
+    pinMode(TARGET_RUN_PIN, INPUT_PULLDOWN);
+    running = digitalRead(TARGET_RUN_PIN) == HIGH;
+#endif
+
+    if (running) {
+      intf.statusMsgf("target running");
+      return finished();
+    }
 
+    if (static_cast<int32_t>(millis() - handshakeUntil) >= 0) {
+      intf.errorMsg("target didn't start");
+      return false;
+    }
+    return true;
+  }
+
+  bool Flasher::finished() {
+    phaseDone(stats.finishTime);
+
+    if (serialize && !Serialization::commit()) {
+      // fail this unit, otherwise the next would get the same serial data
+      intf.errorMsg("serial state write failed");
+      return false;
+    }
+
+    state = State::done;
     return true;
   }
 
+  const FlashStats& Flasher::report() {
+    stats.success = state == State::done;
+    if (state == State::failed && failedIn != State::done)
+      phaseDone(phaseTime(failedIn));
+        // the time spent in the phase that failed counts too
+    stats.totalTime = micros() - startAt;
+    stats.swdClock = LinkHealth::clock();
+    intf.stats(stats);
+
+    LinkHealth::done(stats.success && stats.swdErrors == 0);
+    intf.link(LinkHealth::stats());
+    return stats;
+  }
+
+  void Flasher::phaseDone(uint32_t& phaseTime) {
+    auto now = micros();
+    phaseTime += now - phaseAt;
+    phaseAt = now;
+  }
+
+  uint32_t& Flasher::phaseTime(State in) {
+    switch (in) {
+      case State::connect:
+        return restarted ? stats.fuseTime : stats.connectTime;
+      case State::fuses:      return stats.fuseTime;
+      case State::program:    return stats.programTime;
+      case State::reconnect:  return phaseTime(resumeState);
+      case State::verify:
+      case State::confirm:    return stats.verifyTime;
+      default:                return stats.finishTime;
+    }
+  }
+
+  int Flasher::readImage(size_t len) {
+    Profiler::Scope scope(Profiler::Region::readNextBlock);
+    return image.readNextBlock(bufFile, len);
+  }
+
+  uint32_t Flasher::readWord(uint32_t addr) {
+    SwdTrace::Call call(SwdTrace::Op::readWord, addr);
+    call.data = target->dap().dap_read_word(addr);
+    return call.data;
+  }
+
+  void Flasher::writeWord(uint32_t addr, uint32_t data) {
+    SwdTrace::Call call(SwdTrace::Op::writeWord, addr, data);
+    target->dap().dap_write_word(addr, data);
+  }
+
+  void Flasher::readBlock(uint32_t addr, uint8_t* buf) {
+    Profiler::Scope scope(Profiler::Region::dapReadBlock);
+    SwdTrace::Call call(SwdTrace::Op::readBlock, addr, target->pageSize());
+    target->readBlock(addr, buf);
+    stats.swdReceived += target->pageSize();
+  }
+
+  void Flasher::programBlock(uint32_t addr, const uint8_t* buf) {
+    Profiler::Scope scope(Profiler::Region::programBlock);
+    SwdTrace::Call call(SwdTrace::Op::programBlock, addr, target->pageSize());
+    target->programBlock(addr, buf);
+    stats.swdSent += target->pageSize();
+    if (addr % target->eraseSize() == 0)
+      stats.rowsErased += 1;
+    stats.rowsWritten += 1;
+  }
+
+  void Flasher::fuseRead() {
+    SwdTrace::Call call(SwdTrace::Op::fuseRead);
+    target->fuseRead(); // fuse operations don't return a result (!)
+    call.data = target->fuses().word[0];
+    stats.swdReceived += target->fuseSize();
+  }
+
+  void Flasher::readSerial() {
+    auto addrs = target->serialAddrs();
+    for (int i = 0; i < 4; ++i)
+      stats.serial[i] = readWord(addrs[i]);
+    stats.swdReceived += sizeof(stats.serial);
+  }
+
+  void Flasher::fuseWrite() {
+    SwdTrace::Call call(SwdTrace::Op::fuseWrite, 0, target->fuses().word[0]);
+    target->fuseWrite();
+    stats.swdSent += target->fuseSize();
+    stats.rowsErased += 1;
+    stats.rowsWritten += 1;
+  }
+
 
   bool Flasher::dap_error() {
-    intf.errorMsg(dap.error_message);
+    if (state != State::reconnect)    // failures are expected then
+      intf.errorMsg(target->dap().error_message);
     return false;
   }
 
   void Flasher::error(const char* text) {
+    bool linkError = false;
+    if (current) {
+      current->faulted = true;
+
+      // Only errors talking to a target known to be there say anything
+      // about the link: others are expected, when there is no target yet,
+      // or it is restarting.
+      switch (current->state) {
+        case State::fuses:
+        case State::program:
+        case State::verify:
+        case State::confirm:
+        case State::finish:
+          current->stats.swdErrors += 1;
+          LinkHealth::error();
+          linkError = true;
+          break;
+        default:
+          break;
+      }
+    }
+
     if (strcmp(text, ")") == 0) {
       // The DAP library prints some error messages directly to Serial, except
       // for the closing ')' which it prints by calling the error function.
-      Serial.println(text); // clean up the Serial output
+#ifdef MF_TELEMETRY
+      Serial.println(text);
+        // Straight after the library's text, which bypassed the ring and may
+        // be in the middle of an event: the line is spoilt either way, but
+        // ending it here keeps the next event on a line of its own.
+#else
+      serialOut.println(text); // clean up the Serial output
+#endif
       text = "invalid response";
     }
-    if (current) {
-      // should handle the absurd ")" case
+    SwdTrace::error(text, linkError);
+      // the library's own message went to Serial: keep what led up to it
+    if (current && current->state != State::reconnect
+        && current->state != State::handshake) {
+      // errors are expected in those, while the target is away or booting
       current->intf.errorMsgf("DAP error: %s", text);
     }
   }
 
+
+  Flasher* flasher = NULL;    // the flashing in progress, if any
+
+  bool probeFaulted;
+  void probeError(const char* text) { probeFaulted = true; }
 }
 
 namespace FlashManager {
 
-  bool program(Interface& intf, FilesToFlash& ftf) {
-    Flasher flasher(intf);
-    return flasher.start() && flasher.program(ftf);
+  bool targetPresent() {
+    if (flasher || LinkBench::busy())
+      return true;    // don't disturb it!
+
+    // Looks for a target without resetting or halting it, so it is safe to
+    // do repeatedly while a target is attached and running.
+    // Failures are expected, and not reported.
+    Adafruit_DAP_SAM dap;
+    probeFaulted = false;
+    dap.begin(TARGET_SWCLK, TARGET_SWDIO, TARGET_SWRST, &probeError);
+
+    bool present =
+      dap.dap_disconnect()
+      && dap.dap_connect()
+      && dap.dap_transfer_configure(0, 128, 128)
+      && dap.dap_swd_configure(0)
+      && dap.dap_reset_link()
+      && dap.dap_swj_clock(LinkHealth::clock())
+      && dap.dap_target_prepare();
+
+    if (present) {
+      const uint32_t DSU_DID = 0x41002018;
+      uint32_t did = dap.dap_read_word(DSU_DID);
+      present = !probeFaulted && did != 0 && did != 0xffffffff;
+    }
+
+    dap.dap_disconnect();
+    return present;
+  }
+
+  bool start(Interface& intf, ImageSource& image) {
+    if (flasher)
+      return false;
+
+    flasher = new Flasher(intf, image);
+    return true;
+  }
+
+  bool busy() {
+    return flasher != NULL;
+  }
+
+  void run(uint32_t slice) {
+    if (!flasher)
+      return;
+
+    auto startAt = micros();
+    bool more;
+    do {
+      more = flasher->step();
+    } while (more && micros() - startAt < slice);
+
+    if (!more) {
+      auto& stats = flasher->report();
+      ProductionLog::record(stats);
+      TargetHistory::record(stats);
+      delete flasher;
+      flasher = NULL;
+    }
+  }
+
+  void abort(const char* why) {
+    if (flasher)
+      flasher->abort(why);
   }
 
 }
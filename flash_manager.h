@@ -1,12 +1,22 @@
 #ifndef _FLASH_MANAGER_H_
 #define _FLASH_MANAGER_H_
 
-#include "file_manager.h"
+#include "image_source.h"
 #include "interface.h"
 
 namespace FlashManager {
 
-  bool program(Interface&, FilesToFlash&);
+  bool targetPresent();
+    // checks for an attached target without disturbing it
+
+  bool start(Interface&, ImageSource&);
+  bool busy();
+  void run(uint32_t slice);
+    // Flashing proceeds only in calls to run(), which returns after the step
+    // that takes it past slice microseconds. It ends, successfully or not,
+    // in the last of these calls, and then busy() will be false.
+  void abort(const char* why);
+    // stops the flashing in progress at the next call to run()
 
 }
 
@@ -0,0 +1,26 @@
+#ifndef _IMAGE_SOURCE_H_
+#define _IMAGE_SOURCE_H_
+
+#include <cstddef>
+#include <cstdint>
+
+// Where the image being flashed comes from: the binaries on the drive, or
+// a stream from the host. It is read a block at a time, from the start, and
+// is read through once for each pass of flashing.
+
+class ImageSource {
+public:
+  virtual size_t imageSize() = 0;
+  virtual uint32_t imageCrc() = 0;
+
+  virtual void rewind() = 0;
+  virtual bool ready(size_t blockSize) { return true; }
+    // false if reading the next block would have to wait; try again later
+  virtual int readNextBlock(uint8_t* buf, size_t blockSize) = 0;
+    // returns the bytes read, 0 at the end, or -1 on error
+
+  virtual bool patchable() { return true; }
+    // if Serialization patches apply to this image
+};
+
+#endif // _IMAGE_SOURCE_H_
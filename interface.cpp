@@ -46,7 +46,11 @@ void InterfaceBase::binaries(
   size_t appSize, const char* appName)
   { }
 
-void InterfaceBase::progress(Burn phase, size_t done, size_t size) { }
+void InterfaceBase::progress(const Progress& p) { }
+void InterfaceBase::stats(const FlashStats& s) { }
+void InterfaceBase::link(const LinkStats& s) { }
+void InterfaceBase::linkBench(const LinkBenchResult& r) { }
+void InterfaceBase::memory(const MemoryStats& s) { }
 
 
 
@@ -70,6 +74,51 @@ void InterfaceList::clearMsg()                 { for (auto&& i : ifs) i->clearMs
 void InterfaceList::binaries(size_t bs, const char* bn, size_t as, const char* an)
   { for (auto&& i : ifs) i->binaries(bs, bn, as, an); }
 
-void InterfaceList::progress(Burn phase, size_t done, size_t size)
-  { for (auto&& i : ifs) i->progress(phase, done, size); }
+void InterfaceList::progress(const Progress& p)
+  { for (auto&& i : ifs) i->progress(p); }
+
+void InterfaceList::stats(const FlashStats& s)
+  { for (auto&& i : ifs) i->stats(s); }
+void InterfaceList::link(const LinkStats& s)
+  { for (auto&& i : ifs) i->link(s); }
+void InterfaceList::linkBench(const LinkBenchResult& r)
+  { for (auto&& i : ifs) i->linkBench(r); }
+void InterfaceList::memory(const MemoryStats& s)
+  { for (auto&& i : ifs) i->memory(s); }
+
+
+
+ProgressThrottle::ProgressThrottle(Interface& intf, size_t size, uint32_t perSecond)
+  : intf(intf), interval(1000 / perSecond)
+{
+  current.phase = Burn::complete;
+  current.done = 0;
+  current.size = size;
+  current.elapsed = 0;
+  current.rate = 0;
+  current.remaining = 0;
+
+  phaseStartAt = lastAt = millis();
+}
+
+void ProgressThrottle::emit(Burn phase, size_t done) {
+  auto now = millis();
+
+  if (phase != current.phase) {
+    current.phase = phase;
+    phaseStartAt = now;
+  }
+  lastAt = now;
+
+  current.done = min(done, current.size);
+  current.elapsed = now - phaseStartAt;
+  current.rate = current.elapsed > 0
+    ? static_cast<uint32_t>((uint64_t(current.done) * 1000) / current.elapsed)
+    : 0;
+  current.remaining = current.rate > 0
+    ? static_cast<uint32_t>((uint64_t(current.size - current.done) * 1000) / current.rate)
+    : 0;
+
+  intf.progress(current);
+}
 
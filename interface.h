@@ -2,13 +2,21 @@
 #define _INCLUDE_INTERFACE_H_
 
 #include <cstddef>
+#include <cstdint>
 #include <forward_list>
 #include <initializer_list>
 
+#include <Arduino.h>
+
 
 enum struct Event {
   idle,
-  startFlash
+  startFlash,   // from a button
+  autoStart,    // from a target being attached
+  streamFlash,  // from a job sent by the host over USB serial
+  nextProfile,  // from buttons, to change the binaries flashed
+  prevProfile,
+  linkBench,    // from buttons or the host, to measure the SWD link
 };
 
 enum struct Burn {
@@ -17,6 +25,89 @@ enum struct Burn {
   complete,
 };
 
+struct Progress {
+  Burn      phase;
+  size_t    done;         // bytes
+  size_t    size;         // bytes
+  uint32_t  elapsed;      // ms since the phase started
+  uint32_t  rate;         // bytes per second, so far in this phase
+  uint32_t  remaining;    // ms, estimated time left in this phase
+};
+
+struct FlashStats {
+  bool      success;
+  size_t    imageSize;
+  uint32_t  imageCrc;     // CRC-32 of the binaries, as flashed
+
+  uint32_t  deviceId;     // DSU DID, zero if no target was found
+  uint32_t  serial[4];    // the target's 128 bit serial number
+  uint32_t  fuses[3];     // the user row, as left: its first two words,
+                          // and the region locks of a SAMx5
+  bool      confirmed;    // flashed before with this image, so only verified
+
+  // time spent in each phase, in microseconds
+  uint32_t  connectTime;  // connecting to and preparing the target
+  uint32_t  fuseTime;     // reading & writing fuses, restarting the target
+  uint32_t  programTime;  // the program pass
+  uint32_t  verifyTime;   // the verify pass
+  uint32_t  finishTime;   // final fuse write and target restart
+  uint32_t  totalTime;
+
+  // bytes moved
+  uint32_t  storageRead;  // from the binaries on the drive
+  uint32_t  swdSent;      // to the target
+  uint32_t  swdReceived;  // from the target
+
+  // flash rows touched on the target, including the user row
+  uint32_t  rowsErased;
+  uint32_t  rowsWritten;
+
+  // recovery from errors
+  uint32_t  retries;      // pages tried again after an error
+  uint32_t  reconnects;   // times the target went away and came back
+
+  // the SWD link
+  uint32_t  swdErrors;    // reported by the DAP library
+  uint32_t  swdClock;     // in use at the end
+};
+
+struct LinkCounters {
+  uint32_t  units;        // flashed, or attempted
+  uint32_t  errors;       // reported by the DAP library
+  uint32_t  downshifts;   // times the clock was lowered
+  uint32_t  upshifts;     // and raised again
+};
+
+struct LinkStats {
+  uint32_t      swdClock;   // in use now
+  uint32_t      deviceType; // DSU DID, less the die and revision
+  LinkCounters  port;       // everything flashed through the SWD port
+  LinkCounters  device;     // just the device type
+};
+
+struct LinkBenchResult {
+  static const int readSizes = 4;
+
+  uint32_t  swdClock;
+  uint32_t  accessTime;             // ns, for a single register read
+  uint32_t  writeRate;              // bytes/s, to target RAM
+  uint16_t  readSize[readSizes];    // bytes per block read
+  uint32_t  readRate[readSizes];    // bytes/s, from target flash
+  uint32_t  errors;   // reported by the DAP library, or bad data read back
+};
+
+struct MemoryStats {
+  // RAM, and how it is used, in bytes
+  uint32_t  ramStart;     // address
+  uint32_t  ramSize;
+  uint32_t  data;         // static data, initialized
+  uint32_t  bss;          // static data, zeroed
+  uint32_t  heap;         // taken by the allocator, which never gives it back
+  uint32_t  heapInUse;    // of that, allocated now
+  uint32_t  stack;        // the deepest the stack has been
+  uint32_t  free;         // between the heap and the deepest stack
+};
+
 class Interface {
 public:
   virtual void setup() = 0;
@@ -36,7 +127,11 @@ public:
     size_t appSize, const char* appName)
     = 0;
 
-  virtual void progress(Burn phase, size_t done, size_t size) = 0;
+  virtual void progress(const Progress&) = 0;
+  virtual void stats(const FlashStats&) = 0;
+  virtual void link(const LinkStats&) = 0;
+  virtual void linkBench(const LinkBenchResult&) = 0;
+  virtual void memory(const MemoryStats&) = 0;
 };
 
 
@@ -58,7 +153,11 @@ public:
     size_t bootSize, const char* bootName,
     size_t appSize, const char* appName);
 
-  void progress(Burn phase, size_t done, size_t size);
+  void progress(const Progress&);
+  void stats(const FlashStats&);
+  void link(const LinkStats&);
+  void linkBench(const LinkBenchResult&);
+  void memory(const MemoryStats&);
 };
 
 
@@ -84,7 +183,11 @@ public:
     size_t bootSize, const char* bootName,
     size_t appSize, const char* appName);
 
-  void progress(Burn phase, size_t done, size_t size);
+  void progress(const Progress&);
+  void stats(const FlashStats&);
+  void link(const LinkStats&);
+  void linkBench(const LinkBenchResult&);
+  void memory(const MemoryStats&);
 
 private:
   std::forward_list<Interface*> ifs;
@@ -92,11 +195,43 @@ private:
 
 
 
+/* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+// Progress throttle
+//
+// Called once per block by the flashing loops, this passes progress on to
+// the interfaces at most perSecond times a second, plus on every phase
+// change and at the end of each phase.
+
+class ProgressThrottle {
+public:
+  ProgressThrottle(Interface& intf, size_t size, uint32_t perSecond = 8);
+
+  void update(Burn phase, size_t done) {
+    if (phase != current.phase || done >= current.size
+        || millis() - lastAt >= interval)
+      emit(phase, done);
+  }
+
+private:
+  Interface& intf;
+  Progress current;
+  uint32_t phaseStartAt;
+  uint32_t lastAt;
+  const uint32_t interval;
+
+  void emit(Burn phase, size_t done);
+};
+
+
+
 /* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
 // Utilities
 
 template< typename T >
 T sizeInK(T s) { return (s + 1023) / 1024; }
 
+inline uint32_t bytesPerSec(size_t bytes, uint32_t micros)
+  { return micros > 0 ? static_cast<uint32_t>(uint64_t(bytes) * 1000000 / micros) : 0; }
+
 
 #endif // _INCLUDE_INTERFACE_H_
@@ -0,0 +1,119 @@
+#include "config.h"
+
+#ifdef MF_AUTO_START
+  // The Arduino IDE compiles all files... but this code is only needed if
+  // the feature is enabled
+
+#include "intf_autostart.h"
+
+#include <Arduino.h>
+
+#include "flash_manager.h"
+
+// Starts flashing, without a button press, when a target is attached.
+//
+// Attachment is detected either by a sense pin, wired to the target's
+// ground on the connector so that it is pulled low when a target is
+// plugged in, or failing that, by periodically probing for a target over
+// SWD. Once flashing has been started, nothing more happens until the
+// target is detached; if it couldn't be started for the moment, it is
+// tried again.
+
+namespace {
+
+#ifdef TARGET_SENSE
+  volatile uint32_t senseChangedAt = 0;
+
+  void senseChanged() {
+    senseChangedAt = millis();
+  }
+
+  const uint32_t settleTime = 250;    // ms the sense pin must be steady
+#else
+  const uint32_t probeInterval = 500; // ms between SWD probes
+  const int probesNeeded = 3;         // consecutive, to change state
+#endif
+
+  const uint32_t retryInterval = 1000;  // ms, after a start is rejected
+
+  class AutoStartInterface : public InterfaceBase {
+  public:
+    void setup() {
+#ifdef TARGET_SENSE
+      pinMode(TARGET_SENSE, INPUT_PULLUP);
+      attachInterrupt(digitalPinToInterrupt(TARGET_SENSE), senseChanged, CHANGE);
+      senseChangedAt = millis();
+#endif
+    }
+
+    Event loop() {
+      bool present;
+      if (!detect(present))
+        return Event::idle;
+
+      if (!armed) {
+        if (!present)
+          armed = true;   // detached: ready for the next target
+        return Event::idle;
+      }
+
+      if (present && static_cast<int32_t>(millis() - retryAt) >= 0) {
+        armed = false;
+        return Event::autoStart;
+      }
+      return Event::idle;
+    }
+
+    void rejected() {
+      // say, while the drive is still being written: try again later
+      armed = true;
+      retryAt = millis() + retryInterval;
+    }
+
+  private:
+    bool armed = true;
+    uint32_t retryAt = 0;
+
+#ifdef TARGET_SENSE
+    bool detect(bool& present) {
+      // a settled sense pin, or false if it is still bouncing
+      if (millis() - senseChangedAt < settleTime)
+        return false;
+      present = digitalRead(TARGET_SENSE) == LOW;
+      return true;
+    }
+#else
+    uint32_t nextProbeAt = 0;
+    bool probed = false;
+    int probeCount = 0;
+
+    bool detect(bool& present) {
+      // a stable probe result, or false if it is still changing
+      if (static_cast<int32_t>(millis() - nextProbeAt) < 0)
+        return false;
+      nextProbeAt = millis() + probeInterval;
+
+      bool p = FlashManager::targetPresent();
+      if (p != probed) {
+        probed = p;
+        probeCount = 0;
+      }
+      if (probeCount < probesNeeded)
+        probeCount += 1;
+
+      present = probed;
+      return probeCount >= probesNeeded;
+    }
+#endif
+  };
+
+  AutoStartInterface autoStartInterface_;
+}
+
+Interface& autoStartInterface = autoStartInterface_;
+
+void autoStartRejected() {
+  autoStartInterface_.rejected();
+}
+
+#endif // MF_AUTO_START
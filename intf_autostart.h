@@ -0,0 +1,13 @@
+#ifndef _INTF_AUTOSTART_H_
+#define _INTF_AUTOSTART_H_
+
+#include "interface.h"
+
+extern Interface& autoStartInterface;
+
+void autoStartRejected();
+  // the autoStart event didn't start flashing, but only for the moment
+  // (busy, or the drive being written): it is sent again, shortly, if the
+  // target is still attached
+
+#endif // _INTF_AUTOSTART_H_
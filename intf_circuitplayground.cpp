@@ -39,11 +39,11 @@ namespace {
         if (appSize > 0)    CircuitPlayground.setPixelColor(1, 30, 100, 30);
       }
 
-    void progress(Burn phase, size_t done, size_t size) {
-      int n = (done * 10 + done / 2) / size;
+    void progress(const Progress& p) {
+      int n = (p.done * 10 + p.done / 2) / p.size;
 
       CircuitPlayground.strip.clear();
-      switch (phase) {
+      switch (p.phase) {
         case Burn::programming:
           for (int i = 0; (i + 1) <= n; ++i)
             CircuitPlayground.strip.setPixelColor(i, 100, 30, 100);
@@ -61,7 +61,7 @@ namespace {
       }
       CircuitPlayground.strip.show();
 
-      if (phase == Burn::complete) {
+      if (p.phase == Burn::complete) {
         CircuitPlayground.speaker.enable(true);
         CircuitPlayground.playTone(180, 200, true);
         CircuitPlayground.playTone(240, 100, true);
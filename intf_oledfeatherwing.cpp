@@ -5,6 +5,8 @@
 #include <Adafruit_GFX.h>
 #include <Adafruit_SSD1306.h>
 
+#include "profiler.h"
+
 
 
 // OLED FeatherWing buttons map to different pins depending on board:
@@ -37,6 +39,47 @@
 
 namespace {
 
+  // Tracks a button's state, once it has been steady for the debounce time
+  class Button {
+  public:
+    Button(int pin) : pin(pin) { }
+
+    void setup() {
+      pinMode(pin, INPUT_PULLUP);
+      lastState = state = HIGH;
+      validAt = 0;
+    }
+
+    void update() {
+      // call once per loop, before the others
+      changed = false;
+      auto b = digitalRead(pin);
+      if (b == lastState) {
+        if (validAt > 0) {
+          if (validAt <= millis()) {
+            validAt = 0;
+            changed = b != state;
+            state = b;
+          } // else still waiting for valid time
+        } // else long since reported this
+      } else {
+        lastState = b;
+        validAt = millis() + 50; // debounce time
+      }
+    }
+
+    bool down() const     { return state == LOW; }
+    bool pressed() const  { return changed && state == LOW; }
+    bool released() const { return changed && state == HIGH; }
+
+  private:
+    const int pin;
+    int lastState;
+    int state;
+    uint32_t validAt;
+    bool changed = false;
+  };
+
   class OledFeatherwing : public InterfaceBase {
   public:
     void setup() {
@@ -51,30 +94,34 @@ namespace {
       display.setTextWrap(false);
 
       display.println("Multi-Flash");
-      display.display();
+      show();
 
-      pinMode(OLED_FEATHERWING_BUTTON_A, INPUT_PULLUP);
-      lastButtonState = HIGH;
-      buttonValidAt = 0;
+      buttonA.setup();
+      buttonB.setup();
+      buttonC.setup();
     }
 
     Event loop() {
-      auto b = digitalRead(OLED_FEATHERWING_BUTTON_A);
-      if (b == lastButtonState) {
-        if (buttonValidAt > 0) {
-          if (buttonValidAt <= millis()) {
-            buttonValidAt = 0;
-            if (b == LOW) {
-              return Event::startFlash;
-            }
-          } // else still waiting for valid time
-        } // else long since reported this
-      } else {
-        lastButtonState = b;
-        buttonValidAt = millis() + 50; // debounce time
+      buttonA.update();
+      buttonB.update();
+      buttonC.update();
+
+      if (buttonA.pressed())  return Event::startFlash;
+
+      // B and C change profile when released, so that holding both down
+      // can run the link bench without changing profile as well.
+      auto event = Event::idle;
+      if (buttonB.down() && buttonC.down()) {
+        if (!chord)
+          event = Event::linkBench;
+        chord = true;
+      } else if (!chord) {
+        if (buttonB.released())       event = Event::nextProfile;
+        else if (buttonC.released())  event = Event::prevProfile;
       }
-
-      return Event::idle;
+      if (!buttonB.down() && !buttonC.down())
+        chord = false;
+      return event;
     }
 
     void startMsg(const char* msg)  { textLine(1, false, msg); }
@@ -90,30 +137,44 @@ namespace {
       binaryLine(3, "app", appSize, appName);
     }
 
-    void progress(Burn phase, size_t done, size_t size) {
+    void progress(const Progress& p) {
       const char* leadin;
+      size_t done = p.done;
 
-      switch (phase) {
+      switch (p.phase) {
         case Burn::programming:   leadin = "burn";  break;
         case Burn::verifying:     leadin = "vrfy";  break;
         case Burn::complete:      leadin = "done";  done = 0;  break;
       }
 
-      uint16_t x = static_cast<uint16_t>((done * 100 + 50) / size);
+      uint16_t x = static_cast<uint16_t>((done * 100 + 50) / p.size);
 
       display.fillRect( 0, 24, 128, 8, BLACK);
       display.fillRect(28, 24,   x, 8, WHITE);
       display.setTextColor(WHITE);
       display.setCursor(0, 24);
       display.print(leadin);
-      display.display();
+      show();
    }
 
+    void stats(const FlashStats& s) {
+      if (!s.success)
+        return;   // leave the error message showing
+
+      char msg[32];
+      snprintf(msg, sizeof(msg), "done %lu.%lus %luk/s",
+        s.totalTime / 1000000, (s.totalTime / 100000) % 10,
+        sizeInK(bytesPerSec(s.imageSize, s.totalTime)));
+      textLine(4, false, msg);
+    }
+
   private:
     Adafruit_SSD1306 display = Adafruit_SSD1306(128, 32, &Wire);
 
-    int lastButtonState;
-    uint32_t buttonValidAt;
+    Button buttonA = Button(OLED_FEATHERWING_BUTTON_A);
+    Button buttonB = Button(OLED_FEATHERWING_BUTTON_B);
+    Button buttonC = Button(OLED_FEATHERWING_BUTTON_C);
+    bool chord = false;   // B and C have been down together
 
     void binaryLine(int line, const char* type, size_t size, const char* name) {
       char s[64];
@@ -124,6 +185,11 @@ namespace {
       textLine(line, false, s);
     }
 
+    void show() {
+      Profiler::Scope scope(Profiler::Region::display);
+      display.display();
+    }
+
     void textLine(int line, bool invert, const char* msg) {
       int16_t y = 8 * (line - 1);
 
@@ -131,7 +197,7 @@ namespace {
       display.setTextColor(invert ? BLACK : WHITE);
       display.setCursor(invert ? 1 : 0, y);
       display.print(msg);
-      display.display();
+      show();
     }
   };
 
@@ -3,6 +3,7 @@
 #include <Arduino.h>
 
 #include "config.h"
+#include "serial_out.h"
 
 namespace {
 
@@ -22,25 +23,30 @@ namespace {
       Serial.begin(115200);
     }
 
+    Event loop() {
+      serialOut.pump();
+      return Event::idle;
+    }
+
     void startMsg(const char* msg) {
       ready();
-      Serial.println();
-      Serial.println();
-      Serial.println(msg);
+      serialOut.println();
+      serialOut.println();
+      serialOut.println(msg);
       for (auto i = strlen(msg); i; --i)
-        Serial.print('-');
-      Serial.println();
+        serialOut.print('-');
+      serialOut.println();
     }
 
     void statusMsg(const char* msg) {
       ready();
-      Serial.println(msg);
+      serialOut.println(msg);
     }
 
     void errorMsg(const char* msg) {
       ready();
-      Serial.print("** ");
-      Serial.println(msg);
+      serialOut.print("** ");
+      serialOut.println(msg);
     }
 
     void binaries(
@@ -49,42 +55,105 @@ namespace {
     {
       ready();
 
-      if (bootSize > 0) Serial.printf("> boot: %3dk %s\n", sizeInK(bootSize), bootName);
-      else              Serial.printf("> boot: ---  no binary\n");
+      if (bootSize > 0) serialOut.printf("> boot: %3dk %s\n", sizeInK(bootSize), bootName);
+      else              serialOut.printf("> boot: ---  no binary\n");
 
-      if (appSize > 0)  Serial.printf("> app:  %3dk %s\n", sizeInK(appSize), appName);
-      else              Serial.printf("> app:  ---  no binary\n");
+      if (appSize > 0)  serialOut.printf("> app:  %3dk %s\n", sizeInK(appSize), appName);
+      else              serialOut.printf("> app:  ---  no binary\n");
 
-      Serial.println();
+      serialOut.println();
     }
 
   private:
     Burn progressPhase = Burn::complete;
     int  progressPct = 0;
+    uint32_t progressRate = 0;
 
   public:
-    void progress(Burn phase, size_t done, size_t size) {
+    void progress(const Progress& p) {
       ready();
 
-      if (phase != progressPhase) {
-        progressPhase = phase;
+      if (p.phase != progressPhase) {
+        if (progressPhase != Burn::complete)
+          serialOut.printf(" (%luk/s)", sizeInK(progressRate));
+
+        progressPhase = p.phase;
         progressPct = 0;
 
-        switch (phase) {
-          case Burn::programming:   Serial.print("programming: ");  break;
-          case Burn::verifying:     Serial.print("\nverifying:  "); break;
-          case Burn::complete:      Serial.print("\ndone\n");       return;
+        switch (p.phase) {
+          case Burn::programming:   serialOut.print("programming: ");  break;
+          case Burn::verifying:     serialOut.print("\nverifying:  "); break;
+          case Burn::complete:      serialOut.print("\ndone\n");       return;
         }
       }
+      progressRate = p.rate;
 
-      int pct = static_cast<int>((done * 10) / size) * 10;
+      int pct = static_cast<int>((p.done * 10) / p.size) * 10;
 
       if (pct != progressPct) {
         progressPct = pct;
 
-        Serial.printf("..%2d%%", pct);
+        serialOut.printf("..%2d%%", pct);
       }
     }
+
+    void stats(const FlashStats& s) {
+      ready();
+
+      if (s.deviceId)
+        serialOut.printf("> target  %08lx, serial %08lx%08lx%08lx%08lx\n",
+          s.deviceId, s.serial[0], s.serial[1], s.serial[2], s.serial[3]);
+      if (s.imageCrc)
+        serialOut.printf("> image   crc %08lx%s\n", s.imageCrc,
+          s.confirmed ? ", already flashed: verified only" : "");
+      serialOut.printf("> connect %6lu ms\n", s.connectTime / 1000);
+      serialOut.printf("> fuses   %6lu ms\n", s.fuseTime / 1000);
+      serialOut.printf("> program %6lu ms\n", s.programTime / 1000);
+      serialOut.printf("> verify  %6lu ms\n", s.verifyTime / 1000);
+      serialOut.printf("> finish  %6lu ms\n", s.finishTime / 1000);
+      serialOut.printf("> total   %6lu ms, %luk/s\n", s.totalTime / 1000,
+        sizeInK(bytesPerSec(s.imageSize, s.totalTime)));
+      serialOut.printf("> storage %luk read, swd %luk sent, %luk received\n",
+        sizeInK(s.storageRead), sizeInK(s.swdSent), sizeInK(s.swdReceived));
+      serialOut.printf("> rows    %lu erased, %lu written\n",
+        s.rowsErased, s.rowsWritten);
+      serialOut.printf("> swd     clock %lu, %lu errors", s.swdClock, s.swdErrors);
+      if (s.retries || s.reconnects)
+        serialOut.printf(", %lu retries, %lu reconnects", s.retries, s.reconnects);
+      serialOut.println();
+    }
+
+    void link(const LinkStats& s) {
+      // follows stats()
+      linkLine("port", s.port);
+      if (s.deviceType) {
+        char label[16];
+        snprintf(label, sizeof(label), "%08lx", s.deviceType);
+        linkLine(label, s.device);
+      }
+      serialOut.println();
+    }
+
+    void linkBench(const LinkBenchResult& r) {
+      serialOut.printf("> bench   %lu Hz: access %lu ns, write %luk/s, read",
+        r.swdClock, r.accessTime, sizeInK(r.writeRate));
+      for (int i = 0; i < LinkBenchResult::readSizes; ++i)
+        serialOut.printf(" %u:%luk/s", r.readSize[i], sizeInK(r.readRate[i]));
+      serialOut.printf(", %lu errors\n", r.errors);
+    }
+
+    void memory(const MemoryStats& s) {
+      serialOut.printf("> memory  ram %08lx, %luk: data %lu, bss %lu, "
+        "heap %lu (%lu in use), stack %lu deepest, %lu free\n",
+        s.ramStart, sizeInK(s.ramSize), s.data, s.bss,
+        s.heap, s.heapInUse, s.stack, s.free);
+    }
+
+  private:
+    void linkLine(const char* label, const LinkCounters& c) {
+      serialOut.printf("> link    %s: %lu units, %lu errors, clock lowered %lu, raised %lu\n",
+        label, c.units, c.errors, c.downshifts, c.upshifts);
+    }
   };
 
   SerialInterface serialInterface_;
@@ -0,0 +1,285 @@
+#include "config.h"
+
+#ifdef MF_STREAM
+  // The Arduino IDE compiles all files... but this code is only needed if
+  // the feature is enabled
+
+#include "intf_stream.h"
+
+#include <Arduino.h>
+#include <cstdarg>
+#include <cstdlib>
+#include <cstring>
+
+#include "crc32.h"
+#include "flash_manager.h"
+#include "serial_out.h"
+
+// Flashes an image streamed from the host over USB serial, without it ever
+// being stored on the drive.
+//
+// Lines between the host and the programmer that start with "#!" are the
+// protocol; the host should pass any other lines through as messages.
+//
+//    host:         #!job <size> <crc32 in hex>
+//    programmer:   #!ok                       or #!err <why>
+//    programmer:   #!need <offset> <length>   repeated
+//    host:         exactly <length> bytes of the image, from <offset>
+//    programmer:   #!done pass                or #!done fail
+//
+// The host can also send "#!bench" to run the SWD link bench, whose results
+// come back as messages.
+//
+// The programmer asks for each part of the image as it has room for it, so
+// flow control is in its hands. It reads the image once for each pass of
+// flashing, so it asks for it all again for the verify pass. The host must
+// answer requests in order. tools/stream-flash.py is a host for this.
+
+namespace {
+
+  const uint32_t dataTimeout = 2000;    // ms to wait for requested data
+  const uint32_t sendTimeout = 100;     // ms to wait for room to send a line
+
+  size_t startLine(char* line) {
+    // Protocol lines must start a line, even if a message, such as the
+    // progress dots, left one unfinished.
+    if (serialOut.atLineStart())
+      return 0;
+    line[0] = '\n';
+    return 1;
+  }
+
+  bool send(const char* fmt, ...) {
+    // Protocol lines must go whole: unlike messages, they can't be dropped
+    // if the output is backed up, so wait a little for room.
+    char line[48];
+    auto n = startLine(line);
+    va_list ap;
+    va_start(ap, fmt);
+    n += vsnprintf(line + n, sizeof(line) - n, fmt, ap);
+    va_end(ap);
+
+    auto startAt = millis();
+    while (!serialOut.writeWhole(reinterpret_cast<const uint8_t*>(line), n)) {
+      if (millis() - startAt > sendTimeout)
+        return false;
+      yield();
+    }
+    return true;
+  }
+
+  class StreamImage : public ImageSource {
+  public:
+    void begin(size_t size, uint32_t crc);
+    void end(const char* result);
+    bool active() const { return active_; }
+    void poll();
+
+    size_t imageSize() { return size; }
+    uint32_t imageCrc() { return crc; }
+
+    void rewind();
+    bool ready(size_t blockSize);
+    int readNextBlock(uint8_t* buf, size_t blockSize);
+
+    bool patchable() { return false; }
+      // streamed images are for development: not serialized
+
+  private:
+    static const size_t ringSize = 2048;    // must be a power of two
+    static const size_t chunkSize = 512;    // largest request
+
+    uint8_t ring[ringSize];
+
+    bool active_ = false;
+    bool failed = false;
+    size_t size = 0;
+    uint32_t crc = 0;
+
+    // offsets into the image
+    uint32_t requested = 0;   // asked for up to here
+    uint32_t received = 0;    // arrived, and in the ring, up to here
+    uint32_t consumed = 0;    // read out of the ring up to here
+
+    uint32_t discard = 0;     // bytes still to arrive from before a rewind
+    uint32_t passCrc = 0;     // of the bytes read so far this pass
+    uint32_t waitingSince = 0;
+
+    bool waiting() const { return discard > 0 || received < requested; }
+    void request();
+  };
+
+  void StreamImage::begin(size_t size, uint32_t crc) {
+    this->size = size;
+    this->crc = crc;
+    active_ = true;
+    failed = false;
+    requested = received = consumed = 0;
+    passCrc = 0;
+  }
+
+  void StreamImage::end(const char* result) {
+    if (!active_)
+      return;
+    active_ = false;
+    discard += requested - received;
+    requested = received = consumed = 0;
+
+    send("#!done %s\n", result);
+  }
+
+  void StreamImage::rewind() {
+    discard += requested - received;
+    requested = received = consumed = 0;
+    passCrc = 0;
+  }
+
+  void StreamImage::poll() {
+    while (waiting()) {
+      int avail = Serial.available();
+      if (avail <= 0)
+        break;
+
+      // Into the ring, even if discarded: a discard happens only at a
+      // rewind, or at the end, when the ring is free.
+      auto at = received & (ringSize - 1);
+      size_t n = discard > 0 ? discard : requested - received;
+      n = min(min(n, ringSize - at), static_cast<size_t>(avail));
+      n = Serial.readBytes(ring + at, n);
+      if (n == 0)
+        break;
+
+      if (discard > 0)  discard -= n;
+      else              received += n;
+      waitingSince = millis();
+    }
+
+    if (!active_ || failed)
+      return;
+
+    if (waiting() && millis() - waitingSince > dataTimeout) {
+      failed = true;
+      return;
+    }
+
+    request();
+  }
+
+  void StreamImage::request() {
+    while (requested < size && requested - consumed + chunkSize <= ringSize) {
+      auto len = min(chunkSize, size - requested);
+
+      char line[40];
+      auto n = startLine(line);
+      n += snprintf(line + n, sizeof(line) - n, "#!need %lu %u\n",
+        requested, len);
+      if (!serialOut.writeWhole(reinterpret_cast<const uint8_t*>(line), n))
+        break;    // try again next time
+
+      if (!waiting())
+        waitingSince = millis();
+      requested += len;
+    }
+  }
+
+  bool StreamImage::ready(size_t blockSize) {
+    poll();
+    return failed || received - consumed >= min(blockSize, size - consumed);
+  }
+
+  int StreamImage::readNextBlock(uint8_t* buf, size_t blockSize) {
+    while (!ready(blockSize))
+      yield();    // only if not checked first
+
+    if (failed)
+      return -1;
+
+    auto n = min(blockSize, size - consumed);
+    if (n == 0) {
+      if (passCrc == crc)
+        return 0;
+      send("#!err crc %08lx\n", passCrc);
+      failed = true;
+      return -1;
+    }
+
+    for (size_t i = 0; i < n; ++i)
+      buf[i] = ring[(consumed + i) & (ringSize - 1)];
+    consumed += n;
+    passCrc = crc32(buf, n, passCrc);
+
+    request();
+    return n;
+  }
+
+  StreamImage image;
+
+
+  class StreamInterface : public InterfaceBase {
+  public:
+    Event loop() {
+      image.poll();
+      if (image.active())
+        return Event::idle;   // the image data isn't lines
+
+      while (Serial.available() > 0) {
+        int c = Serial.read();
+        if (c < 0)
+          break;
+        if (c == '\n') {
+          line[lineLen] = '\0';
+          lineLen = 0;
+          auto event = command();
+          if (event != Event::idle)
+            return event;
+        } else if (lineLen + 1 < sizeof(line)) {
+          line[lineLen++] = c;
+        }
+      }
+      return Event::idle;
+    }
+
+    void stats(const FlashStats& s) {
+      image.end(s.success ? "pass" : "fail");
+    }
+
+  private:
+    char line[64];
+    size_t lineLen = 0;
+
+    Event command() {
+      if (strncmp(line, "#!bench", 7) == 0)
+        return Event::linkBench;
+      if (strncmp(line, "#!job ", 6) != 0)
+        return Event::idle;   // anything else is ignored
+
+      char* end;
+      size_t size = strtoul(line + 6, &end, 10);
+      uint32_t crc = strtoul(end, NULL, 16);
+      if (size == 0) {
+        send("#!err bad job\n");
+        return Event::idle;
+      }
+      if (FlashManager::busy()) {
+        send("#!err busy\n");
+        return Event::idle;
+      }
+
+      image.begin(size, crc);
+      send("#!ok\n");
+      return Event::streamFlash;
+    }
+  };
+
+  StreamInterface streamInterfaceImpl;
+}
+
+Interface& streamInterface = streamInterfaceImpl;
+ImageSource& streamImage = image;
+
+void streamCancel(const char* why) {
+  send("#!err %s\n", why);
+  image.end("fail");
+}
+
+#endif // MF_STREAM
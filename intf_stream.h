@@ -0,0 +1,14 @@
+#ifndef _INTF_STREAM_H_
+#define _INTF_STREAM_H_
+
+#include "image_source.h"
+#include "interface.h"
+
+extern Interface& streamInterface;
+
+extern ImageSource& streamImage;
+  // the image of the job from the host, once Event::streamFlash is returned
+void streamCancel(const char* why);
+  // the job can't be run after all: tells the host
+
+#endif // _INTF_STREAM_H_
@@ -0,0 +1,194 @@
+#include "config.h"
+
+#ifdef MF_TELEMETRY
+  // The Arduino IDE compiles all files... but this code is only needed if
+  // the feature is enabled
+
+#include "intf_telemetry.h"
+
+#include <Arduino.h>
+
+#include <cstdarg>
+
+#include "serial_out.h"
+
+// Telemetry for host software: one JSON object per line on the USB serial
+// port. Every record has "ev" for the kind of event, "n" a sequence number
+// (so dropped records can be detected), and "t" the time in ms.
+//
+// Each record is built up in a buffer and then written whole, or if the
+// transmit ring is full, dropped whole: the host never sees a partial line.
+
+namespace {
+
+  class TelemetryInterface : public InterfaceBase {
+  public:
+    void setup() {
+      Serial.begin(115200);
+      serialOut.noteDropped(false);   // gaps in "n" show dropped records
+    }
+
+    Event loop() {
+      serialOut.pump();
+      return Event::idle;
+    }
+
+    void startMsg(const char* msg)  { message("start", msg); }
+    void statusMsg(const char* msg) { message("status", msg); }
+    void errorMsg(const char* msg)  { message("error", msg); }
+    void clearMsg()                 { begin("clear"); end(); }
+
+    void binaries(
+      size_t bootSize, const char* bootName,
+      size_t appSize, const char* appName)
+    {
+      begin("binaries");
+      add(",\"boot_size\":%u,\"boot\":", bootSize);
+      string(bootSize > 0 ? bootName : "");
+      add(",\"app_size\":%u,\"app\":", appSize);
+      string(appSize > 0 ? appName : "");
+      end();
+    }
+
+    void progress(const Progress& p) {
+      begin("progress");
+      add(
+        ",\"phase\":\"%s\",\"done\":%u,\"size\":%u"
+        ",\"elapsed_ms\":%lu,\"rate\":%lu,\"remaining_ms\":%lu",
+        phaseName(p.phase), p.done, p.size,
+        p.elapsed, p.rate, p.remaining);
+      end();
+    }
+
+    void stats(const FlashStats& s) {
+      begin("stats");
+      add(
+        ",\"success\":%s,\"device_id\":\"%08lx\""
+        ",\"serial\":\"%08lx%08lx%08lx%08lx\""
+        ",\"image_crc\":\"%08lx\",\"image_size\":%u,\"confirmed\":%s",
+        s.success ? "true" : "false", s.deviceId,
+        s.serial[0], s.serial[1], s.serial[2], s.serial[3],
+        s.imageCrc, s.imageSize, s.confirmed ? "true" : "false");
+      add(
+        ",\"connect_us\":%lu,\"fuses_us\":%lu,\"program_us\":%lu"
+        ",\"verify_us\":%lu,\"finish_us\":%lu,\"total_us\":%lu",
+        s.connectTime, s.fuseTime, s.programTime,
+        s.verifyTime, s.finishTime, s.totalTime);
+      add(
+        ",\"storage_read\":%lu,\"swd_sent\":%lu,\"swd_received\":%lu"
+        ",\"rows_erased\":%lu,\"rows_written\":%lu",
+        s.storageRead, s.swdSent, s.swdReceived,
+        s.rowsErased, s.rowsWritten);
+      add(
+        ",\"retries\":%lu,\"reconnects\":%lu,\"swd_errors\":%lu,\"swd_clock\":%lu",
+        s.retries, s.reconnects, s.swdErrors, s.swdClock);
+      end();
+    }
+
+    void link(const LinkStats& s) {
+      begin("link");
+      add(",\"swd_clock\":%lu", s.swdClock);
+      counters("port", s.port);
+      if (s.deviceType) {
+        add(",\"device_type\":\"%08lx\"", s.deviceType);
+        counters("device", s.device);
+      }
+      end();
+    }
+
+    void linkBench(const LinkBenchResult& r) {
+      begin("bench");
+      add(",\"swd_clock\":%lu,\"access_ns\":%lu,\"write_bps\":%lu",
+        r.swdClock, r.accessTime, r.writeRate);
+      add(",\"read_bps\":{");
+      for (int i = 0; i < LinkBenchResult::readSizes; ++i)
+        add("%s\"%u\":%lu", i ? "," : "", r.readSize[i], r.readRate[i]);
+      add("},\"errors\":%lu", r.errors);
+      end();
+    }
+
+    void memory(const MemoryStats& s) {
+      begin("memory");
+      add(",\"ram_start\":%lu,\"ram_size\":%lu,\"data\":%lu,\"bss\":%lu",
+        s.ramStart, s.ramSize, s.data, s.bss);
+      add(",\"heap\":%lu,\"heap_in_use\":%lu,\"stack\":%lu,\"free\":%lu",
+        s.heap, s.heapInUse, s.stack, s.free);
+      end();
+    }
+
+  private:
+    uint32_t seq = 0;
+
+    void counters(const char* name, const LinkCounters& c) {
+      add(",\"%s\":{\"units\":%lu,\"errors\":%lu,\"downshifts\":%lu,\"upshifts\":%lu}",
+        name, c.units, c.errors, c.downshifts, c.upshifts);
+    }
+
+    char line[400];
+    size_t lineLen;
+
+    void begin(const char* ev) {
+      lineLen = 0;
+      add("{\"ev\":\"%s\",\"n\":%lu,\"t\":%lu", ev, seq++, millis());
+    }
+
+    void end() {
+      add("}\n");
+      if (lineLen < sizeof(line))
+        serialOut.writeWhole(reinterpret_cast<const uint8_t*>(line), lineLen);
+      // else too long to send whole, so not sent at all
+    }
+
+    void add(const char* fmt, ...) {
+      if (lineLen >= sizeof(line)) return;
+      va_list args;
+      va_start(args, fmt);
+      lineLen += vsnprintf(line + lineLen, sizeof(line) - lineLen, fmt, args);
+      va_end(args);
+    }
+
+    void addChar(char c) {
+      if (lineLen + 1 < sizeof(line))
+        line[lineLen] = c;
+      lineLen += 1;
+    }
+
+    void message(const char* ev, const char* msg) {
+      begin(ev);
+      add(",\"msg\":");
+      string(msg);
+      end();
+    }
+
+    void string(const char* s) {
+      addChar('"');
+      for (; *s; ++s) {
+        char c = *s;
+        if (c == '"' || c == '\\') {
+          addChar('\\');
+          addChar(c);
+        } else if (static_cast<unsigned char>(c) < 0x20) {
+          add("\\u%04x", c);
+        } else {
+          addChar(c);
+        }
+      }
+      addChar('"');
+    }
+
+    static const char* phaseName(Burn phase) {
+      switch (phase) {
+        case Burn::programming:   return "programming";
+        case Burn::verifying:     return "verifying";
+        case Burn::complete:      return "complete";
+      }
+      return "";
+    }
+  };
+
+  TelemetryInterface telemetryInterface_;
+}
+
+Interface& telemetryInterface = telemetryInterface_;
+
+#endif // MF_TELEMETRY
@@ -0,0 +1,8 @@
+#ifndef _INTF_TELEMETRY_H_
+#define _INTF_TELEMETRY_H_
+
+#include "interface.h"
+
+extern Interface& telemetryInterface;
+
+#endif // _INTF_TELEMETRY_H_
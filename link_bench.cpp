@@ -0,0 +1,337 @@
+#include "link_bench.h"
+
+#include <Adafruit_DAP.h>
+#include <cstdarg>
+
+#include "config.h"
+#include "file_manager.h"
+#include "link_health.h"
+
+
+namespace {
+
+  const char* reportPath = "/link-report.txt";
+  const size_t reportSize = 1024;
+
+  // The clocks measured, as given to the DAP library: a fixed set, from
+  // well above the default SWD_CLOCK to below the slowest the link health
+  // steps down to, so a fixture that could run faster shows it.
+  const uint32_t clocks[] = { 400, 200, 100, 50, 25, 12, 6 };
+  const int clockCount = sizeof(clocks) / sizeof(clocks[0]);
+
+  const uint16_t readSizes[LinkBenchResult::readSizes] = { 4, 16, 64, 256 };
+  const int accesses = 256;             // single reads timed, per clock
+  const int accessesPerStep = 16;
+  const uint32_t transferSize = 4096;   // bytes, per throughput test
+  const size_t writeBlock = 256;
+
+  const uint32_t ramAddr = 0x20000000;  // the start of RAM, on all families
+  const uint32_t flashAddr = 0;
+  const uint32_t DSU_DID = 0x41002018;
+
+  BlockFile reportFile;
+  char report[reportSize];
+  size_t reportLen = 0;
+  bool reportPending = false;
+
+  void reportLine(const char* fmt, ...) {
+    va_list ap;
+    va_start(ap, fmt);
+    auto n = vsnprintf(report + reportLen, reportSize - reportLen, fmt, ap);
+    va_end(ap);
+    if (n > 0)
+      reportLen = min(reportLen + n, reportSize - 1);
+  }
+
+  void reportResult(const LinkBenchResult& r) {
+    reportLine("%7lu %9lu %9lu", r.swdClock, r.accessTime, r.writeRate);
+    for (int i = 0; i < LinkBenchResult::readSizes; ++i)
+      reportLine(" %9lu", r.readRate[i]);
+    reportLine(" %6lu\n", r.errors);
+  }
+
+
+  uint8_t pattern(uint32_t offset, int clockStep) {
+    return (offset * 7 + clockStep * 13) & 0xff;
+  }
+
+  // Like flashing, the bench is done in steps, each a single transfer or a
+  // few accesses, so the main loop keeps running.
+
+  class Bench {
+    public:
+      Bench(Interface& intf);
+      ~Bench();
+
+      bool step();      // returns false once finished
+
+    private:
+      Interface& intf;
+      Adafruit_DAP_SAM dap;   // only the generic DAP operations are used
+
+      enum struct Phase {
+        connect,
+        latency,    // single register reads
+        write,      // to RAM, writeBlock at a time
+        readBack,   // and check it
+        read,       // from flash, at each of readSizes
+        release,
+      };
+      Phase phase = Phase::connect;
+
+      int clockStep = 0;
+      int readStep = 0;
+      uint32_t done = 0;      // accesses or bytes, in this phase
+      uint32_t busyTime = 0;  // µs spent in transfers, in this phase
+      LinkBenchResult result;
+
+      uint8_t buf[writeBlock];
+
+      bool stepConnect();
+      bool stepLatency();
+      bool stepWrite();
+      bool stepReadBack();
+      bool stepRead();
+      bool stepRelease();
+
+      void startClock();
+      void nextPhase(Phase next);
+
+      static Bench* current;
+      static void error(const char* text);
+  };
+
+  Bench* Bench::current = NULL;
+
+  Bench::Bench(Interface& intf) : intf(intf) {
+    current = this;
+    dap.begin(TARGET_SWCLK, TARGET_SWDIO, TARGET_SWRST, &error);
+  }
+
+  Bench::~Bench() {
+    if (current == this)
+      current = NULL;
+    dap.dap_disconnect();
+  }
+
+  bool Bench::step() {
+    switch (phase) {
+      case Phase::connect:  return stepConnect();
+      case Phase::latency:  return stepLatency();
+      case Phase::write:    return stepWrite();
+      case Phase::readBack: return stepReadBack();
+      case Phase::read:     return stepRead();
+      case Phase::release:  return stepRelease();
+    }
+    return false;
+  }
+
+  bool Bench::stepConnect() {
+    bool ok =
+      dap.dap_disconnect()
+      && dap.dap_connect()
+      && dap.dap_transfer_configure(0, 128, 128)
+      && dap.dap_swd_configure(0)
+      && dap.dap_reset_link()
+      && dap.dap_swj_clock(LinkHealth::clockAt(0))
+      && dap.dap_reset_target_hw()
+      && dap.dap_reset_link()
+      && dap.dap_target_prepare();
+
+    uint32_t did = ok ? dap.dap_read_word(DSU_DID) : 0;
+    if (did == 0 || did == 0xffffffff) {
+      intf.errorMsg("No target device connected");
+      reportLine("no target connected\n");
+      return false;
+    }
+    intf.statusMsgf("link bench, target %08x", did);
+
+    clockStep = 0;
+    startClock();
+    return true;
+  }
+
+  void Bench::startClock() {
+    memset(&result, 0, sizeof(result));
+    result.swdClock = clocks[clockStep];
+    for (int i = 0; i < LinkBenchResult::readSizes; ++i)
+      result.readSize[i] = readSizes[i];
+
+    dap.dap_swj_clock(result.swdClock);
+    dap.dap_reset_link();
+    dap.dap_target_prepare();
+    intf.statusMsgf("link bench, clock %lu", result.swdClock);
+
+    readStep = 0;
+    nextPhase(Phase::latency);
+  }
+
+  void Bench::nextPhase(Phase next) {
+    phase = next;
+    done = 0;
+    busyTime = 0;
+  }
+
+  bool Bench::stepLatency() {
+    auto startAt = micros();
+    for (int i = 0; i < accessesPerStep; ++i)
+      dap.dap_read_word(DSU_DID);
+    busyTime += micros() - startAt;
+    done += accessesPerStep;
+
+    if (done >= accesses) {
+      result.accessTime = uint64_t(busyTime) * 1000 / done;
+      nextPhase(Phase::write);
+    }
+    return true;
+  }
+
+  bool Bench::stepWrite() {
+    for (size_t i = 0; i < writeBlock; ++i)
+      buf[i] = pattern(done + i, clockStep);
+
+    auto startAt = micros();
+    dap.dap_write_block(ramAddr + done, buf, writeBlock);
+    busyTime += micros() - startAt;
+    done += writeBlock;
+
+    if (done >= transferSize) {
+      result.writeRate = bytesPerSec(done, busyTime);
+      nextPhase(Phase::readBack);
+    }
+    return true;
+  }
+
+  bool Bench::stepReadBack() {
+    dap.dap_read_block(ramAddr + done, buf, writeBlock);
+    for (size_t i = 0; i < writeBlock; ++i) {
+      if (buf[i] != pattern(done + i, clockStep)) {
+        result.errors += 1;   // one per block is enough to tell
+        break;
+      }
+    }
+    done += writeBlock;
+
+    if (done >= transferSize)
+      nextPhase(Phase::read);
+    return true;
+  }
+
+  bool Bench::stepRead() {
+    auto size = readSizes[readStep];
+    auto startAt = micros();
+    dap.dap_read_block(flashAddr + done, buf, size);
+    busyTime += micros() - startAt;
+    done += size;
+
+    if (done < transferSize)
+      return true;
+
+    result.readRate[readStep] = bytesPerSec(done, busyTime);
+    if (++readStep < LinkBenchResult::readSizes) {
+      nextPhase(Phase::read);
+      return true;
+    }
+
+    intf.linkBench(result);
+    reportResult(result);
+
+    if (++clockStep < clockCount)
+      startClock();
+    else
+      nextPhase(Phase::release);
+    return true;
+  }
+
+  bool Bench::stepRelease() {
+    // As Flasher::release(), so the target is left running
+    const uint32_t DHCSR = 0xE000EDF0;
+    const uint32_t DEMCR = 0xE000EDFC;
+    const uint32_t AIRCR = 0xE000ED0C;
+    const uint32_t DSU_CTRLSTAT = 0x41002100;
+
+    dap.dap_swj_clock(LinkHealth::clockAt(0));
+    dap.dap_write_word(DEMCR, 0x00000000);          // no vector catch
+    dap.dap_write_word(DHCSR, 0xA05F0000);          // no halt, no debug
+    dap.dap_write_word(DSU_CTRLSTAT, 0x00000200);   // clear CRSTEXT
+    dap.dap_write_word(AIRCR, 0x05FA0004);          // SYSRESETREQ
+    intf.statusMsg("link bench done");
+    return false;
+  }
+
+  void Bench::error(const char* text) {
+    // errors are what is being measured, so they are counted, not reported
+    if (current)
+      current->result.errors += 1;
+  }
+
+
+  Bench* bench = NULL;
+}
+
+namespace LinkBench {
+
+  void setup(Interface& intf) {
+    if (!reportFile.create(reportPath, reportSize))
+      intf.errorMsg("report file create failed");
+  }
+
+  bool start(Interface& intf) {
+    if (bench)
+      return false;
+
+    reportLen = 0;
+    reportLine("SWD link report, at %lu s uptime\n", millis() / 1000);
+    reportLine("  clock access_ns write_B/s");
+    for (auto size : readSizes)
+      reportLine("   read%-3u", size);
+    reportLine(" errors\n");
+
+    bench = new Bench(intf);
+    return true;
+  }
+
+  bool busy() {
+    return bench != NULL;
+  }
+
+  void run(uint32_t slice) {
+    if (!bench)
+      return;
+
+    auto startAt = micros();
+    bool more;
+    do {
+      more = bench->step();
+    } while (more && micros() - startAt < slice);
+
+    if (!more) {
+      delete bench;
+      bench = NULL;
+      reportPending = true;
+    }
+  }
+
+  void idle() {
+    if (!reportPending || bench)
+      return;
+
+    if (FileManager::changing())
+      return;   // wait until the host is done with the drive
+
+    reportPending = false;
+    if (!reportFile.open(reportPath))
+      return;
+
+    // padded with spaces, so the file reads as plain text
+    uint8_t block[BlockFile::blockSize];
+    for (uint32_t b = 0; b < reportFile.blocks(); ++b) {
+      size_t at = b * BlockFile::blockSize;
+      size_t n = at < reportLen ? min(reportLen - at, BlockFile::blockSize) : 0;
+      memcpy(block, report + at, n);
+      memset(block + n, ' ', BlockFile::blockSize - n);
+      reportFile.write(b, block);
+    }
+  }
+
+}
@@ -0,0 +1,27 @@
+#ifndef _LINK_BENCH_H_
+#define _LINK_BENCH_H_
+
+#include <cstdint>
+
+#include "interface.h"
+
+// Measures what the SWD link to an attached target can do, at a range of
+// clocks above and below SWD_CLOCK: the time for a single register read, write
+// throughput to the target's RAM, read throughput from its flash by block
+// size, and errors. Used to qualify a fixture's cabling, and to choose
+// SWD_CLOCK for it.
+//
+// The target's RAM is overwritten, and it is reset at the end. Results go
+// to the interfaces as each clock is done, and the whole report is written
+// to link-report.txt on the drive.
+
+namespace LinkBench {
+  void setup(Interface&);   // between FileManager::setup() and startUSB()
+
+  bool start(Interface&);
+  bool busy();
+  void run(uint32_t slice);   // as FlashManager::run()
+  void idle();                // writes the report, once done
+}
+
+#endif // _LINK_BENCH_H_
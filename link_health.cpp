@@ -0,0 +1,114 @@
+#include "link_health.h"
+
+#include <Arduino.h>
+#include <cstring>
+
+#include "config.h"
+
+
+namespace {
+
+  using LinkHealth::clockSteps;
+  const uint32_t window = 1000;         // ms
+  const uint32_t errorsToLower = 2;     // in one window
+  const uint32_t unitsToRaise = 5;      // in a row, without errors
+
+  int step = 0;
+  uint32_t windowAt = 0;
+  uint32_t windowErrors = 0;
+  uint32_t cleanUnits = 0;
+
+  LinkCounters port;
+
+  // Device types are the DSU DID, less the die and revision fields
+  const uint32_t deviceTypeMask = 0xffff00ff;
+
+  struct DeviceCounters {
+    uint32_t      type;
+    LinkCounters  counts;
+  };
+
+  const int maxDevices = 4;
+  DeviceCounters devices[maxDevices];
+  int deviceCount = 0;
+  DeviceCounters* device = NULL;    // the one being flashed
+  DeviceCounters* lastDevice = NULL;
+
+  DeviceCounters* deviceFor(uint32_t deviceId) {
+    auto type = deviceId & deviceTypeMask;
+    for (int i = 0; i < deviceCount; ++i)
+      if (devices[i].type == type)
+        return &devices[i];
+
+    // a new one, or if full, the last is given up
+    auto d = &devices[deviceCount < maxDevices ? deviceCount++ : maxDevices - 1];
+    memset(d, 0, sizeof(*d));
+    d->type = type;
+    return d;
+  }
+}
+
+namespace LinkHealth {
+
+  uint32_t clock() {
+    return clockAt(step);
+  }
+
+  uint32_t clockAt(int n) {
+    return SWD_CLOCK >> n;
+  }
+
+  void start(uint32_t deviceId) {
+    device = lastDevice = deviceFor(deviceId);
+    port.units += 1;
+    device->counts.units += 1;
+  }
+
+  bool error() {
+    port.errors += 1;
+    if (device)
+      device->counts.errors += 1;
+    cleanUnits = 0;
+
+    auto now = millis();
+    if (now - windowAt > window) {
+      windowAt = now;
+      windowErrors = 0;
+    }
+    if (++windowErrors < errorsToLower || step + 1 >= clockSteps)
+      return false;
+
+    step += 1;
+    windowErrors = 0;
+    port.downshifts += 1;
+    if (device)
+      device->counts.downshifts += 1;
+    return true;
+  }
+
+  void done(bool errorFree) {
+    if (!device)
+      return;   // no target was found
+
+    if (errorFree && step > 0 && ++cleanUnits >= unitsToRaise) {
+      step -= 1;
+      cleanUnits = 0;
+      port.upshifts += 1;
+      device->counts.upshifts += 1;
+    }
+    device = NULL;
+  }
+
+  LinkStats stats() {
+    LinkStats s;
+    memset(&s, 0, sizeof(s));
+    s.swdClock = clock();
+    s.port = port;
+    if (lastDevice) {
+      s.deviceType = lastDevice->type;
+      s.device = lastDevice->counts;
+    }
+    return s;
+  }
+
+}
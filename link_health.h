@@ -0,0 +1,32 @@
+#ifndef _LINK_HEALTH_H_
+#define _LINK_HEALTH_H_
+
+#include <cstdint>
+
+#include "interface.h"
+
+// Watches the errors on the SWD link, and picks the clock to run it at.
+//
+// Errors are counted in windows of time: a window with too many lowers the
+// clock a step, and a run of units flashed without any raises it again. The
+// counts are kept for the port, and for each device type flashed, so that a
+// fixture or cable that is getting worse shows up before it fails units.
+
+namespace LinkHealth {
+  uint32_t clock();           // to pass to the DAP library
+
+  const int clockSteps = 4;
+  uint32_t clockAt(int step);
+    // the clocks that may be used: SWD_CLOCK, and then halved each step
+
+  void start(uint32_t deviceId);
+    // a unit is being flashed, once its device ID is known
+  bool error();
+    // counts an error, returns true if the clock was lowered
+  void done(bool errorFree);
+    // the unit is finished with
+
+  LinkStats stats();
+}
+
+#endif // _LINK_HEALTH_H_
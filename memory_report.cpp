@@ -0,0 +1,102 @@
+#include "config.h"
+
+#ifdef MF_MEMORY_REPORT
+  // The Arduino IDE compiles all files... but this code is only needed if
+  // the feature is enabled
+
+#include "memory_report.h"
+
+#include <Arduino.h>
+#include <malloc.h>
+
+// The SAMD cores' linker scripts mark out RAM with these
+extern "C" {
+  extern uint32_t __data_start__;
+  extern uint32_t __data_end__;
+  extern uint32_t __bss_start__;
+  extern uint32_t __bss_end__;
+  extern uint32_t __end__;          // where the heap starts
+  extern uint32_t __StackTop;       // the end of RAM
+
+  char* sbrk(int incr);
+}
+
+
+namespace {
+
+  const uint32_t paint = 0xC0FFEE55;
+  const uint32_t margin = 256;      // bytes below the stack left unpainted
+
+  const uint32_t checkInterval = 1000;    // ms
+
+  uint32_t* paintedTo = NULL;       // the top of the paint, exclusive
+  uint32_t checkedAt = 0;
+  uint32_t reportedHeap = 0;
+  uint32_t reportedStack = 0;
+
+  uint32_t addr(const void* p) { return reinterpret_cast<uintptr_t>(p); }
+
+  uint32_t* heapTop() {
+    auto p = addr(sbrk(0));
+    return reinterpret_cast<uint32_t*>((p + 3) & ~3);
+  }
+
+  uint32_t* deepestStack() {
+    // The heap has only grown since the paint, and covers what it took:
+    // the paint is looked for above it
+    auto p = heapTop();
+    while (p < paintedTo && *p == paint)
+      ++p;
+    return p;
+  }
+
+  void send(Interface& intf, const MemoryStats& s) {
+    intf.memory(s);
+    reportedHeap = s.heap;
+    reportedStack = s.stack;
+    checkedAt = millis();
+  }
+}
+
+namespace MemoryReport {
+
+  void setup() {
+    auto sp = reinterpret_cast<uint32_t*>(__get_MSP());
+    paintedTo = sp - margin / sizeof(uint32_t);
+    for (auto p = heapTop(); p < paintedTo; ++p)
+      *p = paint;
+  }
+
+  void report(Interface& intf) {
+    send(intf, stats());
+  }
+
+  void idle(Interface& intf) {
+    if (millis() - checkedAt < checkInterval)
+      return;
+
+    auto s = stats();
+    if (s.heap > reportedHeap || s.stack > reportedStack)
+      send(intf, s);
+    checkedAt = millis();
+  }
+
+  MemoryStats stats() {
+    MemoryStats s;
+    s.ramStart = addr(&__data_start__);
+    s.ramSize = addr(&__StackTop) - s.ramStart;
+    s.data = addr(&__data_end__) - addr(&__data_start__);
+    s.bss = addr(&__bss_end__) - addr(&__bss_start__);
+
+    auto top = heapTop();
+    s.heap = addr(top) - addr(&__end__);
+    s.heapInUse = mallinfo().uordblks;
+
+    auto deepest = deepestStack();
+    s.stack = addr(&__StackTop) - addr(deepest);
+    s.free = addr(deepest) - addr(top);
+    return s;
+  }
+}
+
+#endif // MF_MEMORY_REPORT
@@ -0,0 +1,25 @@
+#ifndef _MEMORY_REPORT_H_
+#define _MEMORY_REPORT_H_
+
+#include "interface.h"
+
+// How the programmer's RAM is used, for MF_MEMORY_REPORT: the static data,
+// the heap, and the deepest the stack has gone, with what is left between
+// them, so that the headroom is known before more is kept in RAM.
+//
+// The stack is measured by painting: at startup, the RAM below the stack is
+// filled with a pattern, and the deepest the stack has been is the lowest
+// word that no longer holds it. The heap is measured from the C library's
+// allocator, which String and forward_list use through new.
+
+namespace MemoryReport {
+  void setup();
+    // as early as can be, before the stack is used in earnest
+  void report(Interface&);
+    // at the end of startup
+  void idle(Interface&);
+    // reports again if the stack or heap has grown since
+  MemoryStats stats();
+}
+
+#endif // _MEMORY_REPORT_H_
@@ -0,0 +1,71 @@
+#include "config.h"
+
+#ifdef MF_MSC_TRACE
+  // The Arduino IDE compiles all files... but this code is only needed if
+  // the feature is enabled
+
+#include "msc_trace.h"
+
+#include <Arduino.h>
+#include <cstdio>
+
+#include "serial_out.h"
+
+
+namespace {
+
+  struct Access {
+    uint32_t seq;
+    uint32_t at;          // µs from the first access
+    uint32_t lba;
+    uint32_t duration;    // µs
+    uint16_t blocks;
+    MscTrace::Op op;
+  };
+
+  const uint32_t ringSize = 32;     // must be a power of two
+  Access ring[ringSize];
+  volatile uint32_t head = 0;       // next access recorded goes here
+  volatile uint32_t tail = 0;       // next access sent comes from here
+
+  uint32_t seq = 0;                 // counts dropped accesses, too
+  uint32_t firstAt = 0;
+}
+
+namespace MscTrace {
+
+  void record(Op op, uint32_t lba, uint32_t blocks, uint32_t startedAt) {
+    if (seq == 0)
+      firstAt = startedAt;
+    auto n = seq++;
+
+    if (head - tail >= ringSize)
+      return;   // dropped: the gap in seq shows it
+
+    auto& a = ring[head & (ringSize - 1)];
+    a.seq = n;
+    a.at = startedAt - firstAt;
+    a.lba = lba;
+    a.duration = micros() - startedAt;
+    a.blocks = blocks;
+    a.op = op;
+    head += 1;
+  }
+
+  void send() {
+    while (tail != head) {
+      auto& a = ring[tail & (ringSize - 1)];
+
+      char line[64];
+      int len = snprintf(line, sizeof(line), "msc: %lu %lu %c %lu %u %lu\n",
+        a.seq, a.at, static_cast<char>(a.op), a.lba, a.blocks, a.duration);
+      if (serialOut.availableForWrite() < len)
+        return;   // the rest next time, rather than drop them
+
+      serialOut.write(reinterpret_cast<const uint8_t*>(line), len);
+      tail += 1;
+    }
+  }
+}
+
+#endif // MF_MSC_TRACE
@@ -0,0 +1,27 @@
+#ifndef _MSC_TRACE_H_
+#define _MSC_TRACE_H_
+
+#include <cstdint>
+
+// A trace of the host's accesses to the drive, for MF_MSC_TRACE.
+//
+// Each read, write and flush is recorded by the USB callbacks, which only
+// put it in a small ring, and is sent later, from the loop, as a line on
+// the USB serial port:
+//
+//    msc: <seq> <time µs> <r|w|f> <lba> <blocks> <duration µs>
+//
+// Time is from the first access. If the ring fills, accesses are dropped,
+// and the gap shows in seq. tools/storage-bench/msc-capture.py saves these
+// to a trace file, and msc_replay runs them again on a computer.
+
+namespace MscTrace {
+  enum struct Op : char { read = 'r', write = 'w', flush = 'f' };
+
+  void record(Op, uint32_t lba, uint32_t blocks, uint32_t startedAt);
+    // after the access; startedAt is micros() when it began
+  void send();
+    // as much of the ring as the serial port has room for
+}
+
+#endif // _MSC_TRACE_H_
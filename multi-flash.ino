@@ -2,77 +2,239 @@
 
 #include "file_manager.h"
 #include "flash_manager.h"
+#include "link_bench.h"
+#include "memory_report.h"
+#include "production_log.h"
+#include "profiler.h"
+#include "serialization.h"
+#include "swd_trace.h"
+#include "target_history.h"
 
 #include "interface.h"
-#include "intf_serial.h"
+#ifdef MF_TELEMETRY
+  #include "intf_telemetry.h"
+#else
+  #include "intf_serial.h"
+#endif
 #ifdef MF_OLED_FEATHERWING
   #include "intf_oledfeatherwing.h"
 #endif
 #ifdef ADAFRUIT_CIRCUITPLAYGROUND_M0
   #include "intf_circuitplayground.h"
 #endif
+#ifdef MF_AUTO_START
+  #include "intf_autostart.h"
+#endif
+#ifdef MF_STREAM
+  #include "intf_stream.h"
+#endif
 
 
 /* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
 
 InterfaceList interfaces({
+#ifdef MF_TELEMETRY
+  &telemetryInterface,
+#else
   &serialInterface,
+#endif
 #ifdef MF_OLED_FEATHERWING
   &oledFeatherwingInterface,
 #endif
 #ifdef ADAFRUIT_CIRCUITPLAYGROUND_M0
   &circuitPlaygroundInterface,
 #endif
+#ifdef MF_AUTO_START
+  &autoStartInterface,
+#endif
+#ifdef MF_STREAM
+  &streamInterface,
+#endif
 });
 
 
+FilesToFlash filesToFlash;
+
+
 /* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
 
 void setup() {
+#ifdef MF_MEMORY_REPORT
+  MemoryReport::setup();
+#endif
   interfaces.setup();
+#ifdef MF_PROFILE
+  Profiler::setup();
+#endif
 
   if (!FileManager::setup(interfaces))
     while(1) ;
 
+  ProductionLog::setup(interfaces);
+  Serialization::setup(interfaces);
+  TargetHistory::setup(interfaces);
+  LinkBench::setup(interfaces);
+#ifdef MF_SWD_TRACE
+  SwdTrace::setup(interfaces);
+#endif
+
+  if (!FileManager::startUSB(interfaces))
+    while(1) ;
+
   interfaces.startMsg("Multi-Flash");
+#ifdef MF_MEMORY_REPORT
+  MemoryReport::report(interfaces);
+#endif
 }
 
-void loop() {
-  if (!FileManager::loop(interfaces)) {
-    return;
+/* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+// loop() is a small cooperative scheduler: each pass gives every task a turn,
+// and then returns so that the core can service USB. Tasks must return
+// promptly. Flashing, and the link bench, the only long running work, get a
+// slice of time each pass, and are done in steps short enough to keep to it.
+
+namespace {
+  const uint32_t flashSlice = 5000;   // µs of flashing per pass
+
+  bool flashPending = false;
+  uint32_t flashPendingAt = 0;
+  ImageSource* flashSource = &filesToFlash;
+
+  bool busy() {
+    return flashPending || FlashManager::busy() || LinkBench::busy();
   }
 
-  if (FileManager::changed()) {
-    FilesToFlash ftf(interfaces);
-    ftf.report(interfaces);
+  void fileTask() {
+    if (FlashManager::busy() || LinkBench::busy())
+      return;   // the change will be picked up when flashing is done
+
+    if (FileManager::changed()) {
+      filesToFlash.scan(interfaces);
+      filesToFlash.report(interfaces);
+    }
   }
 
-  switch (interfaces.loop()) {
-    case Event::idle:
-      break;
+  bool startFlash(Event event) {
+    if (busy())
+      return false;
 
-    case Event::startFlash: {
+    if (FileManager::changing()) {
+      interfaces.statusMsg("storage write in progress...");
+      return false; // don't flash if FS is still being written!
+    }
 
-      if (FileManager::changing()) {
-        interfaces.statusMsg("storage write in progress...");
-        break; // don't flash if FS is still being written!
-      }
+    if (!filesToFlash.okayToFlash()) {
+      interfaces.errorMsg("binaries not ready to flash");
+      return false;   // the reason was reported when they were scanned
+    }
+
+    interfaces.statusMsg("Starting flash...");
+    flashPending = true;
+    flashPendingAt = millis();
+    flashSource = &filesToFlash;
+    if (event == Event::startFlash)
+      flashPendingAt += 1000; // give the operator time to let go of the button
+    return true;
+  }
 
-      FilesToFlash ftf(interfaces);
-      ftf.report(interfaces);
-      if (!ftf.okayToFlash())
+  void eventTask() {
+    auto event = interfaces.loop();
+    switch (event) {
+      case Event::idle:
         break;
 
-      interfaces.statusMsg("Starting flash...");
-      delay(1000);
+      case Event::startFlash:
+        startFlash(event);
+        break;
+
+      case Event::autoStart:
+        if (!startFlash(event) && (busy() || FileManager::changing())) {
+          // only for reasons that pass: binaries that aren't ready have been
+          // reported, and wait for the next target
+#ifdef MF_AUTO_START
+          autoStartRejected();
+#endif
+        }
+        break;
+
+      case Event::nextProfile:
+      case Event::prevProfile:
+        if (busy()) {
+          interfaces.errorMsg("can't change profile now");
+          break;
+        }
+        filesToFlash.selectProfile(interfaces,
+          event == Event::nextProfile ? 1 : -1);
+        break;
+
+#ifdef MF_STREAM
+      case Event::streamFlash:
+        if (busy()) {
+          streamCancel("busy");
+          break;
+        }
+
+        interfaces.statusMsg("Starting stream...");
+        flashPending = true;
+        flashPendingAt = millis();
+        flashSource = &streamImage;
+        break;
+#endif
 
-      FlashManager::program(interfaces, ftf);
+      case Event::linkBench:
+        if (busy()) {
+          interfaces.errorMsg("can't run link bench now");
+          break;
+        }
+        LinkBench::start(interfaces);
+        break;
 
-      break;
+      default:
+        interfaces.errorMsg("Event huh?");
     }
+  }
 
-    default:
-      interfaces.errorMsg("Event huh?");
+  void flashTask() {
+    if (flashPending && static_cast<int32_t>(millis() - flashPendingAt) >= 0) {
+      flashPending = false;
+      FlashManager::start(interfaces, *flashSource);
+    }
+
+    if (FlashManager::busy()) {
+      if (FileManager::changing() && flashSource == &filesToFlash)
+        FlashManager::abort("storage changed while flashing");
+      FlashManager::run(flashSlice);
+    }
+
+    LinkBench::run(flashSlice);
+  }
+
+  void idleTask() {
+    if (busy())
+      return;
+
+    ProductionLog::idle(interfaces);
+    TargetHistory::idle();
+    LinkBench::idle();
+#ifdef MF_SWD_TRACE
+    SwdTrace::idle();
+#endif
+#ifdef MF_MEMORY_REPORT
+    MemoryReport::idle(interfaces);
+#endif
   }
 }
 
+void loop() {
+  if (!FileManager::loop(interfaces)) {
+    return;
+  }
+
+  fileTask();
+  eventTask();
+  flashTask();
+  idleTask();
+#ifdef MF_PROFILE
+  Profiler::send();
+#endif
+}
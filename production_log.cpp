@@ -0,0 +1,171 @@
+#include "production_log.h"
+
+#include <cctype>
+
+#include "file_manager.h"
+
+
+namespace {
+
+  const char* logPath = "/production-log.csv";
+  const uint32_t logSize = 128 * 1024;
+
+  const size_t recordSize = 128;
+  const size_t recordsPerBlock = BlockFile::blockSize / recordSize;
+
+  const char* header =
+    "seq,uptime_s,result,device_id,serial,image_crc,image_size,"
+    "connect_ms,fuses_ms,program_ms,verify_ms,finish_ms,total_ms";
+
+  BlockFile logFile;
+  uint32_t slotCount = 0;
+  uint32_t nextSlot = 1;    // slot 0 holds the header
+  uint32_t nextSeq = 1;
+
+  struct Entry {
+    uint32_t   at;          // millis() when recorded
+    FlashStats stats;
+  };
+
+  const size_t queueSize = 4;
+  Entry queue[queueSize];
+  size_t queueHead = 0;     // next entry recorded goes here
+  size_t queueTail = 0;     // next entry written comes from here
+
+
+  void fillSlot(uint8_t* slot, const char* text) {
+    // slots are padded with spaces, so the file reads as plain CSV
+    auto n = min(strlen(text), recordSize - 1);
+    memcpy(slot, text, n);
+    memset(slot + n, ' ', recordSize - 1 - n);
+    slot[recordSize - 1] = '\n';
+  }
+
+  uint32_t slotSeq(const uint8_t* slot) {
+    uint32_t seq = 0;
+    for (size_t i = 0; i < recordSize && isdigit(slot[i]); ++i)
+      seq = seq * 10 + (slot[i] - '0');
+    return seq;
+  }
+
+  bool initialize() {
+    uint8_t block[BlockFile::blockSize];
+
+    for (uint32_t b = 0; b < logFile.blocks(); ++b) {
+      for (size_t i = 0; i < recordsPerBlock; ++i)
+        fillSlot(block + i * recordSize, "");
+      if (b == 0)
+        fillSlot(block, header);
+      if (!logFile.writeBack(b, block))
+        return false;
+    }
+    return logFile.sync();
+  }
+
+  bool scan() {
+    // find the most recently written slot
+    uint8_t block[BlockFile::blockSize];
+    uint32_t lastSeq = 0;
+    uint32_t lastSlot = 0;
+
+    for (uint32_t b = 0; b < logFile.blocks(); ++b) {
+      if (!logFile.read(b, block))
+        return false;
+
+      if (b == 0 && memcmp(block, header, strlen(header)) != 0)
+        return initialize();
+
+      for (size_t i = 0; i < recordsPerBlock; ++i) {
+        auto seq = slotSeq(block + i * recordSize);
+        if (seq > lastSeq) {
+          lastSeq = seq;
+          lastSlot = b * recordsPerBlock + i;
+        }
+      }
+    }
+
+    nextSeq = lastSeq + 1;
+    nextSlot = lastSlot + 1 < slotCount ? lastSlot + 1 : 1;
+    return true;
+  }
+
+  void format(char* buf, size_t len, uint32_t seq, const Entry& e) {
+    const FlashStats& s = e.stats;
+    snprintf(buf, len,
+      "%lu,%lu,%s,%08lx,%08lx%08lx%08lx%08lx,%08lx,%u,%lu,%lu,%lu,%lu,%lu,%lu",
+      seq, e.at / 1000, s.success ? "pass" : "fail",
+      s.deviceId, s.serial[0], s.serial[1], s.serial[2], s.serial[3],
+      s.imageCrc, s.imageSize,
+      s.connectTime / 1000, s.fuseTime / 1000, s.programTime / 1000,
+      s.verifyTime / 1000, s.finishTime / 1000, s.totalTime / 1000);
+  }
+}
+
+namespace ProductionLog {
+
+  void setup(Interface& intf) {
+    if (!logFile.create(logPath, logSize)) {
+      intf.errorMsg("log file create failed");
+      return;
+    }
+    slotCount = logFile.blocks() * recordsPerBlock;
+
+    if (!scan()) {
+      intf.errorMsg("log file read failed");
+      logFile.close();
+    }
+  }
+
+  void record(const FlashStats& stats) {
+    if (queueHead - queueTail >= queueSize)
+      return;   // only if writes are failing
+
+    Entry& e = queue[queueHead % queueSize];
+    e.at = millis();
+    e.stats = stats;
+    queueHead += 1;
+  }
+
+  void idle(Interface& intf) {
+    if (queueHead == queueTail || slotCount == 0)
+      return;
+
+    if (FileManager::changing())
+      return;   // wait until the host is done with the drive
+
+    // The host may have deleted or replaced the file since it was last
+    // written: look it up again before writing blocks into it. Deleting it
+    // is the way to clear the log, so if it has gone, a new one is started.
+    if (!logFile.open(logPath)) {
+      if (!logFile.create(logPath, logSize)) {
+        intf.errorMsg("log file create failed");
+        slotCount = 0;
+        return;
+      }
+      slotCount = logFile.blocks() * recordsPerBlock;
+      if (!scan()) {
+        intf.errorMsg("log file write failed");
+        logFile.close();
+        slotCount = 0;
+        return;
+      }
+    }
+
+    uint8_t block[BlockFile::blockSize];
+    auto b = nextSlot / recordsPerBlock;
+    auto i = nextSlot % recordsPerBlock;
+    if (!logFile.read(b, block))
+      return;
+
+    char text[recordSize];
+    format(text, sizeof(text), nextSeq, queue[queueTail % queueSize]);
+    fillSlot(block + i * recordSize, text);
+    if (!logFile.write(b, block))
+      return;
+
+    queueTail += 1;
+    nextSeq += 1;
+    nextSlot = nextSlot + 1 < slotCount ? nextSlot + 1 : 1;
+  }
+
+}
@@ -0,0 +1,20 @@
+#ifndef _PRODUCTION_LOG_H_
+#define _PRODUCTION_LOG_H_
+
+#include "interface.h"
+
+// A record of every unit flashed, kept in a CSV file on the drive.
+//
+// The file is preallocated, and records are fixed size slots in it, reused
+// in a ring once the file is full. Records are queued in RAM, and only
+// written out from idle().
+
+namespace ProductionLog {
+  void setup(Interface&);   // between FileManager::setup() and startUSB()
+
+  void record(const FlashStats&);
+  void idle(Interface&);
+    // also starts a new file, if the host deleted it from the drive
+}
+
+#endif // _PRODUCTION_LOG_H_
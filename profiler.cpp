@@ -0,0 +1,172 @@
+#include "config.h"
+
+#ifdef MF_PROFILE
+  // The Arduino IDE compiles all files... but this code is only needed if
+  // the feature is enabled
+
+#include "profiler.h"
+
+#include <Arduino.h>
+#include <cstdio>
+#include <cstring>
+
+#include "serial_out.h"
+
+#ifdef __SAMD51__
+  #error "MF_PROFILE needs a SAMD21: it sets up TC4 the SAMD21 way"
+#endif
+
+
+namespace {
+
+  const uint32_t sampleRate = 997;
+    // Hz; a prime, so as not to keep in step with the 1ms tick
+  const uint32_t timerClock = 48000000 / 64;
+
+  const uint32_t ringSize = 256;    // must be a power of two
+  uint32_t ring[ringSize];
+  volatile uint32_t head = 0;       // next sample goes here
+  volatile uint32_t tail = 0;       // next sample sent comes from here
+  volatile uint32_t lost = 0;
+
+  const uint32_t perLine = 8;       // samples sent in each line
+
+  struct Times {
+    uint32_t count;
+    uint32_t total;     // µs
+    uint32_t longest;   // µs
+  };
+
+  Times times[Profiler::regions];
+  const char* const regionNames[Profiler::regions] = {
+    "readNextBlock", "dap.readBlock", "programBlock", "display.display",
+    "profiler",
+  };
+
+  const uint32_t reportInterval = 1000;   // ms
+  uint32_t reportedAt = 0;
+
+
+  char* putHex(char* p, uint32_t v) {
+    // cheaper than printf, which matters at a thousand samples a second
+    char digits[8];
+    int n = 0;
+    do {
+      digits[n++] = "0123456789abcdef"[v & 15];
+      v >>= 4;
+    } while (v);
+    while (n > 0)
+      *p++ = digits[--n];
+    return p;
+  }
+
+  bool sendSamples() {
+    char line[16 + perLine * 9];
+    char* p = line;
+    memcpy(p, "prof: pc ", 9);
+    p = putHex(p + 9, lost);
+    for (uint32_t i = 0; i < perLine; ++i) {
+      *p++ = ' ';
+      p = putHex(p, ring[(tail + i) & (ringSize - 1)]);
+    }
+    *p++ = '\n';
+
+    int len = p - line;
+    if (serialOut.availableForWrite() < len)
+      return false;   // the rest next time, rather than drop them
+    serialOut.write(reinterpret_cast<const uint8_t*>(line), len);
+    tail += perLine;
+    return true;
+  }
+
+  bool sendRegion(int i) {
+    auto& t = times[i];
+    char line[80];
+    int len = snprintf(line, sizeof(line), "prof: region %s %lu %lu %lu\n",
+      regionNames[i], t.count, t.total, t.longest);
+    if (serialOut.availableForWrite() < len)
+      return false;
+    serialOut.write(reinterpret_cast<const uint8_t*>(line), len);
+    memset(&t, 0, sizeof(t));
+    return true;
+  }
+}
+
+
+// The interrupted code's registers are stacked on entry to the handler, on
+// MSP, the only stack the Arduino core uses: the handler passes where they
+// are to the sampler, untouched.
+
+extern "C" void profilerSample(const uint32_t* frame) {
+  TC4->COUNT16.INTFLAG.reg = TC_INTFLAG_MC0;
+
+  auto h = head;
+  if (h - tail >= ringSize) {
+    lost = lost + 1;
+    return;
+  }
+  ring[h & (ringSize - 1)] = frame[6];   // the stacked PC
+  head = h + 1;
+}
+
+extern "C" __attribute__((naked)) void TC4_Handler() {
+  asm volatile(
+    "mrs  r0, msp\n"
+    "ldr  r1, =profilerSample\n"
+    "bx   r1\n"
+    ".ltorg\n");
+}
+
+
+namespace Profiler {
+
+  void setup() {
+    // TC4, clocked from the 48MHz GCLK0, interrupting on each period
+    GCLK->CLKCTRL.reg = GCLK_CLKCTRL_CLKEN | GCLK_CLKCTRL_GEN_GCLK0
+      | GCLK_CLKCTRL_ID_TC4_TC5;
+    while (GCLK->STATUS.bit.SYNCBUSY) ;
+    PM->APBCMASK.reg |= PM_APBCMASK_TC4;
+
+    auto& tc = TC4->COUNT16;
+    tc.CTRLA.reg = TC_CTRLA_SWRST;
+    while (tc.CTRLA.bit.SWRST) ;
+    tc.CTRLA.reg = TC_CTRLA_MODE_COUNT16 | TC_CTRLA_WAVEGEN_MFRQ
+      | TC_CTRLA_PRESCALER_DIV64;
+    tc.CC[0].reg = timerClock / sampleRate - 1;
+    while (tc.STATUS.bit.SYNCBUSY) ;
+    tc.INTENSET.reg = TC_INTENSET_MC0;
+
+    // The highest priority, so that other handlers are sampled too
+    NVIC_SetPriority(TC4_IRQn, 0);
+    NVIC_EnableIRQ(TC4_IRQn);
+
+    tc.CTRLA.bit.ENABLE = 1;
+    while (tc.STATUS.bit.SYNCBUSY) ;
+  }
+
+  void send() {
+    Scope scope(Region::profiler);
+
+    while (head - tail >= perLine)
+      if (!sendSamples())
+        break;
+
+    if (millis() - reportedAt < reportInterval)
+      return;
+    reportedAt = millis();
+    for (int i = 0; i < regions; ++i)
+      if (times[i].count && !sendRegion(i))
+        break;
+  }
+
+  void done(Region r, uint32_t startedAt) {
+    auto& t = times[static_cast<int>(r)];
+    auto d = micros() - startedAt;
+    t.count += 1;
+    t.total += d;
+    if (d > t.longest)
+      t.longest = d;
+  }
+}
+
+#endif // MF_PROFILE
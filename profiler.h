@@ -0,0 +1,59 @@
+#ifndef _PROFILER_H_
+#define _PROFILER_H_
+
+#include <Arduino.h>
+#include <cstdint>
+
+#include "config.h"
+
+// A sampling profiler, for MF_PROFILE, and timers for the known hot spots.
+//
+// The M0+ has no cycle counter, so instead a timer interrupts about a
+// thousand times a second, and the address of the code it interrupted is
+// put in a ring. From the loop, the addresses are sent as lines on the USB
+// serial port, for tools/profile.py to find the functions they are in, from
+// the sketch's ELF file:
+//
+//    prof: pc <lost> <address> <address> ...
+//    prof: region <name> <count> <total µs> <longest µs>
+//
+// In pc lines, all numbers are hex; lost counts the samples dropped so far
+// because the ring was full. Each region line covers the second or so since
+// the last one for that region.
+//
+// SAMD21 only: it takes TC4, and its interrupt.
+
+namespace Profiler {
+  enum struct Region : uint8_t {
+    readNextBlock,    // the binaries, off the drive
+    dapReadBlock,     // a page, from the target
+    programBlock,     // a page, to the target
+    display,          // a frame, to the OLED
+    profiler,         // sending all this
+  };
+  const int regions = 5;
+
+  void setup();
+  void send();
+    // as much of the ring as the serial port has room for, and the regions
+
+  void done(Region, uint32_t startedAt);
+
+  class Scope {
+    // times a region, for as long as it is in scope; nothing without
+    // MF_PROFILE
+  public:
+#ifdef MF_PROFILE
+    Scope(Region r) : region(r), startedAt(micros()) { }
+    ~Scope() { done(region, startedAt); }
+
+  private:
+    Region region;
+    uint32_t startedAt;
+#else
+    Scope(Region) { }
+#endif
+  };
+}
+
+#endif // _PROFILER_H_
@@ -0,0 +1,75 @@
+#include "serial_out.h"
+
+
+size_t SerialOut::put(const uint8_t* buf, size_t len) {
+  auto n = min(len, space());
+  for (size_t i = 0; i < n; ++i)
+    ring[(head + i) & (ringSize - 1)] = buf[i];
+  head += n;
+  if (n > 0)
+    lastPut = buf[n - 1];
+
+  if (n < len) {
+    droppedCount += len - n;
+    droppedUnreported += len - n;
+  }
+  return n;
+}
+
+size_t SerialOut::write(uint8_t c) {
+  return write(&c, 1);
+}
+
+size_t SerialOut::write(const uint8_t* buf, size_t len) {
+  put(buf, len);
+  pump();
+  return len;   // dropped bytes are accounted for, not reported to Print
+}
+
+bool SerialOut::writeWhole(const uint8_t* buf, size_t len) {
+  pump();
+  if (len > space()) {
+    droppedCount += len;
+    droppedUnreported += len;
+    return false;
+  }
+  put(buf, len);
+  pump();
+  return true;
+}
+
+void SerialOut::pump() {
+  if (!Serial) {
+    // Nobody is listening: Serial would discard this output anyway, and
+    // holding onto it would only fill the ring with stale text.
+    tail = head;
+    droppedUnreported = 0;
+    return;
+  }
+
+  while (used() > 0) {
+    int room = Serial.availableForWrite();
+    if (room <= 0)
+      break;
+
+    // send the contiguous run up to the end of the ring
+    auto start = tail & (ringSize - 1);
+    auto n = min(min(used(), ringSize - start), static_cast<size_t>(room));
+    n = Serial.write(ring + start, n);
+    if (n == 0)
+      break;
+    tail += n;
+  }
+
+  if (!noteDrops) {
+    droppedUnreported = 0;
+  } else if (used() == 0 && droppedUnreported > 0) {
+    char note[48];
+    auto len = snprintf(note, sizeof(note),
+      "\n** serial overflow, %lu bytes dropped\n", droppedUnreported);
+    droppedUnreported = 0;
+    put(reinterpret_cast<const uint8_t*>(note), len);
+  }
+}
+
+SerialOut serialOut;
@@ -0,0 +1,52 @@
+#ifndef _SERIAL_OUT_H_
+#define _SERIAL_OUT_H_
+
+#include <Arduino.h>
+
+// A bounded transmit ring in front of Serial.
+//
+// Writes never block: bytes go into the ring, and pump() moves only as much
+// to the USB CDC port as it has room for. If the ring is full, bytes are
+// dropped and counted, rather than stalling the caller.
+
+class SerialOut : public Print {
+public:
+  size_t write(uint8_t c);
+  size_t write(const uint8_t* buf, size_t len);
+  using Print::write;
+
+  bool writeWhole(const uint8_t* buf, size_t len);
+    // writes all of buf, or if there isn't room, none of it
+  int availableForWrite() { return space(); }
+    // room in the ring, for those that would rather wait than drop
+
+  void pump();
+  uint32_t dropped() const { return droppedCount; }
+
+  bool atLineStart() const { return lastPut == '\n'; }
+    // if what was last written ended a line
+
+  void noteDropped(bool note) { noteDrops = note; }
+    // if true (the default), a line noting the number of bytes dropped is
+    // sent once there is room again
+
+private:
+  static const size_t ringSize = 1024;    // must be a power of two
+
+  uint8_t ring[ringSize];
+  size_t head = 0;    // next byte written goes here
+  size_t tail = 0;    // next byte sent comes from here
+
+  uint32_t droppedCount = 0;
+  uint32_t droppedUnreported = 0;
+  bool noteDrops = true;
+  uint8_t lastPut = '\n';
+
+  size_t used() const { return head - tail; }
+  size_t space() const { return ringSize - used(); }
+  size_t put(const uint8_t* buf, size_t len);
+};
+
+extern SerialOut serialOut;
+
+#endif // _SERIAL_OUT_H_
@@ -0,0 +1,326 @@
+#include "serialization.h"
+
+#include <cctype>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+
+#include <SdFat.h>
+
+#include "crc32.h"
+#include "file_manager.h"
+
+
+namespace {
+
+  const char* patchesPath = "/patches.txt";
+  const char* statePath = "/serial-state.bin";
+
+  enum struct Generator { counter, uid, csv };
+
+  struct Patch {
+    uint32_t  addr;
+    size_t    len;
+    Generator gen;
+
+    uint32_t  start;          // for counter
+    char      csvPath[32];    // for csv
+    int       csvColumn;
+    uint32_t  csvRow;         // row, and its position, last read from the
+    uint32_t  csvPos;         // file, so the next needn't start from the top
+
+    uint8_t   data[32];       // the value for this unit
+  };
+
+  const size_t maxPatches = 8;
+  Patch patches[maxPatches];
+  size_t patchCount = 0;
+
+
+  // The count of units serialized is kept in two slots, in different erase
+  // sectors of the flash chip, and written alternately. The slot with the
+  // higher sequence number wins, so if power fails during a write, the
+  // other slot is still intact.
+
+  struct State {
+    uint32_t magic;
+    uint32_t seq;
+    uint32_t units;
+    uint32_t crc;
+
+    uint32_t computeCrc() const {
+      return crc32(reinterpret_cast<const uint8_t*>(this), offsetof(State, crc));
+    }
+    bool valid() const { return magic == stateMagic && crc == computeCrc(); }
+
+    static const uint32_t stateMagic = 0x3153464d;  // "MFS1"
+  };
+
+  const uint32_t stateSlots[2] = { 0, 8 };   // blocks, 4k apart
+  BlockFile stateFile;
+  State state = { State::stateMagic, 0, 0, 0 };
+
+  bool readState() {
+    uint8_t block[BlockFile::blockSize];
+    bool found = false;
+
+    for (auto slot : stateSlots) {
+      if (!stateFile.read(slot, block))
+        return false;
+
+      State s;
+      memcpy(&s, block, sizeof(s));
+      if (s.valid() && (!found || s.seq > state.seq)) {
+        state = s;
+        found = true;
+      }
+    }
+    return true;
+  }
+
+  bool writeState(const State& s) {
+    uint8_t block[BlockFile::blockSize];
+    memset(block, 0, sizeof(block));
+    memcpy(block, &s, sizeof(s));
+    return stateFile.write(stateSlots[s.seq % 2], block);
+  }
+
+
+  const char* skipSpace(const char* p) {
+    while (*p == ' ' || *p == '\t') ++p;
+    return p;
+  }
+
+  const char* word(const char* p, char* buf, size_t len) {
+    p = skipSpace(p);
+    size_t n = 0;
+    while (*p && !isspace(*p)) {
+      if (n + 1 < len) buf[n++] = *p;
+      ++p;
+    }
+    buf[n] = '\0';
+    return p;
+  }
+
+  bool parsePatch(const char* line, Patch& patch) {
+    char* end;
+    patch.addr = strtoul(line, &end, 0);
+    if (end == line) return false;
+    line = end;
+
+    patch.len = strtoul(line, &end, 0);
+    if (end == line) return false;
+    line = end;
+
+    char gen[16];
+    line = word(line, gen, sizeof(gen));
+
+    if (strcmp(gen, "counter") == 0) {
+      patch.gen = Generator::counter;
+      patch.start = strtoul(line, &end, 0);
+      return end != line;
+    }
+    if (strcmp(gen, "uid") == 0) {
+      patch.gen = Generator::uid;
+      return patch.len <= 16;
+    }
+    if (strcmp(gen, "csv") == 0) {
+      patch.gen = Generator::csv;
+      line = word(line, patch.csvPath, sizeof(patch.csvPath));
+      patch.csvColumn = strtol(line, &end, 0);
+      patch.csvRow = 0;
+      patch.csvPos = 0;
+      return end != line && patch.csvColumn >= 1;
+    }
+    return false;
+  }
+
+  bool encode(const char* field, uint8_t* data, size_t len) {
+    // a "quoted string", or a number stored little endian
+    memset(data, 0, len);
+    field = skipSpace(field);
+
+    if (*field == '"') {
+      ++field;
+      for (size_t i = 0; i < len && *field && *field != '"'; ++i)
+        data[i] = *field++;
+      return true;
+    }
+
+    char* end;
+    uint32_t v = strtoul(field, &end, 0);
+    if (end == field) return false;
+    for (size_t i = 0; i < len && i < sizeof(v); ++i)
+      data[i] = v >> (8 * i);
+    return true;
+  }
+
+  bool csvField(char* line, int column, const char*& field) {
+    // finds the column'th field, and terminates it in place
+    char* p = line;
+    for (int c = 1; ; ++c) {
+      char* start = p;
+      bool quoted = false;
+      while (*p && (quoted || (*p != ',' && *p != '\r' && *p != '\n'))) {
+        if (*p == '"') quoted = !quoted;
+        ++p;
+      }
+      if (c == column) {
+        *p = '\0';
+        field = start;
+        return true;
+      }
+      if (*p != ',')
+        return false;
+      ++p;
+    }
+  }
+
+  bool csvValue(Patch& patch, uint32_t row) {
+    FatFile file;
+    if (!file.open(patch.csvPath, O_RDONLY))
+      return false;
+
+    if (row < patch.csvRow) {
+      patch.csvRow = 0;
+      patch.csvPos = 0;
+    }
+    file.seekSet(patch.csvPos);
+
+    char line[128];
+    while (file.fgets(line, sizeof(line)) > 0) {
+      auto p = skipSpace(line);
+      if (*p == '#' || *p == '\r' || *p == '\n' || *p == '\0')
+        continue;   // comments and blank lines aren't rows
+
+      if (patch.csvRow == row) {
+        const char* field;
+        return csvField(line, patch.csvColumn, field)
+          && encode(field, patch.data, patch.len);
+      }
+      patch.csvRow += 1;
+      patch.csvPos = file.curPosition();
+    }
+    return false;
+  }
+}
+
+namespace Serialization {
+
+  void setup(Interface& intf) {
+    FatFile file;
+    if (!file.open(patchesPath, O_RDONLY))
+      return;   // don't clutter the drive unless this feature is used
+    file.close();
+
+    if (!stateFile.create(statePath, 8 * 1024) || !readState())
+      intf.errorMsg("serial state file failed");
+  }
+
+  bool load(Interface& intf, size_t imageSize) {
+    patchCount = 0;
+
+    FatFile file;
+    if (!file.open(patchesPath, O_RDONLY))
+      return true;    // no patches is fine
+
+    char line[96];
+    int lineNo = 0;
+    while (file.fgets(line, sizeof(line)) > 0) {
+      lineNo += 1;
+
+      auto p = skipSpace(line);
+      if (*p == '#' || *p == '\r' || *p == '\n' || *p == '\0')
+        continue;
+
+      if (patchCount >= maxPatches) {
+        intf.errorMsgf("patches: too many, max %d", maxPatches);
+        patchCount = 0;
+        return false;
+      }
+
+      Patch& patch = patches[patchCount];
+      if (!parsePatch(p, patch)
+          || patch.len == 0 || patch.len > sizeof(patch.data)) {
+        intf.errorMsgf("patches: bad line %d", lineNo);
+        patchCount = 0;
+        return false;
+      }
+      if (patch.addr + patch.len > imageSize) {
+        intf.errorMsgf("patches: line %d outside image", lineNo);
+        patchCount = 0;
+        return false;
+      }
+      patchCount += 1;
+    }
+
+    if (patchCount > 0) {
+      if (!stateFile.isOpen()) {
+        intf.errorMsg("patches: restart the programmer");
+          // the state file is only created at start up
+        patchCount = 0;
+        return false;
+      }
+      intf.statusMsgf("%d patches, unit %lu", patchCount, state.units);
+    }
+    return true;
+  }
+
+  bool active() {
+    return patchCount > 0;
+  }
+
+  bool prepare(Interface& intf, const uint32_t serial[4]) {
+    for (size_t i = 0; i < patchCount; ++i) {
+      Patch& patch = patches[i];
+      switch (patch.gen) {
+        case Generator::counter: {
+          uint32_t v = patch.start + state.units;
+          memset(patch.data, 0, patch.len);
+          for (size_t j = 0; j < patch.len && j < sizeof(v); ++j)
+            patch.data[j] = v >> (8 * j);
+          break;
+        }
+
+        case Generator::uid:
+          memcpy(patch.data, serial, patch.len);
+          break;
+
+        case Generator::csv:
+          if (!csvValue(patch, state.units)) {
+            intf.errorMsgf("no csv value for unit %lu", state.units);
+            return false;
+          }
+          break;
+      }
+    }
+    return true;
+  }
+
+  void apply(uint32_t addr, uint8_t* buf, size_t len) {
+    for (size_t i = 0; i < patchCount; ++i) {
+      const Patch& patch = patches[i];
+
+      auto from = max(addr, patch.addr);
+      auto to = min(addr + len, patch.addr + patch.len);
+      if (from < to)
+        memcpy(buf + (from - addr), patch.data + (from - patch.addr), to - from);
+    }
+  }
+
+  bool commit() {
+    if (patchCount == 0)
+      return true;
+
+    State next = state;
+    next.seq += 1;
+    next.units += 1;
+    next.crc = next.computeCrc();
+    if (!writeState(next))
+      return false;
+
+    state = next;
+    return true;
+  }
+
+}
@@ -0,0 +1,43 @@
+#ifndef _SERIALIZATION_H_
+#define _SERIALIZATION_H_
+
+#include <cstddef>
+#include <cstdint>
+
+#include "interface.h"
+
+// Per-unit data, patched into the image as it is flashed.
+//
+// If there is a patches.txt file alongside the binaries, each line of it
+// describes a patch:
+//
+//     <address> <length> counter <start>
+//     <address> <length> uid
+//     <address> <length> csv <file> <column>
+//
+// Addresses are in the target's flash, and must be within the image.
+// counter is start plus the number of units serialized so far, little
+// endian. uid is the target's 128 bit serial number. csv takes one line of
+// the file per unit, in order, and uses the given column (starting at 1),
+// which is either a number (stored little endian) or a "quoted string".
+//
+// The number of units serialized is kept in serial-state.bin, and only
+// advances when a unit is successfully flashed. That file is created when
+// the programmer starts, if there is a patches.txt file.
+
+namespace Serialization {
+  void setup(Interface&);   // between FileManager::setup() and startUSB()
+
+  bool load(Interface&, size_t imageSize);
+    // read patches.txt, when the binaries are scanned
+  bool active();
+
+  bool prepare(Interface&, const uint32_t serial[4]);
+    // generate the values for the unit about to be flashed
+  void apply(uint32_t addr, uint8_t* buf, size_t len);
+    // patch a block of the image, about to be compared, written or verified
+  bool commit();
+    // the unit was successfully flashed, so move on to the next
+}
+
+#endif // _SERIALIZATION_H_
@@ -0,0 +1,166 @@
+#include "config.h"
+
+#ifdef MF_SWD_TRACE
+  // The Arduino IDE compiles all files... but this code is only needed if
+  // the feature is enabled
+
+#include "swd_trace.h"
+
+#include <Arduino.h>
+#include <cstring>
+
+#include "file_manager.h"
+#include "link_health.h"
+
+
+namespace {
+
+  using SwdTrace::Op;
+
+  struct Entry {
+    uint32_t at;          // micros() when the call started
+    uint32_t addr;
+    uint32_t data;
+    uint16_t took;        // µs, at most 65535
+    Op       op;
+    uint8_t  errors;      // reported by the library during the call
+  };
+  static_assert(sizeof(Entry) == 16, "swd-trace.bin entries are 16 bytes");
+
+  const uint32_t ringSize = 64;     // must be a power of two
+  Entry ring[ringSize];
+  uint32_t head = 0;                // next entry goes here
+
+  uint32_t errorCount = 0;
+  uint32_t lastClock = 0;
+
+  // Once an error to save is reported, this many more entries are recorded,
+  // and then the ring is kept as it is until it is written out.
+  const uint32_t afterError = ringSize / 4;
+  bool keeping = false;
+  uint32_t keepUntil = 0;           // head, once those are recorded
+  uint32_t errorHead = 0;           // the entry for the error
+  uint32_t errorAt = 0;             // millis()
+  char errorText[64];
+  uint32_t saves = 0;
+
+  const char* tracePath = "/swd-trace.bin";
+  const uint32_t traceSize =
+    BlockFile::blockSize + ringSize * sizeof(Entry);
+  const size_t entriesPerBlock = BlockFile::blockSize / sizeof(Entry);
+
+  BlockFile traceFile;
+
+  struct Header {
+    char     magic[8];      // "MFSWDTR1"
+    uint32_t seq;           // traces saved since power up
+    uint32_t savedAt;       // millis() at the error
+    uint32_t count;         // entries that follow
+    uint32_t errorIndex;    // of the error's entry
+    uint32_t entrySize;
+    uint32_t reserved;
+    char     text[64];      // the error, as reported
+  };
+
+
+  void put(Op op, uint32_t addr, uint32_t data,
+      uint32_t at, uint32_t took, uint32_t errors) {
+    if (keeping && head == keepUntil)
+      return;
+
+    auto& e = ring[head & (ringSize - 1)];
+    e.at = at;
+    e.addr = addr;
+    e.data = data;
+    e.took = took < 0xffff ? took : 0xffff;
+    e.op = op;
+    e.errors = errors < 0xff ? errors : 0xff;
+    head += 1;
+  }
+
+  bool write() {
+    uint8_t block[BlockFile::blockSize];
+    auto count = min(head, ringSize);
+    auto first = head - count;
+
+    memset(block, 0, sizeof(block));
+    Header& h = *reinterpret_cast<Header*>(block);
+    memcpy(h.magic, "MFSWDTR1", sizeof(h.magic));
+    h.seq = ++saves;
+    h.savedAt = errorAt;
+    h.count = count;
+    h.errorIndex = errorHead - first;
+    h.entrySize = sizeof(Entry);
+    strncpy(h.text, errorText, sizeof(h.text) - 1);
+    if (!traceFile.write(0, block))
+      return false;
+
+    for (uint32_t b = 1; b < traceFile.blocks(); ++b) {
+      memset(block, 0, sizeof(block));
+      for (size_t i = 0; i < entriesPerBlock; ++i) {
+        auto n = (b - 1) * entriesPerBlock + i;
+        if (n < count)
+          memcpy(block + i * sizeof(Entry),
+            &ring[(first + n) & (ringSize - 1)], sizeof(Entry));
+      }
+      if (!traceFile.write(b, block))
+        return false;
+    }
+    return true;
+  }
+}
+
+namespace SwdTrace {
+
+  void setup(Interface& intf) {
+    if (!traceFile.create(tracePath, traceSize))
+      intf.errorMsg("swd trace create failed");
+  }
+
+  uint32_t errors() {
+    return errorCount;
+  }
+
+  void record(Op op, uint32_t addr, uint32_t data,
+      uint32_t startedAt, uint32_t errorsAt) {
+    auto took = micros() - startedAt;
+
+    auto clock = LinkHealth::clock();
+    if (clock != lastClock) {
+      put(Op::clock, 0, clock, startedAt, 0, 0);
+      lastClock = clock;
+    }
+    put(op, addr, data, startedAt, took, errorCount - errorsAt);
+  }
+
+  void error(const char* text, bool save) {
+    // recorded as it happens, so it comes before the call it was part of
+    errorCount += 1;
+    put(Op::error, 0, 0, micros(), 0, 0);
+
+    if (save && !keeping) {
+      keeping = true;
+      errorHead = head - 1;
+      keepUntil = head + afterError;
+      errorAt = millis();
+      strncpy(errorText, text, sizeof(errorText) - 1);
+      errorText[sizeof(errorText) - 1] = '\0';
+    }
+  }
+
+  void idle() {
+    if (!keeping || !traceFile.isOpen())
+      return;
+
+    if (FileManager::changing())
+      return;   // wait until the host is done with the drive
+
+    // The host may have deleted or replaced the file since it was last
+    // written: look it up again before writing blocks into it.
+    if (traceFile.open(tracePath))
+      write();
+    keeping = false;    // written, or there is nowhere to write it
+  }
+}
+
+#endif // MF_SWD_TRACE
@@ -0,0 +1,80 @@
+#ifndef _SWD_TRACE_H_
+#define _SWD_TRACE_H_
+
+#include <Arduino.h>
+#include <cstdint>
+
+#include "config.h"
+#include "interface.h"
+
+// A trace of the last SWD transactions, for MF_SWD_TRACE, so that a unit
+// that failed in the field can be looked into without a logic analyser.
+//
+// Each call the programmer makes into the DAP library is recorded in a ring
+// in RAM: what it was, the address and data, when it started and how long it
+// took, and how many errors the library reported during it. Errors, and
+// changes of the SWD clock, get entries of their own.
+//
+// When an error is reported while flashing, a few more transactions are
+// recorded, to see what the recovery did, and then the ring is kept as it is
+// until idle() writes it to swd-trace.bin on the drive, between units. The
+// file holds only the latest failure. tools/swd-trace.py decodes it; the
+// layout is described there.
+
+namespace SwdTrace {
+  enum struct Op : uint8_t {
+    clock,          // the SWD clock changed: data is the new clock, as
+                    // given to the DAP library
+    error,          // the DAP library reported an error
+    connect,        // the whole connect sequence
+    select,         // data is the device ID
+    readWord,
+    writeWord,
+    readBlock,      // data is the length
+    programBlock,   // data is the length
+    fuseRead,       // data is the low word of the fuses
+    fuseWrite,      // data is the low word of the fuses
+    resetLink,
+  };
+
+  void setup(Interface&);   // between FileManager::setup() and startUSB()
+
+#ifdef MF_SWD_TRACE
+  void error(const char* text, bool save);
+    // from the DAP library's error function; if save, the trace is kept
+    // for idle() to write out
+#else
+  inline void error(const char*, bool) { }
+#endif
+  void idle();
+
+  void record(Op, uint32_t addr, uint32_t data,
+    uint32_t startedAt, uint32_t errorsAt);
+  uint32_t errors();
+
+  class Call {
+    // records a call into the DAP library, once it goes out of scope;
+    // nothing without MF_SWD_TRACE
+  public:
+#ifdef MF_SWD_TRACE
+    Call(Op op, uint32_t addr = 0, uint32_t data = 0)
+      : data(data), op(op), addr(addr),
+        startedAt(micros()), errorsAt(errors()) { }
+    ~Call() { record(op, addr, data, startedAt, errorsAt); }
+
+    uint32_t data;    // may be set once the result is known
+
+  private:
+    Op op;
+    uint32_t addr;
+    uint32_t startedAt;
+    uint32_t errorsAt;
+#else
+    Call(Op, uint32_t = 0, uint32_t = 0) { }
+
+    uint32_t data;
+#endif
+  };
+}
+
+#endif // _SWD_TRACE_H_
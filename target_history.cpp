@@ -0,0 +1,182 @@
+#include "target_history.h"
+
+#include <cstring>
+
+#include "crc32.h"
+#include "file_manager.h"
+
+
+namespace {
+
+  const char* historyPath = "/target-history.bin";
+  const uint32_t historySize = 256 * 1024;    // about 4000 targets
+
+  using Entry = TargetHistory::Entry;
+  const size_t entriesPerBlock = BlockFile::blockSize / sizeof(Entry);
+  static_assert(sizeof(Entry) * entriesPerBlock == BlockFile::blockSize,
+    "entries must fill a block exactly");
+
+  // Block 0 is a header; the rest are buckets. Entries are never removed,
+  // so a lookup can stop at the first empty slot. If a bucket is full, the
+  // following ones are tried, and if those are full too, an old entry in
+  // the first is replaced.
+
+  const uint32_t historyMagic = 0x3148464d;   // "MFH1"
+  const uint32_t maxProbes = 4;
+
+  struct Header {
+    uint32_t magic;
+    uint32_t entrySize;
+  };
+
+  BlockFile historyFile;
+
+  struct Slot {
+    uint32_t block;
+    size_t   index;
+    bool     found;     // else the slot is free, or is to be replaced
+  };
+
+  bool isEmpty(const Entry& e) {
+    return e.serial[0] == 0xffffffff && e.serial[1] == 0xffffffff
+      && e.serial[2] == 0xffffffff && e.serial[3] == 0xffffffff;
+  }
+
+  uint32_t hash(const uint32_t serial[4]) {
+    return crc32(reinterpret_cast<const uint8_t*>(serial), 4 * sizeof(uint32_t));
+  }
+
+  using Bucket = Entry[entriesPerBlock];   // one block of the file
+
+  bool readBucket(uint32_t b, Bucket& bucket) {
+    return historyFile.read(b, reinterpret_cast<uint8_t*>(bucket));
+  }
+
+  bool find(const uint32_t serial[4], Bucket& bucket, Slot& slot) {
+    // leaves the bucket holding the slot in bucket
+    auto h = hash(serial);
+    auto buckets = historyFile.blocks() - 1;
+
+    for (uint32_t p = 0; p < maxProbes; ++p) {
+      slot.block = 1 + (h + p) % buckets;
+      if (!readBucket(slot.block, bucket))
+        return false;
+
+      for (slot.index = 0; slot.index < entriesPerBlock; ++slot.index) {
+        const Entry& e = bucket[slot.index];
+        if (memcmp(e.serial, serial, sizeof(e.serial)) == 0) {
+          slot.found = true;
+          return true;
+        }
+        if (isEmpty(e)) {
+          slot.found = false;
+          return true;
+        }
+      }
+    }
+
+    slot.block = 1 + h % buckets;
+    slot.index = (h >> 16) % entriesPerBlock;
+    slot.found = false;
+    return readBucket(slot.block, bucket);
+  }
+
+  bool initialize() {
+    uint8_t block[BlockFile::blockSize];
+
+    memset(block, 0xff, sizeof(block));
+    for (uint32_t b = 1; b < historyFile.blocks(); ++b)
+      if (!historyFile.writeBack(b, block))
+        return false;
+    if (!historyFile.sync())
+      return false;
+
+    Header header = { historyMagic, sizeof(Entry) };
+    memcpy(block, &header, sizeof(header));
+    return historyFile.write(0, block);   // last, so a partial one is redone
+  }
+
+  const size_t queueSize = 4;
+  Entry queue[queueSize];
+  size_t queueHead = 0;     // next entry recorded goes here
+  size_t queueTail = 0;     // next entry written comes from here
+}
+
+namespace TargetHistory {
+
+  void setup(Interface& intf) {
+    if (!historyFile.create(historyPath, historySize)) {
+      intf.errorMsg("history file create failed");
+      return;
+    }
+
+    uint8_t block[BlockFile::blockSize];
+    Header header = { 0, 0 };
+    if (historyFile.read(0, block))
+      memcpy(&header, block, sizeof(header));
+    if (header.magic == historyMagic && header.entrySize == sizeof(Entry))
+      return;
+
+    intf.statusMsg("initializing history");
+    if (!initialize()) {
+      intf.errorMsg("history file write failed");
+      historyFile.close();
+    }
+  }
+
+  bool lookup(const uint32_t serial[4], Entry& entry) {
+    if (!historyFile.isOpen())
+      return false;
+
+    Bucket bucket;
+    Slot slot;
+    if (!find(serial, bucket, slot) || !slot.found)
+      return false;
+
+    entry = bucket[slot.index];
+    return true;
+  }
+
+  void record(const FlashStats& stats) {
+    if (!stats.success || !historyFile.isOpen())
+      return;
+    if (queueHead - queueTail >= queueSize)
+      return;   // only if writes are failing
+
+    Entry& e = queue[queueHead % queueSize];
+    memcpy(e.serial, stats.serial, sizeof(e.serial));
+    e.imageCrc = stats.imageCrc;
+    memcpy(e.fuses, stats.fuses, sizeof(e.fuses));
+    e.totalTime = min(stats.totalTime / 1000, static_cast<uint32_t>(0xffff));
+    e.count = 1;
+    queueHead += 1;
+  }
+
+  void idle() {
+    if (queueHead == queueTail || !historyFile.isOpen())
+      return;
+
+    if (FileManager::changing())
+      return;   // wait until the host is done with the drive
+
+    // The host may have deleted or replaced the file since it was last
+    // written: look it up again before writing blocks into it.
+    if (!historyFile.open(historyPath))
+      return;
+
+    Bucket bucket;
+    Slot slot;
+    Entry& e = queue[queueTail % queueSize];
+    if (!find(e.serial, bucket, slot))
+      return;
+
+    if (slot.found)
+      e.count = min(bucket[slot.index].count + 1, 0xffff);
+    bucket[slot.index] = e;
+    if (!historyFile.write(slot.block, reinterpret_cast<uint8_t*>(bucket)))
+      return;
+
+    queueTail += 1;
+  }
+
+}
@@ -0,0 +1,36 @@
+#ifndef _TARGET_HISTORY_H_
+#define _TARGET_HISTORY_H_
+
+#include <cstdint>
+
+#include "interface.h"
+
+// What was last flashed onto each target, by its 128 bit serial number.
+//
+// When a target comes back, say after rework or for a firmware check, and
+// it was last flashed with the same image, it only needs to be verified.
+//
+// The history is kept in target-history.bin, a hash table of fixed size
+// entries: a serial number hashes to one block of the file, so a lookup is
+// a single block read. Updates are queued in RAM, and only written out from
+// idle().
+
+namespace TargetHistory {
+  struct Entry {
+    uint32_t  serial[4];
+    uint32_t  imageCrc;     // of the image last flashed
+    uint32_t  fuses[3];     // the user row, as left
+    uint16_t  totalTime;    // ms, of the last flashing
+    uint16_t  count;        // number of times flashed
+    uint8_t   unused[28];   // so entries fill a block exactly
+  };
+
+  void setup(Interface&);   // between FileManager::setup() and startUSB()
+
+  bool lookup(const uint32_t serial[4], Entry&);
+  void record(const FlashStats&);
+    // only successful flashings are kept
+  void idle();
+}
+
+#endif // _TARGET_HISTORY_H_
@@ -0,0 +1,218 @@
+#!/usr/bin/env python3
+"""Profile a Multi-Flash programmer built with MF_PROFILE.
+
+Captures the samples and region timings the programmer sends, finds the
+function each sample fell in from the sketch's ELF file, and prints where
+the time went: by library, by function, and in the timed regions.
+
+    tools/profile.py /dev/ttyACM0 multi-flash.ino.elf
+    tools/profile.py --seconds 30 --save run.txt /dev/ttyACM0 multi-flash.ino.elf
+    tools/profile.py --load run.txt multi-flash.ino.elf
+
+Capture runs until ^C, or for --seconds. The ELF file is in the Arduino IDE's
+build directory: turn on verbose output for compilation to see where. Its
+symbols are read with arm-none-eabi-nm, from the Arduino toolchain, which
+must be on the PATH, or given with --nm.
+"""
+
+import argparse
+import bisect
+import collections
+import os
+import re
+import select
+import subprocess
+import sys
+import termios
+import time
+import tty
+
+
+class Port:
+    def __init__(self, path):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        if os.isatty(self.fd):
+            tty.setraw(self.fd)
+            termios.tcflush(self.fd, termios.TCIOFLUSH)
+        self.pending = b''
+
+    def lines(self, until=None):
+        while True:
+            while b'\n' not in self.pending:
+                timeout = None if until is None else until - time.time()
+                if timeout is not None and timeout <= 0:
+                    return
+                ready, _, _ = select.select([self.fd], [], [], timeout)
+                if not ready:
+                    return
+                data = os.read(self.fd, 4096)
+                if not data:
+                    return
+                self.pending += data
+            line, self.pending = self.pending.split(b'\n', 1)
+            yield line.rstrip(b'\r').decode('utf-8', 'replace')
+
+
+class Profile:
+    def __init__(self):
+        self.samples = collections.Counter()    # by address
+        self.count = 0
+        self.lost = 0
+        self.regions = {}   # name: [count, total µs, longest µs]
+        self.seconds = 0.0
+
+    def add(self, line):
+        words = line.split()
+        if len(words) < 3 or words[0] != 'prof:':
+            return False
+        if words[1] == 'pc':
+            self.lost = max(self.lost, int(words[2], 16))
+            for w in words[3:]:
+                self.samples[int(w, 16)] += 1
+                self.count += 1
+        elif words[1] == 'region' and len(words) == 6:
+            r = self.regions.setdefault(words[2], [0, 0, 0])
+            r[0] += int(words[3])
+            r[1] += int(words[4])
+            r[2] = max(r[2], int(words[5]))
+        else:
+            return False
+        return True
+
+
+class Symbols:
+    # Text symbols, sorted by address, with the source file each is from
+    line = re.compile(r'^([0-9a-f]+)(?: ([0-9a-f]+))? [tTwW] ([^\t]*)(?:\t(.*))?$')
+
+    def __init__(self, nm, elf):
+        out = subprocess.run(
+            [nm, '-n', '-C', '-S', '-l', '--defined-only', elf],
+            check=True, stdout=subprocess.PIPE, universal_newlines=True).stdout
+        self.starts = []
+        self.entries = []
+        for text in out.splitlines():
+            m = self.line.match(text)
+            if not m:
+                continue
+            start = int(m.group(1), 16)
+            size = int(m.group(2), 16) if m.group(2) else 0
+            self.starts.append(start)
+            self.entries.append((start, size, m.group(3), area(m.group(4))))
+
+    def find(self, addr):
+        i = bisect.bisect_right(self.starts, addr) - 1
+        if i < 0:
+            return '?', '?'
+        start, size, name, where = self.entries[i]
+        if size and addr >= start + size:
+            return '0x%x' % addr, '?'
+        return name, where
+
+
+def area(source):
+    # The library, or the sketch's own file, or the core, a symbol is from
+    if not source:
+        return 'no source'
+    path = source.rsplit(':', 1)[0].replace('\\', '/')
+    m = re.search(r'/libraries/([^/]+)/', path)
+    if m:
+        return m.group(1)
+    if '/cores/' in path:
+        return 'core'
+    if '/multi-flash/' in path or path.endswith('.ino'):
+        return os.path.basename(path)
+    return 'other'
+
+
+def capture(port, seconds, save):
+    profile = Profile()
+    until = time.time() + seconds if seconds else None
+    startAt = time.time()
+    try:
+        for line in port.lines(until):
+            if profile.add(line):
+                if save:
+                    save.write(line + '\n')
+            else:
+                print(line)
+    except KeyboardInterrupt:
+        pass
+    profile.seconds = time.time() - startAt
+    if save:
+        save.write('# seconds %.3f\n' % profile.seconds)
+    return profile
+
+
+def load(f):
+    profile = Profile()
+    for line in f:
+        line = line.strip()
+        if line.startswith('# seconds '):
+            profile.seconds = float(line.split()[2])
+        else:
+            profile.add(line)
+    return profile
+
+
+def table(title, counts, total, top):
+    print('\n%-48s %8s %6s' % (title, 'samples', '%'))
+    for name, n in counts.most_common(top):
+        print('%-48s %8d %5.1f%%' % (name[:48], n, 100.0 * n / total))
+
+
+def report(profile, symbols, top):
+    total = profile.count
+    print('%d samples, %d lost, over %.1fs' %
+          (total, profile.lost, profile.seconds))
+    if not total:
+        return
+
+    byFunction = collections.Counter()
+    byArea = collections.Counter()
+    for addr, n in profile.samples.items():
+        name, where = symbols.find(addr)
+        byFunction[name] += n
+        byArea[where] += n
+    table('by library, or file', byArea, total, top)
+    table('by function', byFunction, total, top)
+
+    if profile.regions:
+        print('\n%-16s %8s %10s %10s %10s %6s' %
+              ('region', 'count', 'total ms', 'mean µs', 'longest µs', '%'))
+        for name, (count, totalUs, longest) in sorted(profile.regions.items()):
+            share = (100.0 * totalUs / 1e6 / profile.seconds
+                     if profile.seconds else 0.0)
+            print('%-16s %8d %10.1f %10.1f %10d %5.1f%%' %
+                  (name, count, totalUs / 1000.0, totalUs / float(count),
+                   longest, share))
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Profile a Multi-Flash programmer built with MF_PROFILE.')
+    parser.add_argument('port', nargs='?', help='serial port, such as /dev/ttyACM0')
+    parser.add_argument('elf', help="the sketch's ELF file")
+    parser.add_argument('--seconds', type=float, help='capture for this long')
+    parser.add_argument('--save', help='also write what is captured to this file')
+    parser.add_argument('--load', help='read a saved capture, instead of the port')
+    parser.add_argument('--nm', default='arm-none-eabi-nm', help='nm to use')
+    parser.add_argument('--top', type=int, default=25, help='rows in each table')
+    args = parser.parse_args()
+
+    if args.load:
+        with open(args.load) as f:
+            profile = load(f)
+    elif args.port:
+        save = open(args.save, 'w') if args.save else None
+        profile = capture(Port(args.port), args.seconds, save)
+        if save:
+            save.close()
+    else:
+        parser.error('give a port, or --load')
+
+    report(profile, Symbols(args.nm, args.elf), args.top)
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,451 @@
+// Predicts how many units an assembly station with Multi-Flash programmers
+// can do in an hour, for a given image and configuration: the programmer's
+// own Flasher, from flash_manager.cpp, is run against a simulated SAMD21
+// over the simulated SWD wire (see tools/swd-sim/sim_programmer.h), reading
+// its binaries with file_manager.cpp off an emulated drive; the operator's
+// part is timed as given.
+//
+//    station_sim [--start button|probe|sense] [--verify full|known]
+//                [--flashed] [--display oled|cpx|none] [--gang n]
+//                [--attach s] [--press s] [--detach s] [--shift h]
+//                [--pin-ns n] [--txn-ns n] [--byte-ns n] [--image file]
+//                boot.bin [app.bin]
+//
+// The binaries are put on the drive under their own names, so they must be
+// named as they would be on the programmer's drive.
+//
+// One unit is flashed, and its phases printed as a waterfall: what the
+// operator does, and each phase of flashing, as Flasher times them in its
+// FlashStats, with the time in each that went on reading the drive, and on
+// updating the display. A phase that Flasher didn't get to, because it
+// failed or had no need, isn't shown. Time is
+// simulated, so this is repeatable, and every unit after it would be the
+// same: the steady state rate follows from it.
+//
+// How a unit is started:
+//
+//    button  the operator presses "A" once it is attached; flashing starts
+//            a second later, so they can let go (as in multi-flash.ino)
+//    probe   MF_AUTO_START, probing for the target over SWD twice a
+//            second, and three probes in a row are needed to see it come
+//            or go
+//    sense   MF_AUTO_START, with TARGET_SENSE wired: the pin must be
+//            steady for 250ms
+//
+// For probe and sense, the mean time to see a change is used.
+//
+// --verify known is a target that the target history has, flashed with the
+// same binaries: it is flashed once before the unit is timed, so that it
+// is, and then only verified. --flashed is a target that holds the
+// image already, with its boot protected, but isn't in the history: it is
+// flashed in full, but the pages that are unchanged are skipped.
+//
+// The programmer doesn't drive more than one target. --gang is that many
+// programmers, side by side, with one operator going from one to the next:
+// each programmer's cycle is the operator's time and its own, but the
+// operator can only do one thing at a time.
+
+#include <Adafruit_SPIFlash.h>
+#include <SdFat.h>
+
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <initializer_list>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "file_manager.h"
+#include "interface.h"
+#include "samd21_sim.h"
+#include "sim_programmer.h"
+#include "swd_sim.h"
+
+
+namespace {
+
+  using namespace SwdSim;
+
+  enum class Start { button, probe, sense };
+  enum class Display { oled, cpx, none };
+
+  struct Config {
+    Start start = Start::button;
+    Display display = Display::oled;
+    bool known = false;     // --verify known
+    bool flashed = false;
+    int gang = 1;
+
+    double attach = 4.0;    // s, the operator's times
+    double press = 0.5;
+    double detach = 2.0;
+    double shift = 8.0;     // hours
+  };
+
+  Config config;
+
+
+  Time startDelay(Start s) {
+    switch (s) {
+      case Start::button: return 1000 * ms;   // after the press
+      case Start::probe:  return 1250 * ms;   // 3 probes, 500ms apart
+      case Start::sense:  return 250 * ms;    // settle time
+    }
+    return 0;
+  }
+
+  Time frameTime(Display d) {
+    switch (d) {
+      case Display::oled:
+        // a whole 128x32 frame over I2C at 400kHz: 512 bytes of pixels, and
+        // some commands, 9 bits a byte
+        return 12400 * us;
+      case Display::cpx:
+        // ten NeoPixels, 24 bits each at 800kHz, and the latch
+        return 350 * us;
+      case Display::none:
+        return 0;
+    }
+    return 0;
+  }
+
+
+  // Each phase's time is taken apart into what went on reading the drive,
+  // updating the display, and the rest: SWD, and the target. These are
+  // noted as they happen, and put in the phases they fell in at the end.
+
+  struct Phase {
+    const char* name;
+    bool operatorDoes;
+    Time start;
+    Time time;
+    Time storage;
+    Time display;
+  };
+
+  std::vector<Phase> phases;
+
+  struct Spent {
+    Time at;
+    Time storage;
+    Time display;
+  };
+
+  std::vector<Spent> spent;
+
+  void followStorage(uint64_t ns) {
+    spent.push_back({ now(), ns, 0 });
+    wait(ns);
+  }
+
+  void begin(const char* name, bool operatorDoes = false) {
+    phases.push_back({ name, operatorDoes, now(), 0, 0, 0 });
+  }
+
+  void end() {
+    auto& p = phases.back();
+    p.time = now() - p.start;
+  }
+
+  void flasherPhases(Time at, const FlashStats& s) {
+    // Flasher's phases follow one another, from when it started
+    const struct { const char* name; uint32_t time; } times[] = {
+      { "connect",  s.connectTime },
+      { "fuses",    s.fuseTime },
+      { "program",  s.programTime },
+      { "verify",   s.verifyTime },
+      { "finish",   s.finishTime },
+    };
+    for (auto& t : times) {
+      if (t.time == 0)
+        continue;
+      phases.push_back({ t.name, false, at, Time(t.time) * us, 0, 0 });
+      at += Time(t.time) * us;
+    }
+  }
+
+  void account() {
+    for (auto& p : phases) {
+      for (auto& s : spent) {
+        if (p.start <= s.at && s.at < p.start + p.time) {
+          p.storage += s.storage;
+          p.display += s.display;
+        }
+      }
+    }
+  }
+
+  void human(const char* name, double seconds) {
+    begin(name, true);
+    wait(Time(seconds * 1e9));
+    end();
+  }
+
+
+  class StationInterface : public InterfaceBase {
+  public:
+    // Only the display's time matters here: the OLED redraws the whole frame
+    // for each line, the Circuit Playground's pixels only show progress.
+
+    void startMsg(const char* msg)  { text(); }
+    void statusMsg(const char* msg) { text(); }
+    void errorMsg(const char* msg) {
+      text();
+      fprintf(stderr, "error: %s\n", msg);
+      errors += 1;
+    }
+
+    void progress(const Progress& p) { frame(); }
+    void stats(const FlashStats& s)  { text(); last = s; }
+
+    int errors = 0;
+    FlashStats last = { };
+
+  private:
+    void text() {
+      if (config.display == Display::oled)
+        frame();
+    }
+
+    void frame() {
+      auto t = frameTime(config.display);
+      spent.push_back({ now(), 0, t });
+      wait(t);
+    }
+  };
+
+  StationInterface intf;
+
+  Adafruit_FlashTransport_QSPI stationTransport;
+  Adafruit_SPIFlash stationFlash(&stationTransport);
+  FatFileSystem stationFs;
+    // to build the drive; file_manager.cpp has its own, on the same chip
+
+
+  std::string baseName(const std::string& path) {
+    auto slash = path.find_last_of('/');
+    return slash == std::string::npos ? path : path.substr(slash + 1);
+  }
+
+  bool readFile(const std::string& path, std::vector<uint8_t>& data) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f) {
+      fprintf(stderr, "%s: can't read\n", path.c_str());
+      return false;
+    }
+    data.assign(std::istreambuf_iterator<char>(f),
+                std::istreambuf_iterator<char>());
+    return true;
+  }
+
+  bool buildDrive(const std::vector<std::string>& paths, FilesToFlash& files,
+      std::vector<uint8_t>& image) {
+    FlashEmu::erase();
+    if (!FileManager::setup(intf) || !stationFs.begin(&stationFlash))
+      return false;
+
+    // In the order the programmer puts them in the image
+    for (const char* prefix : { "boot", "app" }) {
+      for (auto& path : paths) {
+        auto name = baseName(path);
+        if (name.compare(0, strlen(prefix), prefix) != 0)
+          continue;
+
+        std::vector<uint8_t> data;
+        if (!readFile(path, data))
+          return false;
+        FatFile file;
+        if (!file.open(stationFs.vwd(), name.c_str(),
+              O_RDWR | O_CREAT | O_TRUNC)
+            || size_t(file.write(data.data(), data.size())) != data.size()
+            || !file.close()) {
+          fprintf(stderr, "%s: can't write to the drive\n", name.c_str());
+          return false;
+        }
+        image.insert(image.end(), data.begin(), data.end());
+      }
+    }
+    stationFlash.syncBlocks();
+
+    if (!FileManager::setup(intf))    // mounted afresh, as at boot
+      return false;
+    files.scan(intf);
+    if (!files.okayToFlash()) {
+      fprintf(stderr, "the binaries aren't ready to flash\n");
+      return false;
+    }
+    return true;
+  }
+
+
+  void waterfall(Time unitAt, Time cycle) {
+    const int width = 40;   // characters for the whole cycle
+
+    printf("%-8s %-10s %8s %8s %10s %10s\n",
+      "phase", "by", "start s", "time s", "storage ms", "display ms");
+    for (auto& p : phases) {
+      auto start = p.start - unitAt;
+      printf("%-8s %-10s %8.3f %8.3f %10.1f %10.1f  ",
+        p.name, p.operatorDoes ? "operator" : "programmer",
+        start / 1e9, p.time / 1e9, p.storage / 1e6, p.display / 1e6);
+
+      int from = int(start * width / cycle);
+      int to = max(from + 1, int((start + p.time) * width / cycle));
+      printf("%*s%s\n", from, "",
+        std::string(to - from, p.operatorDoes ? '=' : '#').c_str());
+    }
+  }
+
+  void usage() {
+    fprintf(stderr,
+      "usage: station_sim [--start button|probe|sense] [--verify full|known]\n"
+      "                   [--flashed] [--display oled|cpx|none] [--gang n]\n"
+      "                   [--attach s] [--press s] [--detach s] [--shift h]\n"
+      "                   [--pin-ns n] [--txn-ns n] [--byte-ns n]"
+      " [--image file]\n"
+      "                   boot.bin [app.bin]\n");
+  }
+
+  bool option(const std::string& arg, const char* value,
+      const char* name, std::initializer_list<const char*> choices, int& which) {
+    if (arg != name)
+      return false;
+    which = -1;
+    int i = 0;
+    for (auto c : choices) {
+      if (strcmp(value, c) == 0)
+        which = i;
+      i += 1;
+    }
+    return true;
+  }
+}
+
+int main(int argc, char** argv) {
+  std::vector<std::string> binaries;
+  std::string drivePath = "station-sim.img";
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    const char* value = i + 1 < argc ? argv[i + 1] : "";
+    int which = 0;
+
+    if (option(arg, value, "--start", { "button", "probe", "sense" }, which))
+      config.start = Start(which);
+    else if (option(arg, value, "--display", { "oled", "cpx", "none" }, which))
+      config.display = Display(which);
+    else if (option(arg, value, "--verify", { "full", "known" }, which))
+      config.known = which == 1;
+    else if (arg == "--flashed")      { config.flashed = true; continue; }
+    else if (arg == "--gang")         config.gang = atoi(value);
+    else if (arg == "--attach")       config.attach = atof(value);
+    else if (arg == "--press")        config.press = atof(value);
+    else if (arg == "--detach")       config.detach = atof(value);
+    else if (arg == "--shift")        config.shift = atof(value);
+    else if (arg == "--pin-ns")       pinTime = atoi(value);
+    else if (arg == "--txn-ns")       FlashEmu::timing.transaction = atoi(value);
+    else if (arg == "--byte-ns")      FlashEmu::timing.perByte = atoi(value);
+    else if (arg == "--image")        drivePath = value;
+    else if (arg[0] != '-') { binaries.push_back(arg); continue; }
+    else { usage(); return 2; }
+
+    if (which < 0 || i + 1 >= argc) { usage(); return 2; }
+    i += 1;
+  }
+  if (binaries.empty() || binaries.size() > 2 || config.gang < 1) {
+    usage();
+    return 2;
+  }
+
+  FilesToFlash files;
+  std::vector<uint8_t> image;
+  if (!FlashEmu::open(drivePath, 2 * 1024 * 1024)
+      || !buildDrive(binaries, files, image))
+    return 2;
+
+  Samd21 chip;
+  if (image.empty() || image.size() > chip.flash.size()) {
+    fprintf(stderr, "the image must be 1 to %zu bytes\n", chip.flash.size());
+    return 2;
+  }
+  if (config.known || config.flashed) {
+    memcpy(chip.flash.data(), image.data(), image.size());
+    chip.userRow[0] = (chip.userRow[0] & ~7) | 2;   // boot protected
+  }
+
+  Target target(chip);
+  SimProgrammer::attach(target);
+  if (config.known) {
+    SimProgrammer::Console console;
+    console.quiet = true;
+    SimProgrammer::flash(console, files);
+    if (!console.last.success)
+      return 1;
+  }
+  FlashEmu::follow = followStorage;
+
+  // One unit, from the operator picking it up
+  auto unitAt = now();
+  human("attach", config.attach);
+  if (config.start == Start::button)
+    human("press", config.press);
+  begin("start");
+  intf.statusMsg("Starting flash...");
+  wait(startDelay(config.start));
+  end();
+
+  auto flashAt = now();
+  SimProgrammer::flash(intf, files);
+  auto& stats = intf.last;
+  bool ok = stats.success;
+  flasherPhases(flashAt, stats);
+  human("detach", config.detach);
+
+  // When auto started, the programmer has to see the target go before it
+  // can start again: the operator attaching the next one mostly hides that
+  Time rearm = config.start == Start::button ? 0 : startDelay(config.start);
+  Time attachTime = Time(config.attach * 1e9);
+  if (rearm > attachTime) {
+    begin("re-arm");
+    wait(rearm - attachTime);
+    end();
+  }
+  Time cycle = now() - unitAt;
+  account();
+
+  const char* starts[] = { "button", "probe", "sense" };
+  const char* displays[] = { "oled", "cpx", "none" };
+  printf("image:   %zu bytes, %s, %s start, %s display, pin %lluns\n",
+    image.size(), config.known ? "known target, verify only"
+      : config.flashed ? "flashed target" : "blank target",
+    starts[int(config.start)], displays[int(config.display)],
+    (unsigned long long)pinTime);
+  printf("result:  %s%s, %u rows erased, %u written, the user row's"
+    " included\n\n",
+    ok ? "pass" : "fail", stats.confirmed ? ", confirmed" : "",
+    stats.rowsErased, stats.rowsWritten);
+  waterfall(unitAt, cycle);
+
+  // The operator's time, and the programmer's, for each unit
+  Time handling = 0;
+  for (auto& p : phases)
+    if (p.operatorDoes)
+      handling += p.time;
+  Time machine = cycle - handling;
+  Time round = max(Time(config.gang) * handling, cycle);
+  double perHour = config.gang * 3600e9 / round;
+  printf("\ncycle:   %.2fs a unit, operator %.2fs, programmer %.2fs\n",
+    cycle / 1e9, handling / 1e9, machine / 1e9);
+  if (config.gang > 1)
+    printf("gang:    %d programmers, %.2fs a round, %s bound\n",
+      config.gang, round / 1e9,
+      Time(config.gang) * handling >= cycle ? "operator" : "programmer");
+  printf("rate:    %.0f units an hour, %.0f in a %.1f hour shift\n",
+    perHour, floor(perHour * config.shift), config.shift);
+
+  FlashEmu::close();
+  return ok && intf.errors == 0 ? 0 : 1;
+}
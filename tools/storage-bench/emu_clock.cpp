@@ -0,0 +1,12 @@
+// Arduino's time calls, running on the emulated flash chip's simulated time.
+// Built with the SWD simulator instead, tools/swd-sim/sim_arduino.cpp has
+// these, and FlashEmu::follow carries the chip's time over to its clock.
+
+#include <Adafruit_SPIFlash.h>
+#include <Arduino.h>
+
+
+unsigned long millis() { return FlashEmu::now() / 1000000; }
+unsigned long micros() { return FlashEmu::now() / 1000; }
+void delay(unsigned long t) { FlashEmu::wait(t * 1000000ull); }
+void delayMicroseconds(unsigned int t) { FlashEmu::wait(t * 1000ull); }
@@ -0,0 +1,237 @@
+// The flash chip, as an image file mapped into memory, behind the host's
+// Adafruit_SPIFlash; and the board's other globals, that file_manager.cpp
+// and SdFat refer to. Arduino's time calls are in emu_clock.cpp.
+
+#include <Adafruit_SleepyDog.h>
+#include <Adafruit_SPIFlash.h>
+#include <Adafruit_TinyUSB.h>
+#include <Arduino.h>
+#include <SPI.h>
+
+#include <cstdio>
+#include <cstring>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+
+namespace {
+
+  const uint32_t pageLen = 256;
+  const uint32_t sectorLen = 4096;
+  const uint32_t blockLen = 512;
+
+  int fd = -1;
+  uint8_t* image = NULL;
+  uint32_t imageSize = 0;
+
+  uint64_t simTime = 0;
+
+  void spend(uint64_t ns) {
+    simTime += ns;
+    if (FlashEmu::follow)
+      FlashEmu::follow(ns);
+  }
+
+  bool inRange(uint32_t addr, size_t len) {
+    return image && addr <= imageSize && len <= imageSize - addr;
+  }
+
+  uint32_t spanned(uint32_t addr, size_t len, uint32_t unit) {
+    if (len == 0) return 0;
+    return (addr + len - 1) / unit - addr / unit + 1;
+  }
+
+  bool read(uint32_t addr, uint8_t* buf, size_t len) {
+    if (!inRange(addr, len))
+      return false;
+    memcpy(buf, image + addr, len);
+
+    FlashEmu::stats.reads += 1;
+    FlashEmu::stats.bytesRead += len;
+    spend(FlashEmu::timing.transaction + len * FlashEmu::timing.perByte);
+    return true;
+  }
+
+  bool write(uint32_t addr, const uint8_t* buf, size_t len) {
+    if (!inRange(addr, len))
+      return false;
+    memcpy(image + addr, buf, len);
+
+    auto pages = spanned(addr, len, pageLen);
+    FlashEmu::stats.writes += pages;
+    spend(pages * (FlashEmu::timing.transaction
+      + pageLen * FlashEmu::timing.perByte + FlashEmu::timing.pageProgram));
+    return true;
+  }
+
+  bool erase(uint32_t sector) {
+    if (!inRange(sector, sectorLen))
+      return false;
+    memset(image + sector, 0xff, sectorLen);
+
+    FlashEmu::stats.erases += 1;
+    spend(FlashEmu::timing.transaction + FlashEmu::timing.sectorErase);
+    return true;
+  }
+
+
+  // The library's cache, for block writes
+
+  const uint32_t noSector = ~0u;
+  uint32_t cacheAddr = noSector;
+  uint8_t cache[sectorLen];
+
+  bool flushCache() {
+    if (cacheAddr == noSector)
+      return true;
+
+    bool ok = erase(cacheAddr);
+    for (uint32_t p = 0; p < sectorLen && ok; p += pageLen)
+      ok = write(cacheAddr + p, cache + p, pageLen);
+    cacheAddr = noSector;
+    return ok;
+  }
+
+  bool cachedWrite(uint32_t addr, const uint8_t* buf, size_t len) {
+    while (len > 0) {
+      uint32_t sector = addr & ~(sectorLen - 1);
+      uint32_t offset = addr - sector;
+      size_t n = min(sectorLen - offset, len);
+
+      if (sector != cacheAddr) {
+        if (!flushCache() || !read(sector, cache, sectorLen))
+          return false;
+        cacheAddr = sector;
+      }
+      memcpy(cache + offset, buf, n);
+
+      addr += n;
+      buf += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  bool cachedRead(uint32_t addr, uint8_t* buf, size_t len) {
+    if (cacheAddr == noSector
+        || addr + len <= cacheAddr || addr >= cacheAddr + sectorLen)
+      return read(addr, buf, len);
+
+    // Before the cached sector, from it, and after it
+    size_t before = addr < cacheAddr ? cacheAddr - addr : 0;
+    size_t from = addr > cacheAddr ? addr - cacheAddr : 0;
+    size_t cached = min(sectorLen - from, len - before);
+    size_t after = len - before - cached;
+
+    if (before && !read(addr, buf, before))
+      return false;
+    memcpy(buf + before, cache + from, cached);
+    if (after && !read(addr + before + cached, buf + before + cached, after))
+      return false;
+    return true;
+  }
+}
+
+namespace FlashEmu {
+
+  Timing timing;
+  Stats stats;
+  void (*follow)(uint64_t ns) = NULL;
+
+  bool open(const std::string& path, uint32_t size) {
+    close();
+
+    fd = ::open(path.c_str(), O_RDWR | O_CREAT, 0644);
+    if (fd < 0) {
+      perror(path.c_str());
+      return false;
+    }
+
+    struct stat st;
+    bool fresh = fstat(fd, &st) == 0 && st.st_size == 0;
+    if (ftruncate(fd, size) != 0) {
+      perror(path.c_str());
+      close();
+      return false;
+    }
+
+    void* p = mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (p == MAP_FAILED) {
+      perror(path.c_str());
+      close();
+      return false;
+    }
+    image = static_cast<uint8_t*>(p);
+    imageSize = size;
+
+    if (fresh)
+      erase();
+    return true;
+  }
+
+  void close() {
+    cacheAddr = noSector;
+    if (image)
+      munmap(image, imageSize);
+    if (fd >= 0)
+      ::close(fd);
+    image = NULL;
+    imageSize = 0;
+    fd = -1;
+  }
+
+  void erase() {
+    cacheAddr = noSector;
+    if (image)
+      memset(image, 0xff, imageSize);
+  }
+
+  uint64_t now() { return simTime; }
+  void wait(uint64_t ns) { simTime += ns; }
+}
+
+
+bool Adafruit_SPIFlash::begin() { return image != NULL; }
+
+uint32_t Adafruit_SPIFlash::size() { return imageSize; }
+uint16_t Adafruit_SPIFlash::numPages() { return imageSize / pageLen; }
+
+uint32_t Adafruit_SPIFlash::readBuffer(
+    uint32_t addr, uint8_t* buffer, uint32_t len) {
+  return read(addr, buffer, len) ? len : 0;
+}
+
+uint32_t Adafruit_SPIFlash::writeBuffer(
+    uint32_t addr, const uint8_t* buffer, uint32_t len) {
+  return write(addr, buffer, len) ? len : 0;
+}
+
+bool Adafruit_SPIFlash::readBlock(uint32_t block, uint8_t* dst) {
+  return readBlocks(block, dst, 1);
+}
+
+bool Adafruit_SPIFlash::writeBlock(uint32_t block, const uint8_t* src) {
+  return writeBlocks(block, src, 1);
+}
+
+bool Adafruit_SPIFlash::syncBlocks() { return flushCache(); }
+
+bool Adafruit_SPIFlash::readBlocks(uint32_t block, uint8_t* dst, size_t nb) {
+  return cachedRead(block * blockLen, dst, nb * blockLen);
+}
+
+bool Adafruit_SPIFlash::writeBlocks(
+    uint32_t block, const uint8_t* src, size_t nb) {
+  return cachedWrite(block * blockLen, src, nb * blockLen);
+}
+
+
+SPIClass SPI;
+WatchdogType Watchdog;
+
+Adafruit_USBD_MSC::ReadCallback Adafruit_USBD_MSC::readCallback = NULL;
+Adafruit_USBD_MSC::WriteCallback Adafruit_USBD_MSC::writeCallback = NULL;
+Adafruit_USBD_MSC::FlushCallback Adafruit_USBD_MSC::flushCallback = NULL;
+uint32_t Adafruit_USBD_MSC::capacity = 0;
@@ -0,0 +1 @@
+// file_manager.cpp includes this, but uses none of it
@@ -0,0 +1,87 @@
+#ifndef _HOST_ADAFRUIT_SPIFLASH_H_
+#define _HOST_ADAFRUIT_SPIFLASH_H_
+
+// Adafruit_SPIFlash, emulated on the host with an image file in place of
+// the flash chip, so that file_manager.cpp, and SdFat under it, can be run
+// and measured on a computer. See ../flash_emu.cpp.
+//
+// Every instance is the same chip. Each call that would be one transaction
+// on the QSPI bus is counted as one, and takes simulated time: so much for
+// the transaction, and so much for each byte.
+//
+// Block writes go through a one sector cache, as in the library: the
+// sector is read in when a block in it is first written, and is erased and
+// programmed when a block in another sector is written, or on sync. Block
+// reads see what is in the cache; readBuffer() and writeBuffer() go
+// straight to the chip.
+
+#include <cstddef>
+#include <cstdint>
+#include <string>
+
+#include <SdFat.h>
+
+namespace FlashEmu {
+
+  struct Timing {
+    // Rough figures for a SAMD51's QSPI at 48MHz, including the driver's
+    // own time for each call
+    uint64_t transaction  = 2000;     // ns, command, address and dummy
+    uint64_t perByte      = 42;       // ns, quad data
+    uint64_t pageProgram  = 700000;   // ns, 256 bytes
+    uint64_t sectorErase  = 45000000; // ns, 4k
+  };
+
+  struct Stats {
+    uint64_t reads;         // transactions
+    uint64_t bytesRead;
+    uint64_t writes;        // pages programmed
+    uint64_t erases;        // sectors
+  };
+
+  bool open(const std::string& path, uint32_t size);
+    // the image file is created, or grown, to size
+  void close();
+  void erase();
+    // the whole chip, to 0xff, as a new board has it
+
+  extern Timing timing;
+  extern Stats stats;
+
+  uint64_t now();
+    // simulated time, in ns; it moves on only with flash transactions and
+    // delay(), so runs are repeatable
+  void wait(uint64_t ns);
+    // time passing off the chip, as in delay()
+
+  extern void (*follow)(uint64_t ns);
+    // if set, is also given the time each transaction takes, so that
+    // another simulation's clock can include it
+}
+
+
+class Adafruit_FlashTransport { };
+class Adafruit_FlashTransport_QSPI : public Adafruit_FlashTransport { };
+
+class Adafruit_SPIFlash : public BaseBlockDriver {
+public:
+  Adafruit_SPIFlash(Adafruit_FlashTransport* transport) { (void)transport; }
+
+  bool begin();
+
+  uint32_t size();
+  uint16_t numPages();
+  uint16_t pageSize() { return 256; }
+
+  uint32_t readBuffer(uint32_t addr, uint8_t* buffer, uint32_t len);
+  uint32_t writeBuffer(uint32_t addr, const uint8_t* buffer, uint32_t len);
+
+  // BaseBlockDriver, in 512 byte blocks, for SdFat
+  bool readBlock(uint32_t block, uint8_t* dst);
+  bool writeBlock(uint32_t block, const uint8_t* src);
+  bool syncBlocks();
+  bool readBlocks(uint32_t block, uint8_t* dst, size_t nb);
+  bool writeBlocks(uint32_t block, const uint8_t* src, size_t nb);
+};
+
+#endif // _HOST_ADAFRUIT_SPIFLASH_H_
@@ -0,0 +1,16 @@
+#ifndef _HOST_ADAFRUIT_SLEEPYDOG_H_
+#define _HOST_ADAFRUIT_SLEEPYDOG_H_
+
+// FileManager::setup() resets the board after formatting the drive. On the
+// host it carries on instead, with the drive formatted.
+
+class WatchdogType {
+public:
+  int enable(int ms = 0) { return ms; }
+  void disable() { }
+  void reset() { }
+};
+
+extern WatchdogType Watchdog;
+
+#endif // _HOST_ADAFRUIT_SLEEPYDOG_H_
@@ -0,0 +1,29 @@
+#ifndef _HOST_ADAFRUIT_TINYUSB_H_
+#define _HOST_ADAFRUIT_TINYUSB_H_
+
+// There is no USB host to present the drive to. The callbacks are kept, so
+// that msc_replay can call them as the host would have.
+
+#include <cstdint>
+
+class Adafruit_USBD_MSC {
+public:
+  typedef int32_t (*ReadCallback)(uint32_t lba, void* buffer, uint32_t len);
+  typedef int32_t (*WriteCallback)(uint32_t lba, uint8_t* buffer, uint32_t len);
+  typedef void (*FlushCallback)(void);
+
+  void setID(const char* vendor, const char* product, const char* rev) { }
+  void setReadWriteCallback(ReadCallback r, WriteCallback w, FlushCallback f)
+    { readCallback = r; writeCallback = w; flushCallback = f; }
+  void setCapacity(uint32_t blocks, uint16_t blockSize)
+    { capacity = blocks; }
+  void setUnitReady(bool) { }
+  bool begin() { return true; }
+
+  static ReadCallback readCallback;
+  static WriteCallback writeCallback;
+  static FlushCallback flushCallback;
+  static uint32_t capacity;   // blocks
+};
+
+#endif // _HOST_ADAFRUIT_TINYUSB_H_
@@ -0,0 +1,165 @@
+#ifndef _HOST_ARDUINO_H_
+#define _HOST_ARDUINO_H_
+
+// Just enough of Arduino.h to build file_manager.cpp and SdFat on the host,
+// against the emulated flash chip, and flash_manager.cpp, against the
+// simulated target. The time calls are in ../emu_clock.cpp; or, built with
+// the SWD simulator, in tools/swd-sim/sim_arduino.cpp, which has the pin
+// calls too. Build with ARDUINO defined, as SdFat checks for it before
+// including this.
+
+#include <cctype>
+#include <cstdarg>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+#define HIGH            1
+#define LOW             0
+#define INPUT           0
+#define OUTPUT          1
+#define INPUT_PULLUP    2
+#define INPUT_PULLDOWN  3
+
+#define DEC             10
+#define HEX             16
+
+#define PROGMEM
+#define pgm_read_byte(p)  (*(const uint8_t*)(p))
+class __FlashStringHelper;
+#define F(s)            (reinterpret_cast<const __FlashStringHelper*>(s))
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+void pinMode(uint32_t pin, uint32_t mode);
+void digitalWrite(uint32_t pin, uint32_t value);
+int digitalRead(uint32_t pin);
+
+unsigned long millis();
+unsigned long micros();
+void delay(unsigned long ms);
+void delayMicroseconds(unsigned int us);
+inline void yield() { }
+
+template<class A, class B> auto min(A a, B b) -> decltype(a + b)
+  { return a < b ? a : b; }
+template<class A, class B> auto max(A a, B b) -> decltype(a + b)
+  { return a > b ? a : b; }
+
+
+class String {
+public:
+  String(const char* s = "") : s(s) { }
+
+  const char* c_str() const { return s.c_str(); }
+  unsigned int length() const { return s.length(); }
+
+  void toLowerCase()
+    { for (auto& c : s) c = tolower((unsigned char)c); }
+  bool startsWith(const char* p) const
+    { return s.compare(0, strlen(p), p) == 0; }
+  bool endsWith(const char* p) const {
+    size_t n = strlen(p);
+    return s.size() >= n && s.compare(s.size() - n, n, p) == 0;
+  }
+
+private:
+  std::string s;
+};
+
+
+class Print {
+public:
+  virtual ~Print() { }
+
+  virtual size_t write(uint8_t) = 0;
+  virtual size_t write(const uint8_t* buf, size_t len) {
+    size_t n = 0;
+    while (len-- && write(*buf++)) ++n;
+    return n;
+  }
+  size_t write(const char* s) { return write((const uint8_t*)s, strlen(s)); }
+  virtual int availableForWrite() { return 0; }
+  virtual void flush() { }
+
+  size_t print(const char* s) { return write(s); }
+  size_t print(const __FlashStringHelper* s) { return print((const char*)s); }
+  size_t print(char c) { return write((uint8_t)c); }
+  size_t print(unsigned long n, int base = DEC) {
+    char buf[24];
+    snprintf(buf, sizeof(buf), base == HEX ? "%lx" : "%lu", n);
+    return write(buf);
+  }
+  size_t print(long n, int base = DEC) {
+    if (n < 0 && base == DEC)
+      return print('-') + print((unsigned long)-n);
+    return print((unsigned long)n, base);
+  }
+  size_t print(unsigned int n, int base = DEC)
+    { return print((unsigned long)n, base); }
+  size_t print(int n, int base = DEC) { return print((long)n, base); }
+  size_t print(uint8_t n, int base = DEC)
+    { return print((unsigned long)n, base); }
+
+  size_t println() { return write("\r\n"); }
+  template<class T> size_t println(T v) { return print(v) + println(); }
+  template<class T> size_t println(T v, int base)
+    { return print(v, base) + println(); }
+
+  size_t printf(const char* fmt, ...) {
+    char buf[256];
+    va_list args;
+    va_start(args, fmt);
+    vsnprintf(buf, sizeof(buf), fmt, args);
+    va_end(args);
+    return write(buf);
+  }
+};
+
+class Stream : public Print {
+public:
+  virtual int available() = 0;
+  virtual int read() = 0;
+  virtual int peek() = 0;
+
+  size_t readBytes(uint8_t* buf, size_t len) {
+    // only what has arrived: there is no timeout to wait out on the host
+    size_t n = 0;
+    int c;
+    while (n < len && (c = read()) >= 0)
+      buf[n++] = c;
+    return n;
+  }
+};
+
+class Serial_ : public Stream {
+  // The USB serial port: written to stdout, and nothing comes in, until
+  // port() gives it a file descriptor, such as a pty's, to be the port.
+  // Defined in tools/swd-sim/sim_arduino.cpp, for the builds that use it.
+public:
+  void begin(unsigned long) { }
+  void port(int fd) { this->fd = fd; }
+
+  size_t write(uint8_t c) { return write(&c, 1); }
+  size_t write(const uint8_t* buf, size_t len);
+  using Print::write;
+  int availableForWrite() { return 256; }
+
+  int available();
+  int read();
+  int peek();
+
+  operator bool() { return true; }
+
+private:
+  int fd = -1;
+  int peeked = -1;
+};
+
+extern Serial_ Serial;
+
+#endif // _HOST_ARDUINO_H_
@@ -0,0 +1,30 @@
+#ifndef _HOST_SPI_H_
+#define _HOST_SPI_H_
+
+// For SdFat's SD card drivers, which are built but not used: the flash is
+// reached through Adafruit_SPIFlash.
+
+#include <Arduino.h>
+
+#define SPI_MODE0   0
+#define MSBFIRST    1
+
+class SPISettings {
+public:
+  SPISettings() { }
+  SPISettings(uint32_t clock, uint8_t bitOrder, uint8_t dataMode) { }
+};
+
+class SPIClass {
+public:
+  void begin() { }
+  void end() { }
+  void beginTransaction(SPISettings) { }
+  void endTransaction() { }
+  uint8_t transfer(uint8_t) { return 0xff; }
+  void transfer(void* buf, size_t len) { memset(buf, 0xff, len); }
+};
+
+extern SPIClass SPI;
+
+#endif // _HOST_SPI_H_
@@ -0,0 +1,2 @@
+// Arduino.h has the delays, on the host
+#include <Arduino.h>
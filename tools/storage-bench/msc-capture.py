@@ -0,0 +1,87 @@
+#!/usr/bin/env python3
+"""Capture a trace of a host's accesses to a Multi-Flash programmer's drive.
+
+The programmer must be built with MF_MSC_TRACE. Start this, then copy files
+to the drive, eject it, or whatever is to be traced; stop with ^C.
+
+    tools/storage-bench/msc-capture.py /dev/ttyACM0 macos-copy.txt
+
+Each access the programmer reports is written to the trace file, in the
+form msc_replay reads. Other lines from the programmer are printed. Any
+accesses the programmer had to drop are noted in the trace, and counted.
+"""
+
+import argparse
+import os
+import select
+import sys
+import termios
+import tty
+
+
+class Port:
+    def __init__(self, path):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        if os.isatty(self.fd):
+            tty.setraw(self.fd)
+            termios.tcflush(self.fd, termios.TCIOFLUSH)
+        self.pending = b''
+
+    def lines(self):
+        while True:
+            while b'\n' not in self.pending:
+                select.select([self.fd], [], [])
+                data = os.read(self.fd, 4096)
+                if not data:
+                    return
+                self.pending += data
+            line, self.pending = self.pending.split(b'\n', 1)
+            yield line.rstrip(b'\r').decode('utf-8', 'replace')
+
+
+def capture(port, out):
+    expected = 0
+    count = 0
+    dropped = 0
+    try:
+        for line in port.lines():
+            if not line.startswith('msc: '):
+                print(line)
+                continue
+
+            words = line[5:].split()
+            if len(words) != 6:
+                print('bad trace line: %s' % line, file=sys.stderr)
+                continue
+            seq = int(words[0])
+            if seq > expected:
+                out.write('# %d dropped\n' % (seq - expected))
+                dropped += seq - expected
+            expected = seq + 1
+
+            out.write(' '.join(words[1:]) + '\n')
+            count += 1
+    except KeyboardInterrupt:
+        pass
+    return count, dropped
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Capture drive accesses from a Multi-Flash programmer.')
+    parser.add_argument('port', help='serial port, such as /dev/ttyACM0')
+    parser.add_argument('trace', help='file to write the trace to')
+    args = parser.parse_args()
+
+    port = Port(args.port)
+    with open(args.trace, 'w') as out:
+        out.write('# captured from %s\n' % args.port)
+        count, dropped = capture(port, out)
+
+    print('%d accesses captured, %d dropped' % (count, dropped),
+          file=sys.stderr)
+    return 1 if dropped else 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())
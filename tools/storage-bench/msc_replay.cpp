@@ -0,0 +1,206 @@
+// Replays a host's accesses to the drive, captured on the programmer with
+// MF_MSC_TRACE, through file_manager.cpp's USB callbacks, against the
+// emulated flash chip, and reports what they cost.
+//
+//    msc_replay [--image file] [--flash-mb n] [--txn-ns n] [--byte-ns n]
+//               trace.txt
+//
+// A trace is a text file, with one access a line:
+//
+//    <time µs> <r|w|f> <lba> <blocks> <duration µs>
+//
+// as msc-capture.py writes them. Blank lines, and anything after a #, are
+// ignored. Time and duration are as they were on the programmer: only the
+// order of the accesses, and where they were, are replayed. The trace
+// doesn't have the data written, so a pattern is written instead; what the
+// flash chip does doesn't depend on it.
+//
+// The drive is the image file, formatted first if it has no file system.
+// Its contents are spoilt by the replay.
+
+#include <Adafruit_SPIFlash.h>
+#include <Adafruit_TinyUSB.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <string>
+#include <vector>
+
+#include "file_manager.h"
+#include "interface.h"
+
+
+namespace {
+
+  struct Access {
+    uint64_t at;        // µs, on the programmer
+    char op;
+    uint32_t lba;
+    uint32_t blocks;
+    uint64_t duration;  // µs, on the programmer
+  };
+
+  struct OpStats {
+    uint64_t count;
+    uint64_t blocks;
+    uint64_t time;        // ns, emulated
+    uint64_t worst;
+    uint64_t deviceTime;  // µs, as traced
+    uint64_t errors;
+  };
+
+  class ReplayInterface : public InterfaceBase {
+  public:
+    void errorMsg(const char* msg) { fprintf(stderr, "error: %s\n", msg); }
+  };
+
+  ReplayInterface intf;
+
+
+  bool load(const std::string& path, std::vector<Access>& trace) {
+    std::ifstream f(path);
+    if (!f) {
+      fprintf(stderr, "%s: can't read\n", path.c_str());
+      return false;
+    }
+
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(f, line)) {
+      lineNo += 1;
+      auto hash = line.find('#');
+      if (hash != std::string::npos)
+        line.erase(hash);
+      if (line.find_first_not_of(" \t\r") == std::string::npos)
+        continue;
+
+      Access a;
+      unsigned long long at, duration;
+      unsigned long lba, blocks;
+      char op;
+      if (sscanf(line.c_str(), "%llu %c %lu %lu %llu",
+            &at, &op, &lba, &blocks, &duration) != 5
+          || (op != 'r' && op != 'w' && op != 'f')) {
+        fprintf(stderr, "%s:%d: bad access\n", path.c_str(), lineNo);
+        return false;
+      }
+      a.at = at;
+      a.op = op;
+      a.lba = lba;
+      a.blocks = blocks;
+      a.duration = duration;
+      trace.push_back(a);
+    }
+    return true;
+  }
+
+  void replay(const Access& a, OpStats& s) {
+    static std::vector<uint8_t> buf;
+    buf.resize(a.blocks * 512);
+    for (size_t i = 0; i < buf.size(); ++i)
+      buf[i] = uint8_t(a.lba + i / 512 + i);
+
+    auto startAt = FlashEmu::now();
+    bool ok = true;
+    if (a.lba + a.blocks > Adafruit_USBD_MSC::capacity) {
+      ok = false;
+    } else if (a.op == 'r') {
+      ok = Adafruit_USBD_MSC::readCallback(a.lba, buf.data(), buf.size()) >= 0;
+    } else if (a.op == 'w') {
+      ok = Adafruit_USBD_MSC::writeCallback(a.lba, buf.data(), buf.size()) >= 0;
+    } else {
+      Adafruit_USBD_MSC::flushCallback();
+    }
+    auto time = FlashEmu::now() - startAt;
+
+    s.count += 1;
+    s.blocks += a.blocks;
+    s.time += time;
+    s.worst = max(s.worst, time);
+    s.deviceTime += a.duration;
+    if (!ok)
+      s.errors += 1;
+  }
+
+  void row(const char* name, const OpStats& s, bool transfers) {
+    double secs = s.time / 1e9;
+    char rate[16] = "-";
+    if (transfers && secs > 0)
+      snprintf(rate, sizeof(rate), "%.2f", s.blocks * 512 / secs / (1024 * 1024));
+
+    printf("%-6s %8llu %8llu %8s %10.2f %10.3f %10.1f %10.1f",
+      name, (unsigned long long)s.count, (unsigned long long)s.blocks, rate,
+      s.worst / 1e6, s.count ? s.time / 1e6 / s.count : 0.0,
+      s.time / 1e6, s.deviceTime / 1e3);
+    if (s.errors)
+      printf("  %llu failed", (unsigned long long)s.errors);
+    printf("\n");
+  }
+
+  void usage() {
+    fprintf(stderr,
+      "usage: msc_replay [--image file] [--flash-mb n] [--txn-ns n]"
+      " [--byte-ns n] trace.txt\n");
+  }
+}
+
+int main(int argc, char** argv) {
+  std::string tracePath, imagePath = "msc-replay.img";
+  uint32_t flashMb = 2;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--image" && i + 1 < argc)          imagePath = argv[++i];
+    else if (arg == "--flash-mb" && i + 1 < argc)  flashMb = atoi(argv[++i]);
+    else if (arg == "--txn-ns" && i + 1 < argc)
+      FlashEmu::timing.transaction = atoi(argv[++i]);
+    else if (arg == "--byte-ns" && i + 1 < argc)
+      FlashEmu::timing.perByte = atoi(argv[++i]);
+    else if (arg[0] != '-' && tracePath.empty())   tracePath = arg;
+    else { usage(); return 2; }
+  }
+  if (tracePath.empty()) {
+    usage();
+    return 2;
+  }
+  if (flashMb < 1 || flashMb > 8) {
+    fprintf(stderr, "--flash-mb must be 1 to 8\n");
+    return 2;
+  }
+
+  std::vector<Access> trace;
+  if (!load(tracePath, trace))
+    return 2;
+
+  if (!FlashEmu::open(imagePath, flashMb * 1024 * 1024)
+      || !FileManager::setup(intf) || !FileManager::startUSB(intf))
+    return 2;
+
+  OpStats reads, writes, flushes;
+  memset(&reads, 0, sizeof(reads));
+  writes = flushes = reads;
+  FlashEmu::stats = FlashEmu::Stats();
+
+  for (auto& a : trace)
+    replay(a, a.op == 'r' ? reads : a.op == 'w' ? writes : flushes);
+
+  auto& f = FlashEmu::stats;
+  double span = trace.empty() ? 0 : (trace.back().at - trace.front().at) / 1e6;
+  printf("trace: %zu accesses, over %.1fs on the programmer\n",
+    trace.size(), span);
+  printf("%-6s %8s %8s %8s %10s %10s %10s %10s\n",
+    "", "count", "blocks", "MB/s", "worst ms", "mean ms", "total ms",
+    "traced ms");
+  row("read", reads, true);
+  row("write", writes, true);
+  row("flush", flushes, false);
+  printf("flash: %llu sectors erased, %llu pages programmed, "
+    "%llu read transactions\n",
+    (unsigned long long)f.erases, (unsigned long long)f.writes,
+    (unsigned long long)f.reads);
+
+  FlashEmu::close();
+  return reads.errors + writes.errors ? 1 : 0;
+}
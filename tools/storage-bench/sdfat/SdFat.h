@@ -0,0 +1,85 @@
+#ifndef _HOST_SDFAT_H_
+#define _HOST_SDFAT_H_
+
+// A stand-in for Adafruit's SdFat fork: the part of its API that the
+// programmer, and the tools that run it on a computer, use, implemented over
+// elm-chan's FatFs from the top of this tree, in sdfat_host.cpp.
+//
+// Drives it writes are ordinary FAT drives, and it reads the ones the
+// programmer formats. It follows elm-chan's configuration, in
+// elm-chan/ffconf.h, so there are no long file names: a name that doesn't
+// fit 8.3 can't be opened or created; except that creating one starting
+// with a dot, as the programmer does for macOS when it formats the drive,
+// succeeds without making anything. createContiguous() only succeeds if
+// the clusters it is given happen to be contiguous, which on a drive that
+// hasn't been fragmented they are.
+
+#include <Arduino.h>
+
+#define O_RDONLY      0x00
+#define O_WRONLY      0x01
+#define O_RDWR        0x02
+#define O_CREAT       0x40
+#define O_TRUNC       0x200
+#define FILE_READ     O_RDONLY
+#define FILE_WRITE    (O_RDWR | O_CREAT)
+
+class BaseBlockDriver {
+public:
+  virtual bool readBlock(uint32_t block, uint8_t* dst) = 0;
+  virtual bool syncBlocks() = 0;
+  virtual bool writeBlock(uint32_t block, const uint8_t* src) = 0;
+  virtual bool readBlocks(uint32_t block, uint8_t* dst, size_t nb) = 0;
+  virtual bool writeBlocks(uint32_t block, const uint8_t* src, size_t nb) = 0;
+};
+
+struct FatFileState;    // elm-chan's objects, kept out of this header
+
+class FatFile {
+public:
+  FatFile();
+  FatFile(const FatFile&);
+  FatFile& operator=(const FatFile&);
+  ~FatFile();
+
+  bool open(const char* path, int oflag = O_RDONLY);
+  bool open(FatFile* dir, const char* path, int oflag = O_RDONLY);
+  bool openNext(FatFile* dir, int oflag = O_RDONLY);
+  bool close();
+  bool remove();
+  bool createContiguous(FatFile* dir, const char* path, uint32_t size);
+
+  bool isOpen() const;
+  bool isDir() const;
+  bool isFile() const;
+  bool isHidden() const;
+  size_t getName(char* name, size_t size);
+  uint32_t fileSize() const;
+  uint8_t getError();
+  bool contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock);
+
+  int read(void* buf, size_t count);
+  int write(const void* buf, size_t count);
+  int fgets(char* str, int num, char* delim = 0);
+  bool seekSet(uint32_t pos);
+  uint32_t curPosition() const;
+  void rewind();
+  bool sync();
+
+private:
+  bool openPath(const char* path, int oflag);
+
+  FatFileState* s;
+};
+
+class FatFileSystem {
+public:
+  bool begin(BaseBlockDriver* driver);
+  FatFile* vwd();
+  bool mkdir(const char* path);
+  bool remove(const char* path);
+  uint8_t blocksPerCluster();
+  void cacheClear() { }   // elm-chan's cache is in each file
+};
+
+#endif // _HOST_SDFAT_H_
@@ -0,0 +1,369 @@
+// The SdFat stand-in, over elm-chan's FatFs: see SdFat.h.
+//
+// file_manager.cpp includes elm-chan/ff.c too, for formatting, and its
+// functions, and the disk_ functions it calls, are extern "C"; so in this
+// copy they are all renamed.
+
+#include <SdFat.h>
+
+#include <cstring>
+#include <string>
+
+#define disk_status       sdfat_disk_status
+#define disk_initialize   sdfat_disk_initialize
+#define disk_read         sdfat_disk_read
+#define disk_write        sdfat_disk_write
+#define disk_ioctl        sdfat_disk_ioctl
+
+#define f_chdir           sdfat_f_chdir
+#define f_chdrive         sdfat_f_chdrive
+#define f_chmod           sdfat_f_chmod
+#define f_close           sdfat_f_close
+#define f_closedir        sdfat_f_closedir
+#define f_expand          sdfat_f_expand
+#define f_fdisk           sdfat_f_fdisk
+#define f_findfirst       sdfat_f_findfirst
+#define f_findnext        sdfat_f_findnext
+#define f_forward         sdfat_f_forward
+#define f_getcwd          sdfat_f_getcwd
+#define f_getfree         sdfat_f_getfree
+#define f_getlabel        sdfat_f_getlabel
+#define f_gets            sdfat_f_gets
+#define f_lseek           sdfat_f_lseek
+#define f_mkdir           sdfat_f_mkdir
+#define f_mkfs            sdfat_f_mkfs
+#define f_mount           sdfat_f_mount
+#define f_open            sdfat_f_open
+#define f_opendir         sdfat_f_opendir
+#define f_printf          sdfat_f_printf
+#define f_putc            sdfat_f_putc
+#define f_puts            sdfat_f_puts
+#define f_read            sdfat_f_read
+#define f_readdir         sdfat_f_readdir
+#define f_rename          sdfat_f_rename
+#define f_setcp           sdfat_f_setcp
+#define f_setlabel        sdfat_f_setlabel
+#define f_stat            sdfat_f_stat
+#define f_sync            sdfat_f_sync
+#define f_truncate        sdfat_f_truncate
+#define f_unlink          sdfat_f_unlink
+#define f_utime           sdfat_f_utime
+#define f_write           sdfat_f_write
+  // f_size, f_tell, f_rewind and the like are macros, over these
+
+namespace sdfat_elm_chan {
+  #include "elm-chan/ff.c"
+}
+
+using namespace sdfat_elm_chan;
+
+
+namespace {
+
+  BaseBlockDriver* driver = NULL;
+  FATFS fatfs;
+  FatFile root;
+
+  std::string fatPath(const char* path) {
+    // elm-chan's paths don't start with /
+    return path[0] == '/' ? path + 1 : path;
+  }
+
+  bool markerName(const std::string& path, FRESULT r) {
+    // the files the programmer makes for macOS, which 8.3 can't hold
+    return (r == FR_INVALID_NAME || r == FR_NO_PATH)
+      && (path[0] == '.' || path.find("/.") != std::string::npos);
+  }
+}
+
+namespace sdfat_elm_chan {
+  extern "C" {
+
+    DSTATUS disk_status(BYTE) {
+      return driver ? 0 : STA_NOINIT;
+    }
+
+    DSTATUS disk_initialize(BYTE) {
+      return driver ? 0 : STA_NOINIT;
+    }
+
+    DRESULT disk_read(BYTE, BYTE* buff, DWORD sector, UINT count) {
+      return driver->readBlocks(sector, buff, count) ? RES_OK : RES_ERROR;
+    }
+
+    DRESULT disk_write(BYTE, const BYTE* buff, DWORD sector, UINT count) {
+      return driver->writeBlocks(sector, buff, count) ? RES_OK : RES_ERROR;
+    }
+
+    DRESULT disk_ioctl(BYTE, BYTE cmd, void*) {
+      if (cmd == CTRL_SYNC)
+        return driver->syncBlocks() ? RES_OK : RES_ERROR;
+      return RES_PARERR;
+    }
+  }
+}
+
+
+struct FatFileState {
+  bool open = false;
+  bool dir = false;
+  bool error = false;
+  BYTE attr = 0;
+  std::string path;     // without the leading /; empty for the root
+  FIL fil;
+  DIR d;
+};
+
+FatFile::FatFile() : s(new FatFileState) { }
+FatFile::FatFile(const FatFile& other) : s(new FatFileState(*other.s)) { }
+FatFile& FatFile::operator=(const FatFile& other) {
+  *s = *other.s;
+  return *this;
+}
+FatFile::~FatFile() {
+  close();
+  delete s;
+}
+
+bool FatFile::openPath(const char* path, int oflag) {
+  close();
+  s->error = false;
+  auto p = fatPath(path);
+
+  FILINFO info;
+  bool exists = p.empty() || f_stat(p.c_str(), &info) == FR_OK;
+  if (exists && (p.empty() || (info.fattrib & AM_DIR))) {
+    if (f_opendir(&s->d, p.c_str()) != FR_OK)
+      return false;
+    s->open = s->dir = true;
+    s->attr = AM_DIR;
+    s->path = p;
+    return true;
+  }
+
+  BYTE mode = FA_READ;
+  if (oflag & (O_WRONLY | O_RDWR))
+    mode |= FA_WRITE;
+  if (oflag & O_TRUNC)
+    mode |= FA_CREATE_ALWAYS;
+  else if (oflag & O_CREAT)
+    mode |= FA_OPEN_ALWAYS;
+  auto r = f_open(&s->fil, p.c_str(), mode);
+  if ((oflag & O_CREAT) && markerName(p, r))
+    return true;    // made, as far as the caller can tell, but not open
+  if (r != FR_OK)
+    return false;
+  s->open = true;
+  s->dir = false;
+  s->attr = exists ? info.fattrib : 0;
+  s->path = p;
+  return true;
+}
+
+bool FatFile::open(const char* path, int oflag) {
+  return openPath(path, oflag);
+}
+
+bool FatFile::open(FatFile* dir, const char* path, int oflag) {
+  if (path[0] == '/' || !dir || dir->s->path.empty())
+    return openPath(path, oflag);
+  return openPath((dir->s->path + "/" + path).c_str(), oflag);
+}
+
+bool FatFile::openNext(FatFile* dir, int oflag) {
+  // As SdFat does, the entry just read is opened where it is, as f_open()
+  // and f_opendir() would once they had found it: opening it by name would
+  // search the directory from the start again, for each entry.
+  DIR& d = dir->s->d;
+  FILINFO info;
+  if (DIR_READ_FILE(&d) != FR_OK)
+    return false;     // the end of the directory, or an error
+  get_fileinfo(&d, &info);
+
+  close();
+  s->error = false;
+  DWORD first = ld_clust(&fatfs, d.dir);
+  if (info.fattrib & AM_DIR) {
+    s->d.obj.fs = &fatfs;
+    s->d.obj.id = fatfs.id;
+    s->d.obj.sclust = first;
+    if (dir_sdi(&s->d, 0) != FR_OK)
+      return false;
+    s->dir = true;
+  } else {
+    FIL& f = s->fil;
+    f.obj.fs = &fatfs;
+    f.obj.id = fatfs.id;
+    f.obj.sclust = first;
+    f.obj.objsize = ld_dword(d.dir + DIR_FileSize);
+    f.flag = (oflag & (O_WRONLY | O_RDWR)) ? FA_READ | FA_WRITE : FA_READ;
+    f.err = 0;
+    f.sect = 0;
+    f.fptr = 0;
+    f.dir_sect = fatfs.winsect;
+    f.dir_ptr = d.dir;
+    memset(f.buf, 0, sizeof f.buf);
+    s->dir = false;
+  }
+  s->open = true;
+  s->attr = info.fattrib;
+  s->path = dir->s->path.empty() ? std::string(info.fname)
+    : dir->s->path + "/" + info.fname;
+
+  auto r = dir_next(&d, 0);
+  return r == FR_OK || r == FR_NO_FILE;
+}
+
+bool FatFile::close() {
+  if (!s->open)
+    return true;
+  s->open = false;
+  return (s->dir ? f_closedir(&s->d) : f_close(&s->fil)) == FR_OK;
+}
+
+bool FatFile::remove() {
+  auto p = s->path;
+  close();
+  return f_unlink(p.c_str()) == FR_OK;
+}
+
+bool FatFile::createContiguous(FatFile* dir, const char* path, uint32_t size) {
+  if (!open(dir, path, O_RDWR | O_CREAT | O_TRUNC))
+    return false;
+
+  // Seeking past the end, when writing, allocates the clusters
+  uint32_t bgn, end;
+  if (f_lseek(&s->fil, size) != FR_OK || f_tell(&s->fil) != size
+      || f_lseek(&s->fil, 0) != FR_OK || f_sync(&s->fil) != FR_OK
+      || !contiguousRange(&bgn, &end)) {
+    remove();
+    return false;
+  }
+  return true;
+}
+
+bool FatFile::isOpen() const    { return s->open; }
+bool FatFile::isDir() const     { return s->open && s->dir; }
+bool FatFile::isFile() const    { return s->open && !s->dir; }
+bool FatFile::isHidden() const  { return s->attr & AM_HID; }
+
+size_t FatFile::getName(char* name, size_t size) {
+  auto slash = s->path.rfind('/');
+  auto base = s->path.substr(slash == std::string::npos ? 0 : slash + 1);
+  if (base.size() + 1 > size)
+    return 0;
+  strcpy(name, base.c_str());
+  return base.size();
+}
+
+uint32_t FatFile::fileSize() const {
+  return isFile() ? f_size(&s->fil) : 0;
+}
+
+uint8_t FatFile::getError() {
+  return s->error ? 1 : 0;
+}
+
+bool FatFile::contiguousRange(uint32_t* bgnBlock, uint32_t* endBlock) {
+  if (!isFile())
+    return false;
+  DWORD first = s->fil.obj.sclust;
+  if (first == 0)
+    return false;     // no clusters yet
+
+  DWORD clusters = 1;
+  for (DWORD c = first; ; ++clusters, ++c) {
+    DWORD next = get_fat(&s->fil.obj, c);
+    if (next < 2 || next >= fatfs.n_fatent)
+      break;          // the end of the chain
+    if (next != c + 1)
+      return false;
+  }
+  *bgnBlock = clst2sect(&fatfs, first);
+  *endBlock = *bgnBlock + clusters * fatfs.csize - 1;
+  return true;
+}
+
+int FatFile::read(void* buf, size_t count) {
+  UINT done;
+  if (!isFile() || f_read(&s->fil, buf, count, &done) != FR_OK) {
+    s->error = true;
+    return -1;
+  }
+  return done;
+}
+
+int FatFile::write(const void* buf, size_t count) {
+  UINT done;
+  if (!isFile() || f_write(&s->fil, buf, count, &done) != FR_OK) {
+    s->error = true;
+    return -1;
+  }
+  return done;
+}
+
+int FatFile::fgets(char* str, int num, char* delim) {
+  // as SdFat's: the line, with its delimiter, if it fits
+  int n = 0;
+  while (n < num - 1) {
+    char c;
+    int r = read(&c, 1);
+    if (r < 0)
+      return -1;
+    if (r == 0)
+      break;
+    str[n++] = c;
+    if (delim ? strchr(delim, c) != NULL : c == '\n')
+      break;
+  }
+  str[n] = '\0';
+  return n;
+}
+
+bool FatFile::seekSet(uint32_t pos) {
+  return isFile() && f_lseek(&s->fil, pos) == FR_OK;
+}
+
+uint32_t FatFile::curPosition() const {
+  return isFile() ? f_tell(&s->fil) : 0;
+}
+
+void FatFile::rewind() {
+  if (isDir())
+    f_rewinddir(&s->d);
+  else if (isFile())
+    f_rewind(&s->fil);
+}
+
+bool FatFile::sync() {
+  return isFile() && f_sync(&s->fil) == FR_OK;
+}
+
+
+bool FatFileSystem::begin(BaseBlockDriver* blockDriver) {
+  root.close();
+  f_unmount("");
+  driver = blockDriver;
+  return f_mount(&fatfs, "", 1) == FR_OK && root.open("/");
+}
+
+FatFile* FatFileSystem::vwd() {
+  return &root;
+}
+
+bool FatFileSystem::mkdir(const char* path) {
+  FILINFO info;
+  auto p = fatPath(path);
+  if (f_stat(p.c_str(), &info) == FR_OK)
+    return info.fattrib & AM_DIR;
+  auto r = f_mkdir(p.c_str());
+  return r == FR_OK || markerName(p, r);
+}
+
+bool FatFileSystem::remove(const char* path) {
+  return f_unlink(fatPath(path).c_str()) == FR_OK;
+}
+
+uint8_t FatFileSystem::blocksPerCluster() {
+  return fatfs.csize;
+}
@@ -0,0 +1,380 @@
+// Measures how the programmer reads its binaries off the drive: the scan of
+// the drive by FilesToFlash::scan(), and FilesToFlash::readNextBlock() as
+// Flasher calls it, run from file_manager.cpp itself, over SdFat, against
+// an emulated flash chip.
+//
+//    storage_bench [--sweep name] [--image file] [--flash-mb n]
+//                  [--txn-ns n] [--byte-ns n]
+//
+// Each point of a sweep starts from a freshly formatted drive, which holds
+// a directory, unit/, with boot.bin, app.bin and other, empty, files in it.
+// The sweeps, each changing one thing from the baseline, are:
+//
+//    block   the block size readNextBlock() is called with
+//    frag    the clusters in each fragment of the binaries, written
+//            interleaved with another file that is then deleted
+//    dir     the number of entries in unit/, from 10 to 10,000
+//    split   where the image is split between boot.bin and app.bin, each
+//            read at several block sizes, with contiguous and fragmented
+//            binaries
+//
+// For each, the read of the whole image is given in MB/s, flash
+// transactions, and the longest a single block took; and the scan in ms and
+// transactions. Times are those of the flash chip, from FlashEmu::timing,
+// not of the computer running this.
+//
+// Every block read is checked against what was written, and must be whole,
+// as Flasher pads a short block: the exit status is 1 if any are wrong.
+
+#include <Adafruit_SPIFlash.h>
+#include <SdFat.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include "crc32.h"
+#include "file_manager.h"
+#include "interface.h"
+
+
+namespace {
+
+  struct Layout {
+    size_t bootSize   = 8 * 1024;
+    size_t appSize    = 120 * 1024;
+    uint32_t fragment = 0;      // clusters in each fragment; 0: contiguous
+    int entries       = 10;     // in unit/, the binaries included
+  };
+
+  struct Result {
+    char problem[80];     // empty if all was read as written
+
+    double scanMs;
+    uint64_t scanReads;
+
+    double mbPerSec;
+    uint64_t reads;
+    double worstUs;
+  };
+
+  const size_t baselineBlock = 256;
+  const char* profileDir = "unit";
+
+
+  class BenchInterface : public InterfaceBase {
+  public:
+    void errorMsg(const char* msg) {
+      errors += 1;
+      fprintf(stderr, "error: %s\n", msg);
+    }
+
+    int errors = 0;
+  };
+
+  BenchInterface intf;
+  FilesToFlash files;
+
+  Adafruit_FlashTransport_QSPI benchTransport;
+  Adafruit_SPIFlash benchFlash(&benchTransport);
+  FatFileSystem benchFs;
+    // to build the drive; file_manager.cpp has its own, on the same chip
+
+
+  uint8_t pattern(size_t at) {
+    // the byte at each offset into the image, so that misplaced data shows
+    return (uint32_t(at) * 2654435761u) >> 24;
+  }
+
+  bool writeData(FatFile& file, size_t& at, size_t end, size_t len) {
+    uint8_t buf[512];
+    while (len > 0 && at < end) {
+      size_t n = min(min(sizeof(buf), len), end - at);
+      for (size_t k = 0; k < n; ++k)
+        buf[k] = pattern(at + k);
+      if (size_t(file.write(buf, n)) != n)
+        return false;
+      at += n;
+      len -= n;
+    }
+    return true;
+  }
+
+  bool writeGap(FatFile& gap, size_t len) {
+    uint8_t buf[512];
+    memset(buf, 0, sizeof(buf));
+    while (len > 0) {
+      size_t n = min(len, sizeof(buf));
+      if (size_t(gap.write(buf, n)) != n)
+        return false;
+      len -= n;
+    }
+    return true;
+  }
+
+  bool writeBinary(const char* name, size_t from, size_t to,
+      uint32_t fragment, FatFile& gap) {
+    char path[32];
+    snprintf(path, sizeof(path), "%s/%s", profileDir, name);
+
+    FatFile file;
+    if (!file.open(benchFs.vwd(), path, O_RDWR | O_CREAT | O_TRUNC))
+      return false;
+
+    size_t cluster = benchFs.blocksPerCluster() * 512;
+    size_t run = fragment ? fragment * cluster : to - from;
+    size_t at = from;
+    while (at < to) {
+      if (!writeData(file, at, to, run))
+        return false;
+      // The next cluster of the file is only allocated when it is written,
+      // so one for the gap file comes between
+      if (fragment && at < to && !writeGap(gap, cluster))
+        return false;
+    }
+    return file.close();
+  }
+
+  bool buildDrive(const Layout& layout) {
+    FlashEmu::erase();
+    if (!FileManager::setup(intf))     // which formats it
+      return false;
+
+    if (!benchFs.begin(&benchFlash) || !benchFs.mkdir(profileDir))
+      return false;
+
+    // The other files come first, so the scan has to go past them all
+    char path[32];
+    for (int i = 2; i < layout.entries; ++i) {
+      snprintf(path, sizeof(path), "%s/f%05d.txt", profileDir, i);
+      FatFile file;
+      if (!file.open(benchFs.vwd(), path, O_RDWR | O_CREAT) || !file.close())
+        return false;
+    }
+
+    FatFile gap;
+    if (layout.fragment
+        && !gap.open(benchFs.vwd(), "gap.tmp", O_RDWR | O_CREAT | O_TRUNC))
+      return false;
+
+    auto total = layout.bootSize + layout.appSize;
+    bool ok = writeBinary("boot.bin", 0, layout.bootSize, layout.fragment, gap)
+      && writeBinary("app.bin", layout.bootSize, total, layout.fragment, gap);
+    if (layout.fragment)
+      ok = gap.remove() && ok;
+    benchFlash.syncBlocks();
+
+    return ok && FileManager::setup(intf);    // mounted afresh, as at boot
+  }
+
+  void fail(Result& r, const char* fmt, size_t n = 0) {
+    if (!r.problem[0])
+      snprintf(r.problem, sizeof(r.problem), fmt, n);
+  }
+
+  void scan(const Layout& layout, Result& r) {
+    auto reads = FlashEmu::stats.reads;
+    auto startAt = FlashEmu::now();
+    intf.errors = 0;
+    files.scan(intf);
+    r.scanMs = (FlashEmu::now() - startAt) / 1e6;
+    r.scanReads = FlashEmu::stats.reads - reads;
+
+    auto total = layout.bootSize + layout.appSize;
+    uint32_t crc = 0;
+    for (size_t at = 0; at < total; ++at) {
+      uint8_t b = pattern(at);
+      crc = crc32(&b, 1, crc);
+    }
+
+    if (!files.okayToFlash())           fail(r, "binaries not found");
+    else if (files.imageSize() != total) fail(r, "size is %zu", files.imageSize());
+    else if (files.imageCrc() != crc)   fail(r, "CRC is wrong");
+    else if (intf.errors)               fail(r, "%zu errors", intf.errors);
+  }
+
+  void read(const Layout& layout, size_t blockSize, Result& r) {
+    auto total = layout.bootSize + layout.appSize;
+    auto reads = FlashEmu::stats.reads;
+    auto startAt = FlashEmu::now();
+    uint64_t worst = 0;
+
+    std::vector<uint8_t> buf(blockSize);
+    size_t at = 0;
+    files.rewind();
+    for (;;) {
+      auto blockAt = FlashEmu::now();
+      int n = files.readNextBlock(buf.data(), blockSize);
+      worst = max(worst, FlashEmu::now() - blockAt);
+      if (n < 0) {
+        fail(r, "read error at %zu", at);
+        break;
+      }
+      if (n == 0)
+        break;
+
+      if (size_t(n) != min(blockSize, total - at)) {
+        fail(r, "short block at %zu", at);
+        break;
+      }
+      for (int k = 0; k < n; ++k)
+        if (buf[k] != pattern(at + k)) {
+          fail(r, "wrong data at %zu", at + k);
+          break;
+        }
+      at += n;
+    }
+    if (at != total)
+      fail(r, "read %zu bytes", at);
+
+    auto secs = (FlashEmu::now() - startAt) / 1e9;
+    r.mbPerSec = secs > 0 ? total / secs / (1024 * 1024) : 0;
+    r.reads = FlashEmu::stats.reads - reads;
+    r.worstUs = worst / 1e3;
+  }
+
+  Result run(const Layout& layout, size_t blockSize,
+      std::initializer_list<size_t> alsoCheck = {}) {
+    Result r;
+    memset(&r, 0, sizeof(r));
+    if (!buildDrive(layout)) {
+      fail(r, "couldn't build the drive");
+      return r;
+    }
+    scan(layout, r);
+    if (r.problem[0])
+      return r;
+
+    for (auto size : alsoCheck) {
+      Result check = r;
+      read(layout, size, check);
+      if (check.problem[0]) {
+        snprintf(r.problem, sizeof(r.problem), "%zu byte blocks: %s",
+          size, check.problem);
+        return r;
+      }
+    }
+    read(layout, blockSize, r);
+    return r;
+  }
+
+
+  int failures = 0;
+
+  void heading(const char* title, const char* what) {
+    printf("\n%s\n%-16s %8s %8s %10s %9s %10s  %s\n", title,
+      what, "MB/s", "reads", "worst us", "scan ms", "scan reads", "check");
+  }
+
+  void row(const char* label, const Result& r) {
+    printf("%-16s %8.2f %8llu %10.1f %9.1f %10llu  %s\n", label,
+      r.mbPerSec, (unsigned long long)r.reads, r.worstUs,
+      r.scanMs, (unsigned long long)r.scanReads,
+      r.problem[0] ? r.problem : "ok");
+    if (r.problem[0])
+      failures += 1;
+  }
+
+  void sweepBlock() {
+    heading("Block size", "bytes");
+    for (size_t size : { 64, 128, 256, 512, 1024, 4096 }) {
+      char label[16];
+      snprintf(label, sizeof(label), "%zu", size);
+      row(label, run(Layout(), size));
+    }
+  }
+
+  void sweepFrag() {
+    heading("Fragmentation", "clusters/frag");
+    for (uint32_t fragment : { 0, 64, 16, 4, 1 }) {
+      Layout layout;
+      layout.fragment = fragment;
+      char label[16];
+      snprintf(label, sizeof(label), "%u", fragment);
+      row(fragment ? label : "contiguous", run(layout, baselineBlock));
+    }
+  }
+
+  void sweepDir() {
+    heading("Directory size", "entries");
+    for (int entries : { 10, 100, 1000, 10000 }) {
+      Layout layout;
+      layout.entries = entries;
+      char label[16];
+      snprintf(label, sizeof(label), "%d", entries);
+      row(label, run(layout, baselineBlock));
+    }
+  }
+
+  void sweepSplit() {
+    heading("Boot/app split", "boot bytes");
+    Layout baseline;
+    auto total = baseline.bootSize + baseline.appSize;
+    for (uint32_t fragment : { 0, 1 }) {
+      for (size_t boot : { size_t(0), size_t(1), size_t(63), size_t(64),
+          size_t(65), size_t(255), size_t(256), size_t(257), size_t(511),
+          size_t(512), size_t(513), size_t(8192), size_t(8193),
+          total - 1 }) {
+        Layout layout;
+        layout.bootSize = boot;
+        layout.appSize = total - boot;
+        layout.fragment = fragment;
+        char label[24];
+        snprintf(label, sizeof(label), "%zu%s", boot, fragment ? " frag" : "");
+        row(label, run(layout, baselineBlock, { 64, 1000, 4096 }));
+      }
+    }
+  }
+
+  void usage() {
+    fprintf(stderr,
+      "usage: storage_bench [--sweep block|frag|dir|split] [--image file]"
+      " [--flash-mb n] [--txn-ns n] [--byte-ns n]\n");
+  }
+}
+
+int main(int argc, char** argv) {
+  std::string sweep, imagePath = "storage-bench.img";
+  uint32_t flashMb = 2;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--sweep" && i + 1 < argc)          sweep = argv[++i];
+    else if (arg == "--image" && i + 1 < argc)     imagePath = argv[++i];
+    else if (arg == "--flash-mb" && i + 1 < argc)  flashMb = atoi(argv[++i]);
+    else if (arg == "--txn-ns" && i + 1 < argc)
+      FlashEmu::timing.transaction = atoi(argv[++i]);
+    else if (arg == "--byte-ns" && i + 1 < argc)
+      FlashEmu::timing.perByte = atoi(argv[++i]);
+    else { usage(); return 2; }
+  }
+  if (flashMb < 1 || flashMb > 8) {
+    fprintf(stderr, "--flash-mb must be 1 to 8\n");
+    return 2;
+  }
+  if (!FlashEmu::open(imagePath, flashMb * 1024 * 1024))
+    return 2;
+
+  printf("flash: %uMB, %llu ns a transaction, %llu ns a byte\n", flashMb,
+    (unsigned long long)FlashEmu::timing.transaction,
+    (unsigned long long)FlashEmu::timing.perByte);
+  Layout baseline;
+  printf("baseline: boot %zu, app %zu, contiguous, %d entries, %zu byte blocks\n",
+    baseline.bootSize, baseline.appSize, baseline.entries, baselineBlock);
+
+  bool any = false;
+  if (sweep.empty() || sweep == "block")  { sweepBlock(); any = true; }
+  if (sweep.empty() || sweep == "frag")   { sweepFrag();  any = true; }
+  if (sweep.empty() || sweep == "dir")    { sweepDir();   any = true; }
+  if (sweep.empty() || sweep == "split")  { sweepSplit(); any = true; }
+  if (!any) {
+    usage();
+    return 2;
+  }
+
+  FlashEmu::close();
+  printf("\n%s\n", failures ? "FAILED" : "all read back as written");
+  return failures ? 1 : 0;
+}
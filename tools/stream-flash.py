@@ -0,0 +1,167 @@
+#!/usr/bin/env python3
+"""Flash an image through a Multi-Flash programmer, streamed over USB serial.
+
+The programmer must be built with MF_STREAM. The image is the given .bin
+files, one after another, as they would be on the drive: the boot binary,
+then the app binary, if any.
+
+    tools/stream-flash.py /dev/ttyACM0 boot.bin app.bin
+
+Messages from the programmer are printed as they arrive. The exit status is
+0 if the target was flashed, 1 if not.
+
+The port can be any serial device, including a pty, so this can be run
+against something other than a real programmer. With --sim, the port is
+instead tools/swd-sim's stream_sim, built from the programmer's own
+sources, which is run, and flashes a simulated target:
+
+    tools/stream-flash.py --sim tools/swd-sim/stream_sim boot.bin app.bin
+
+Its report of the job, and of what the target's flash holds, is printed at
+the end, and must say the image is held for the exit status to be 0.
+"""
+
+import argparse
+import os
+import select
+import subprocess
+import sys
+import termios
+import time
+import tty
+import zlib
+
+
+class Port:
+    def __init__(self, path):
+        self.fd = os.open(path, os.O_RDWR | os.O_NOCTTY)
+        if os.isatty(self.fd):
+            tty.setraw(self.fd)
+            termios.tcflush(self.fd, termios.TCIOFLUSH)
+        self.pending = b''
+
+    def write(self, data):
+        while data:
+            n = os.write(self.fd, data)
+            data = data[n:]
+
+    def readline(self, timeout):
+        # returns a line, without the newline, or None if none in time
+        deadline = time.monotonic() + timeout
+        while b'\n' not in self.pending:
+            left = deadline - time.monotonic()
+            if left <= 0:
+                return None
+            ready, _, _ = select.select([self.fd], [], [], left)
+            if ready:
+                data = os.read(self.fd, 4096)
+                if not data:
+                    raise EOFError('port closed')
+                self.pending += data
+        line, self.pending = self.pending.split(b'\n', 1)
+        return line.rstrip(b'\r').decode('utf-8', 'replace')
+
+
+def flash(port, image, timeout, verbose):
+    crc = zlib.crc32(image) & 0xffffffff
+    port.write(b'#!job %d %08x\n' % (len(image), crc))
+
+    accepted = False
+    start = time.monotonic()
+    sent = 0
+    while True:
+        line = port.readline(timeout)
+        if line is None:
+            print('timed out', file=sys.stderr)
+            return False
+
+        if not line.startswith('#!'):
+            print(line)
+            continue
+
+        words = line[2:].split()
+        if not words:
+            continue
+        cmd = words[0]
+
+        if cmd == 'ok':
+            accepted = True
+        elif cmd == 'need' and accepted:
+            offset, length = int(words[1]), int(words[2])
+            port.write(image[offset:offset + length])
+            sent += length
+            if verbose:
+                print('  sent %d @ %d' % (length, offset), file=sys.stderr)
+        elif cmd == 'err':
+            print('error: %s' % ' '.join(words[1:]), file=sys.stderr)
+            if not accepted:
+                return False
+        elif cmd == 'done' and accepted:
+            elapsed = time.monotonic() - start
+            print('%s, %d bytes sent in %.1fs' % (words[1], sent, elapsed),
+                  file=sys.stderr)
+            return words[1] == 'pass'
+
+
+def run_sim(harness, faults):
+    # starts stream_sim for one job; returns it, and the pty it opened
+    cmd = [harness, '--jobs', '1']
+    if faults:
+        cmd += ['--faults', faults]
+    proc = subprocess.Popen(cmd, stdout=subprocess.PIPE,
+                            universal_newlines=True)
+    words = proc.stdout.readline().split()
+    if len(words) != 2 or words[0] != 'port':
+        proc.kill()
+        raise RuntimeError('%s: no port' % harness)
+    return proc, words[1]
+
+
+def finish_sim(proc, flashed):
+    # prints the job's report; the job must have left the image in flash
+    try:
+        report, _ = proc.communicate(timeout=5)
+    except subprocess.TimeoutExpired:
+        proc.kill()
+        report, _ = proc.communicate()
+    sys.stderr.write(report)
+    return flashed and 'holds the image' in report
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Stream an image to a Multi-Flash programmer.')
+    parser.add_argument('port', help='serial port, such as /dev/ttyACM0;'
+                        ' or with --sim, the stream_sim harness')
+    parser.add_argument('bins', nargs='+', help='binaries, in flash order')
+    parser.add_argument('--timeout', type=float, default=10.0,
+                        help='seconds to wait for the programmer')
+    parser.add_argument('--verbose', '-v', action='store_true')
+    parser.add_argument('--sim', action='store_true',
+                        help='run the port, stream_sim, and flash through it')
+    parser.add_argument('--faults',
+                        help='with --sim, faults to inject into the target')
+    args = parser.parse_args()
+
+    image = b''
+    for path in args.bins:
+        with open(path, 'rb') as f:
+            image += f.read()
+    if not image:
+        parser.error('image is empty')
+
+    if not args.sim:
+        port = Port(args.port)
+        return 0 if flash(port, image, args.timeout, args.verbose) else 1
+
+    proc, path = run_sim(args.port, args.faults)
+    try:
+        flashed = flash(Port(path), image, args.timeout, args.verbose)
+    except Exception:
+        proc.kill()
+        raise
+    return 0 if finish_sim(proc, flashed) else 1
+
+
+if __name__ == '__main__':
+    sys.exit(main())
@@ -0,0 +1,168 @@
+#ifndef _HOST_ADAFRUIT_DAP_H_
+#define _HOST_ADAFRUIT_DAP_H_
+
+// A stand-in for the Adafruit_DAP library, for building the programmer's
+// flash_manager.cpp against the simulated target: the part of the library's
+// API that the programmer uses, with the same names and signatures,
+// implemented in dap_host.cpp as a bit-bang SWD master over Arduino's pin
+// calls, which sim_arduino.cpp puts on the simulated wire.
+//
+// It follows what the library does on the wire, as far as the programmer
+// can tell: the connect and prepare sequences, posted reads, WAIT retries as
+// set by dap_transfer_configure(), and rows programmed by unlocking and
+// erasing, then writing the pages in one block. Errors go to the error
+// handler given to begin(), once per failed transfer, and the text is left
+// in error_message. Only the SAMD21s are known to select(); SAMx5 is
+// declared, so the programmer builds, but not simulated.
+
+#include <Arduino.h>
+
+typedef void (*ErrorHandler)(const char* error);
+
+typedef struct {
+  uint32_t    dsu_did;
+  const char* name;
+  uint32_t    flash_size;
+  uint32_t    n_pages;
+} device_t;
+
+class Adafruit_DAP {
+public:
+  virtual ~Adafruit_DAP() { }
+
+  bool begin(int swclk, int swdio, int swrst, ErrorHandler perr);
+
+  bool dap_disconnect();
+  bool dap_connect();
+  bool dap_transfer_configure(uint8_t idle, uint16_t count, uint16_t retry);
+  bool dap_swd_configure(uint8_t cfg);
+  bool dap_swj_clock(uint32_t clock);
+  bool dap_set_clock(uint32_t clock);
+  bool dap_reset_link();
+  bool dap_reset_target_hw(int state = 0);
+  bool dap_target_prepare();
+
+  bool dap_read_reg(uint8_t reg, uint32_t* data);
+  bool dap_write_reg(uint8_t reg, uint32_t data);
+    // reg is a CMSIS-DAP transfer request: bit 0 set for the AP, and the
+    // register's address in bits 2 and 3
+  uint32_t dap_read_word(uint32_t addr);
+  bool dap_write_word(uint32_t addr, uint32_t data);
+  bool dap_read_block(uint32_t addr, uint8_t* data, int size);
+  bool dap_write_block(uint32_t addr, const uint8_t* data, int size);
+
+  virtual bool select(uint32_t* id) = 0;
+  virtual void deselect() { }
+  virtual void erase() = 0;
+
+  char* error_message = errorText;
+  device_t target_device = { 0, "", 0, 0 };
+
+protected:
+  bool fail(const char* text);
+    // reports an error, and returns false
+
+private:
+  int swclk = -1;
+  int swdio = -1;
+  int swrst = -1;
+  ErrorHandler perr = NULL;
+  uint8_t idleCycles = 0;
+  uint16_t waitRetries = 128;
+  char errorText[64] = "";
+
+  void writeBits(uint32_t bits, int count);
+  uint32_t readBits(int count);
+  void cycles(int count);
+  int transfer(uint8_t request, uint32_t& data);
+  bool lineReset();
+};
+
+class Adafruit_DAP_SAM : public Adafruit_DAP {
+public:
+  bool select(uint32_t* id);
+  void deselect();
+  void erase();
+  void lock();
+
+  uint32_t program_start(uint32_t offset = 0);
+  void programBlock(uint32_t addr, const uint8_t* buf);
+  void readBlock(uint32_t addr, uint8_t* buf);
+    // a row, 256 bytes
+
+  void fuseRead();
+  void fuseWrite();
+
+  union {
+    struct {
+      uint64_t BOOTPROT:3;
+      uint64_t :1;
+      uint64_t EEPROM:3;
+      uint64_t :1;
+      uint64_t BOD33_Level:6;
+      uint64_t BOD33_Enable:1;
+      uint64_t BOD33_Action:2;
+      uint64_t :8;
+      uint64_t WDT_Enable:1;
+      uint64_t WDT_Always_On:1;
+      uint64_t WDT_Period:4;
+      uint64_t WDT_Window:4;
+      uint64_t WDT_EWOFFSET:4;
+      uint64_t WDT_WEN:1;
+      uint64_t BOD33_Hysteresis:1;
+      uint64_t :1;
+      uint64_t :5;
+      uint64_t LOCK:16;
+    } bit;
+    uint32_t reg32[2];
+    uint64_t reg64;
+    uint8_t reg[8];
+  } _USER_ROW;
+
+private:
+  bool waitNvmReady();
+};
+
+class Adafruit_DAP_SAMx5 : public Adafruit_DAP {
+public:
+  bool select(uint32_t* id);    // finds no device
+  void deselect();
+  void erase();
+  void lock();
+
+  uint32_t program_start(uint32_t offset = 0);
+  void programBlock(uint32_t addr, const uint8_t* buf, uint16_t size = 512);
+  void readBlock(uint32_t addr, uint8_t* buf, uint16_t size = 512);
+
+  void fuseRead();
+  void fuseWrite();
+
+  union {
+    struct {
+      uint32_t BOD33_Disable:1;
+      uint32_t BOD33_Level:8;
+      uint32_t BOD33_Action:2;
+      uint32_t BOD33_Hysteresis:4;
+      uint32_t BOD12_Calibration:11;
+      uint32_t NVM_BOOT:4;
+      uint32_t :2;
+      uint32_t SEESBLK:4;
+      uint32_t SEEPSZ:3;
+      uint32_t RAM_ECCDIS:1;
+      uint32_t :8;
+      uint32_t WDT_Enable:1;
+      uint32_t WDT_Always_On:1;
+      uint32_t WDT_Period:4;
+      uint32_t WDT_Window:4;
+      uint32_t WDT_EWOFFSET:4;
+      uint32_t WDT_WEN:1;
+      uint32_t :7;
+      uint32_t NVM_LOCKS;
+      uint32_t User_Page;
+    } bit;
+    uint32_t reg32[128];
+    uint8_t reg[512];
+  } _USER_ROW;
+};
+
+#endif // _HOST_ADAFRUIT_DAP_H_
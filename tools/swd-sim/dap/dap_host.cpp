@@ -0,0 +1,434 @@
+// The Adafruit_DAP stand-in: see Adafruit_DAP.h.
+//
+// Each transfer is clocked out a bit at a time: SWDIO is set while SWCLK is
+// low, and the target samples it on the rising edge; the target's bits are
+// read while SWCLK is low. Between the host's bits and the target's there is
+// a turnaround cycle, in which neither drives the line.
+
+#include <Adafruit_DAP.h>
+
+#include <cstring>
+
+
+namespace {
+
+  // Transfer requests, as CMSIS-DAP has them
+  const uint8_t AP = 1 << 0;
+  const uint8_t RnW = 1 << 1;
+  const uint8_t DP_ABORT = 0x00;
+  const uint8_t DP_IDCODE = 0x00;
+  const uint8_t DP_CTRL_STAT = 0x04;
+  const uint8_t DP_SELECT = 0x08;
+  const uint8_t DP_RDBUFF = 0x0C;
+  const uint8_t AP_CSW = AP | 0x00;
+  const uint8_t AP_TAR = AP | 0x04;
+  const uint8_t AP_DRW = AP | 0x0C;
+
+  const int ACK_OK = 1;
+  const int ACK_WAIT = 2;
+  const int ACK_FAULT = 4;
+  const int ACK_PARITY = 8;   // not on the wire: OK, but the data was spoilt
+
+  const uint32_t tarWrap = 1024;  // TAR only increments within this
+
+  bool parity(uint32_t v) {
+    return __builtin_popcount(v) & 1;
+  }
+
+  const char* ackText(int ack) {
+    switch (ack) {
+      case ACK_WAIT:    return "invalid response (WAIT)";
+      case ACK_FAULT:   return "invalid response (FAULT)";
+      case ACK_PARITY:  return "parity error";
+      default:          return "invalid response (no ACK)";
+    }
+  }
+
+  // SAMD21 registers and commands
+  const uint32_t DSU_CTRL_STAT = 0x41002100;
+  const uint32_t DSU_DID = 0x41002018;
+  const uint32_t NVMCTRL_CTRLA = 0x41004000;
+  const uint32_t NVMCTRL_CTRLB = 0x41004004;
+  const uint32_t NVMCTRL_INTFLAG = 0x41004014;
+  const uint32_t NVMCTRL_ADDR = 0x4100401C;
+  const uint32_t USER_ROW_ADDR = 0x00804000;
+
+  const uint32_t CMDEX = 0xA500;
+  const uint32_t CMD_ER = 0x02;
+  const uint32_t CMD_EAR = 0x05;
+  const uint32_t CMD_WAP = 0x06;
+  const uint32_t CMD_UR = 0x41;
+  const uint32_t CMD_PBC = 0x44;
+  const uint32_t CMD_SSB = 0x45;
+
+  const uint32_t DHCSR = 0xE000EDF0;
+  const uint32_t DEMCR = 0xE000EDFC;
+  const uint32_t AIRCR = 0xE000ED0C;
+
+  const uint32_t FLASH_ROW_SIZE = 256;
+  const uint32_t nvmTimeout = 100;    // ms, well past a chip's slowest row
+
+  // The SAMD21s, by device ID less the die and revision
+  const uint32_t didMask = 0xffff00ff;
+  const device_t devices[] = {
+    { 0x10010000, "SAM D21J18A", 256 * 1024, 4096 },
+    { 0x10010001, "SAM D21J17A", 128 * 1024, 2048 },
+    { 0x10010002, "SAM D21J16A",  64 * 1024, 1024 },
+    { 0x10010005, "SAM D21G18A", 256 * 1024, 4096 },
+    { 0x10010006, "SAM D21G17A", 128 * 1024, 2048 },
+    { 0x10010007, "SAM D21G16A",  64 * 1024, 1024 },
+    { 0x1001000A, "SAM D21E18A", 256 * 1024, 4096 },
+    { 0x1001000B, "SAM D21E17A", 128 * 1024, 2048 },
+    { 0x1001000C, "SAM D21E16A",  64 * 1024, 1024 },
+  };
+}
+
+
+/* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+// The wire
+
+void Adafruit_DAP::writeBits(uint32_t bits, int count) {
+  for (int i = 0; i < count; ++i) {
+    digitalWrite(swdio, (bits >> i) & 1 ? HIGH : LOW);
+    digitalWrite(swclk, LOW);
+    digitalWrite(swclk, HIGH);
+  }
+}
+
+uint32_t Adafruit_DAP::readBits(int count) {
+  uint32_t bits = 0;
+  for (int i = 0; i < count; ++i) {
+    digitalWrite(swclk, LOW);
+    if (digitalRead(swdio) == HIGH)
+      bits |= 1u << i;
+    digitalWrite(swclk, HIGH);
+  }
+  return bits;
+}
+
+void Adafruit_DAP::cycles(int count) {
+  for (int i = 0; i < count; ++i) {
+    digitalWrite(swclk, LOW);
+    digitalWrite(swclk, HIGH);
+  }
+}
+
+int Adafruit_DAP::transfer(uint8_t request, uint32_t& data) {
+  // one request, tried again while the target answers WAIT
+  uint8_t bits = 0x81 | (request & 0x0f) << 1 | parity(request & 0x0f) << 5;
+  bool read = request & RnW;
+
+  for (int tries = 0; ; ++tries) {
+    writeBits(bits, 8);
+    pinMode(swdio, INPUT);
+    cycles(1);    // turnaround
+    int ack = readBits(3);
+
+    if (ack == ACK_OK) {
+      if (read) {
+        data = readBits(32);
+        if (readBits(1) != parity(data))
+          ack = ACK_PARITY;
+        cycles(1);
+        pinMode(swdio, OUTPUT);
+      } else {
+        cycles(1);
+        pinMode(swdio, OUTPUT);
+        writeBits(data, 32);
+        writeBits(parity(data), 1);
+      }
+      writeBits(0, idleCycles);
+      return ack;
+    }
+
+    if (ack == ACK_WAIT || ack == ACK_FAULT) {
+      cycles(1);
+      pinMode(swdio, OUTPUT);
+    } else {
+      // nothing answered: let a data phase, had there been one, go by
+      cycles(1 + 33);
+      pinMode(swdio, OUTPUT);
+    }
+    if (ack != ACK_WAIT || tries >= waitRetries)
+      return ack;
+  }
+}
+
+bool Adafruit_DAP::lineReset() {
+  pinMode(swdio, OUTPUT);
+  writeBits(0xffffffff, 32);    // at least 50 ones
+  writeBits(0xffffffff, 24);
+  writeBits(0xe79e, 16);        // JTAG to SWD
+  writeBits(0xffffffff, 32);
+  writeBits(0xffffffff, 24);
+  writeBits(0, 8);
+  return true;
+}
+
+bool Adafruit_DAP::fail(const char* text) {
+  strncpy(errorText, text, sizeof(errorText) - 1);
+  errorText[sizeof(errorText) - 1] = '\0';
+  if (perr)
+    perr(errorText);
+  return false;
+}
+
+
+/* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+// The DAP
+
+bool Adafruit_DAP::begin(int swclk_, int swdio_, int swrst_, ErrorHandler perr_) {
+  swclk = swclk_;
+  swdio = swdio_;
+  swrst = swrst_;
+  perr = perr_;
+  return true;
+}
+
+bool Adafruit_DAP::dap_disconnect() {
+  pinMode(swdio, INPUT);
+  pinMode(swclk, INPUT);
+  pinMode(swrst, INPUT);
+  return true;
+}
+
+bool Adafruit_DAP::dap_connect() {
+  pinMode(swclk, OUTPUT);
+  pinMode(swdio, OUTPUT);
+  digitalWrite(swclk, HIGH);
+  digitalWrite(swdio, HIGH);
+  return true;
+}
+
+bool Adafruit_DAP::dap_transfer_configure(
+    uint8_t idle, uint16_t count, uint16_t retry) {
+  idleCycles = idle;
+  waitRetries = count;
+  return true;
+}
+
+bool Adafruit_DAP::dap_swd_configure(uint8_t cfg) {
+  return true;    // one turnaround cycle, and no data phase on WAIT
+}
+
+bool Adafruit_DAP::dap_swj_clock(uint32_t clock) {
+  return true;    // the pins run at the simulator's pinTime, whatever this
+}
+
+bool Adafruit_DAP::dap_set_clock(uint32_t clock) {
+  return dap_swj_clock(clock);
+}
+
+bool Adafruit_DAP::dap_reset_link() {
+  lineReset();
+  uint32_t idcode;
+  return dap_read_reg(DP_IDCODE, &idcode);
+}
+
+bool Adafruit_DAP::dap_reset_target_hw(int state) {
+  // Reset with SWCLK held at state: low, on a SAMD21, keeps the core in its
+  // reset extension phase, so it runs nothing before the debugger has it
+  pinMode(swrst, OUTPUT);
+  digitalWrite(swclk, state ? HIGH : LOW);
+  digitalWrite(swrst, LOW);
+  delay(10);
+  digitalWrite(swrst, HIGH);
+  delay(10);
+  digitalWrite(swclk, HIGH);
+  return true;
+}
+
+bool Adafruit_DAP::dap_target_prepare() {
+  uint32_t status;
+  return dap_write_reg(DP_ABORT, 0x0000001e)      // clear the sticky errors
+    && dap_write_reg(DP_SELECT, 0x00000000)
+    && dap_write_reg(DP_CTRL_STAT, 0x50000f00)    // power up
+    && dap_read_reg(DP_CTRL_STAT, &status)
+    && dap_write_reg(AP_CSW, 0x23000052);         // words, incrementing
+}
+
+bool Adafruit_DAP::dap_read_reg(uint8_t reg, uint32_t* data) {
+  uint32_t value = 0;
+  int ack = transfer(reg | RnW, value);
+  *data = value;
+  return ack == ACK_OK || fail(ackText(ack));
+}
+
+bool Adafruit_DAP::dap_write_reg(uint8_t reg, uint32_t data) {
+  int ack = transfer(reg & ~RnW, data);
+  return ack == ACK_OK || fail(ackText(ack));
+}
+
+uint32_t Adafruit_DAP::dap_read_word(uint32_t addr) {
+  // AP reads are posted: the data comes with the next read, of RDBUFF
+  uint32_t data = 0;
+  if (!dap_write_reg(AP_TAR, addr)
+      || !dap_read_reg(AP_DRW, &data)
+      || !dap_read_reg(DP_RDBUFF, &data))
+    return 0;
+  return data;
+}
+
+bool Adafruit_DAP::dap_write_word(uint32_t addr, uint32_t data) {
+  return dap_write_reg(AP_TAR, addr) && dap_write_reg(AP_DRW, data);
+}
+
+bool Adafruit_DAP::dap_read_block(uint32_t addr, uint8_t* data, int size) {
+  int words = size / 4;
+  for (int i = 0; i < words; ) {
+    uint32_t at = addr + i * 4;
+    int n = min(words - i, (tarWrap - at % tarWrap) / 4);
+    uint32_t value;
+    if (!dap_write_reg(AP_TAR, at) || !dap_read_reg(AP_DRW, &value))
+      return false;
+    for (int j = 0; j < n; ++j, ++i) {
+      // each read of DRW returns the word before, and starts the next
+      if (!dap_read_reg(j == n - 1 ? DP_RDBUFF : AP_DRW, &value))
+        return false;
+      memcpy(data + i * 4, &value, 4);
+    }
+  }
+  return true;
+}
+
+bool Adafruit_DAP::dap_write_block(uint32_t addr, const uint8_t* data, int size) {
+  int words = size / 4;
+  for (int i = 0; i < words; ) {
+    uint32_t at = addr + i * 4;
+    int n = min(words - i, (tarWrap - at % tarWrap) / 4);
+    if (!dap_write_reg(AP_TAR, at))
+      return false;
+    for (int j = 0; j < n; ++j, ++i) {
+      uint32_t value;
+      memcpy(&value, data + i * 4, 4);
+      if (!dap_write_reg(AP_DRW, value))
+        return false;
+    }
+  }
+  return true;
+}
+
+/* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+// SAMD21
+
+bool Adafruit_DAP_SAM::select(uint32_t* id) {
+  *id = dap_read_word(DSU_DID);
+  for (auto& d : devices) {
+    if ((*id & didMask) == d.dsu_did) {
+      target_device = d;
+
+      // halt the core, and keep it halted through a reset
+      dap_write_word(DHCSR, 0xA05F0003);
+      dap_write_word(DEMCR, 0x00000001);
+      dap_write_word(AIRCR, 0x05FA0004);
+      return true;
+    }
+  }
+  return false;
+}
+
+bool Adafruit_DAP_SAM::waitNvmReady() {
+  auto giveUpAt = millis() + nvmTimeout;
+  do {
+    uint32_t flags;
+    if (!dap_write_reg(AP_TAR, NVMCTRL_INTFLAG)
+        || !dap_read_reg(AP_DRW, &flags) || !dap_read_reg(DP_RDBUFF, &flags))
+      return false;
+    if (flags & 1)    // READY
+      return true;
+  } while (millis() < giveUpAt);
+  return fail("NVM not ready");
+}
+
+void Adafruit_DAP_SAM::deselect() {
+  dap_write_word(DEMCR, 0x00000000);
+  dap_write_word(DHCSR, 0xA05F0000);
+}
+
+void Adafruit_DAP_SAM::erase() {
+  dap_write_word(DSU_CTRL_STAT, 0x00001f00);  // clear the flags
+  dap_write_word(DSU_CTRL_STAT, 0x00000010);  // chip erase
+  auto giveUpAt = millis() + 10 * nvmTimeout;
+  while (millis() < giveUpAt) {
+    if (dap_read_word(DSU_CTRL_STAT) & 0x00000100)
+      return;
+  }
+  fail("chip erase timed out");
+}
+
+void Adafruit_DAP_SAM::lock() {
+  dap_write_word(NVMCTRL_CTRLA, CMDEX | CMD_SSB);
+  waitNvmReady();
+}
+
+uint32_t Adafruit_DAP_SAM::program_start(uint32_t offset) {
+  if (dap_read_word(DSU_CTRL_STAT) & 0x00010000)
+    fail("device is locked, perform a chip erase before programming");
+  dap_write_word(NVMCTRL_CTRLB, 0);   // pages are written once filled
+  return offset;
+}
+
+void Adafruit_DAP_SAM::programBlock(uint32_t addr, const uint8_t* buf) {
+  dap_write_word(NVMCTRL_ADDR, addr >> 1);
+  dap_write_word(NVMCTRL_CTRLA, CMDEX | CMD_UR);
+  if (!waitNvmReady())
+    return;
+  dap_write_word(NVMCTRL_CTRLA, CMDEX | CMD_ER);
+  if (!waitNvmReady())
+    return;
+  dap_write_block(addr, buf, FLASH_ROW_SIZE);
+    // while a page is written, the next one's words are answered WAIT
+}
+
+void Adafruit_DAP_SAM::readBlock(uint32_t addr, uint8_t* buf) {
+  dap_read_block(addr, buf, FLASH_ROW_SIZE);
+}
+
+void Adafruit_DAP_SAM::fuseRead() {
+  _USER_ROW.reg32[0] = dap_read_word(USER_ROW_ADDR);
+  _USER_ROW.reg32[1] = dap_read_word(USER_ROW_ADDR + 4);
+}
+
+void Adafruit_DAP_SAM::fuseWrite() {
+  dap_write_word(NVMCTRL_CTRLB, 0);
+  dap_write_word(NVMCTRL_ADDR, USER_ROW_ADDR >> 1);
+  dap_write_word(NVMCTRL_CTRLA, CMDEX | CMD_EAR);
+  if (!waitNvmReady())
+    return;
+  dap_write_word(NVMCTRL_CTRLA, CMDEX | CMD_PBC);
+  if (!waitNvmReady())
+    return;
+  dap_write_word(USER_ROW_ADDR, _USER_ROW.reg32[0]);
+  dap_write_word(USER_ROW_ADDR + 4, _USER_ROW.reg32[1]);
+  dap_write_word(NVMCTRL_CTRLA, CMDEX | CMD_WAP);
+  waitNvmReady();
+}
+
+
+/* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+// SAMx5, not simulated
+
+bool Adafruit_DAP_SAMx5::select(uint32_t* id) {
+  *id = dap_read_word(DSU_DID);
+  return false;
+}
+
+void Adafruit_DAP_SAMx5::deselect() { }
+void Adafruit_DAP_SAMx5::erase() { fail("SAMx5 isn't simulated"); }
+void Adafruit_DAP_SAMx5::lock() { fail("SAMx5 isn't simulated"); }
+
+uint32_t Adafruit_DAP_SAMx5::program_start(uint32_t offset) {
+  fail("SAMx5 isn't simulated");
+  return offset;
+}
+
+void Adafruit_DAP_SAMx5::programBlock(uint32_t, const uint8_t*, uint16_t) {
+  fail("SAMx5 isn't simulated");
+}
+
+void Adafruit_DAP_SAMx5::readBlock(uint32_t, uint8_t*, uint16_t) {
+  fail("SAMx5 isn't simulated");
+}
+
+void Adafruit_DAP_SAMx5::fuseRead() { fail("SAMx5 isn't simulated"); }
+void Adafruit_DAP_SAMx5::fuseWrite() { fail("SAMx5 isn't simulated"); }
@@ -0,0 +1,81 @@
+// The parts of the programmer that flash_manager.cpp calls, but that aren't
+// simulated: they keep their state on the drive, or are never busy on the
+// host. Each does the least that leaves Flasher behaving as it does on the
+// board:
+//
+// * ProductionLog records nothing
+// * TargetHistory is kept in memory, for this run only
+// * Serialization is never active, as if there were no patches.txt
+// * LinkBench is never running
+
+#include <cstring>
+#include <vector>
+
+#include "link_bench.h"
+#include "production_log.h"
+#include "serialization.h"
+#include "target_history.h"
+
+
+namespace {
+  std::vector<TargetHistory::Entry> history;
+}
+
+namespace ProductionLog {
+  void setup(Interface&) { }
+  void record(const FlashStats&) { }
+  void idle(Interface&) { }
+}
+
+namespace TargetHistory {
+  void setup(Interface&) { }
+
+  bool lookup(const uint32_t serial[4], Entry& entry) {
+    for (auto& e : history) {
+      if (memcmp(e.serial, serial, sizeof(e.serial)) == 0) {
+        entry = e;
+        return true;
+      }
+    }
+    return false;
+  }
+
+  void record(const FlashStats& stats) {
+    if (!stats.success)
+      return;
+
+    Entry e;
+    memcpy(e.serial, stats.serial, sizeof(e.serial));
+    e.imageCrc = stats.imageCrc;
+    memcpy(e.fuses, stats.fuses, sizeof(e.fuses));
+    e.totalTime = min(stats.totalTime / 1000, static_cast<uint32_t>(0xffff));
+    e.count = 1;
+
+    for (auto& h : history) {
+      if (memcmp(h.serial, e.serial, sizeof(e.serial)) == 0) {
+        h = e;
+        return;
+      }
+    }
+    history.push_back(e);
+  }
+
+  void idle() { }
+}
+
+namespace Serialization {
+  void setup(Interface&) { }
+  bool load(Interface&, size_t) { return true; }
+  bool active() { return false; }
+  bool prepare(Interface&, const uint32_t[4]) { return true; }
+  void apply(uint32_t, uint8_t*, size_t) { }
+  bool commit() { return true; }
+}
+
+namespace LinkBench {
+  void setup(Interface&) { }
+  bool start(Interface&) { return false; }
+  bool busy() { return false; }
+  void run(uint32_t) { }
+  void idle() { }
+}
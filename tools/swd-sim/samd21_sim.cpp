@@ -0,0 +1,507 @@
+#include "samd21_sim.h"
+
+#include <algorithm>
+#include <cstring>
+#include <fstream>
+
+#include "crc32.h"
+
+
+namespace {
+
+  using namespace SwdSim;
+
+  const uint32_t ramAddr = 0x20000000;
+  const uint32_t ramSize = 32 * 1024;
+
+  const uint32_t nvmAuxStart = 0x00800000;
+  const uint32_t nvmAuxEnd = 0x00810000;
+  const uint32_t serialAddrs[4] = { 0x0080A00C, 0x0080A040, 0x0080A044, 0x0080A048 };
+
+  const uint32_t NVMCTRL = 0x41004000;
+  const uint32_t DSU = 0x41002000;
+  const uint32_t DSU_END = 0x41002200;    // it is also seen at DSU + 0x100
+  const uint32_t peripheralsStart = 0x40000000;
+  const uint32_t peripheralsEnd = 0x44000000;
+  const uint32_t ppbStart = 0xE0000000;
+  const uint32_t ppbEnd = 0xE0100000;
+
+  // NVMCTRL registers, and their bits
+  const uint32_t NVM_CTRLA = 0x00;
+  const uint32_t NVM_CTRLB = 0x04;
+  const uint32_t NVM_PARAM = 0x08;
+  const uint32_t NVM_INTFLAG = 0x14;
+  const uint32_t NVM_STATUS = 0x18;
+  const uint32_t NVM_ADDR = 0x1C;
+  const uint32_t NVM_LOCK = 0x20;
+
+  const uint32_t CTRLB_MANW = 1 << 7;
+  const uint32_t CMDEX_KEY = 0xA5;
+  const uint32_t STATUS_LOAD = 1 << 1;
+  const uint32_t STATUS_PROGE = 1 << 2;
+  const uint32_t STATUS_LOCKE = 1 << 3;
+  const uint32_t STATUS_NVME = 1 << 4;
+  const uint32_t STATUS_SB = 1 << 8;
+
+  const uint32_t CMD_ER = 0x02;
+  const uint32_t CMD_WP = 0x04;
+  const uint32_t CMD_EAR = 0x05;
+  const uint32_t CMD_WAP = 0x06;
+  const uint32_t CMD_LR = 0x40;
+  const uint32_t CMD_UR = 0x41;
+  const uint32_t CMD_PBC = 0x44;
+  const uint32_t CMD_SSB = 0x45;
+
+  // DSU registers, and their bits
+  const uint32_t DSU_CTRLSTAT = 0x00;
+  const uint32_t DSU_ADDR = 0x04;
+  const uint32_t DSU_LENGTH = 0x08;
+  const uint32_t DSU_DATA = 0x0C;
+  const uint32_t DSU_DID = 0x18;
+
+  const uint32_t CTRL_SWRST = 1 << 0;
+  const uint32_t CTRL_CRC = 1 << 2;
+  const uint32_t CTRL_CE = 1 << 4;
+  const uint8_t STATUSA_DONE = 1 << 0;
+  const uint8_t STATUSA_CRSTEXT = 1 << 1;
+  const uint8_t STATUSA_BERR = 1 << 2;
+  const uint8_t STATUSB_PROT = 1 << 0;
+  const uint8_t STATUSB_DBGPRES = 1 << 1;
+
+  // Cortex-M0+ debug registers
+  const uint32_t CPUID = 0xE000ED00;
+  const uint32_t AIRCR = 0xE000ED0C;
+  const uint32_t DHCSR = 0xE000EDF0;
+  const uint32_t DCRSR = 0xE000EDF4;
+  const uint32_t DCRDR = 0xE000EDF8;
+  const uint32_t DEMCR = 0xE000EDFC;
+
+  const uint32_t C_DEBUGEN = 1 << 0;
+  const uint32_t C_HALT = 1 << 1;
+  const uint32_t S_REGRDY = 1 << 16;
+  const uint32_t S_HALT = 1 << 17;
+  const uint32_t S_RESET_ST = 1 << 25;
+  const uint32_t VC_CORERESET = 1 << 0;
+
+  uint32_t getWord(const uint8_t* p) {
+    return p[0] | p[1] << 8 | p[2] << 16 | uint32_t(p[3]) << 24;
+  }
+
+  void putWord(uint8_t* p, uint32_t v) {
+    p[0] = v; p[1] = v >> 8; p[2] = v >> 16; p[3] = v >> 24;
+  }
+
+  // Flash is programmed by clearing bits; only erasing sets them.
+  void programWord(uint8_t* p, const uint8_t* from) {
+    for (int i = 0; i < 4; ++i)
+      p[i] &= from[i];
+  }
+}
+
+namespace SwdSim {
+
+  Samd21::Samd21(uint32_t flashSize, uint32_t deviceId)
+    : flash(flashSize, 0xff), ram(ramSize, 0), deviceId(deviceId)
+  {
+    stats = {};
+
+    // as shipped: no boot protection, no EEPROM, no regions locked
+    memset(userRow, 0xff, sizeof(userRow));
+    putWord(userRow + 0, 0xD8E0C7FF);
+    putWord(userRow + 4, 0xFFFFFC5D);
+
+    serial[0] = 0x12345678;
+    serial[1] = 0x50533252;
+    serial[2] = 0x2E3D1AFF;
+    serial[3] = 0x0A1D0E35;
+
+    memset(pageBuffer, 0xff, sizeof(pageBuffer));
+    coreReset(0);
+    runAt = 0;
+  }
+
+  bool Samd21::running(Time now) const {
+    return !inReset && !resetExtension && !halted && now >= runAt;
+  }
+
+  bool Samd21::loadFlash(const std::string& path) {
+    std::ifstream f(path, std::ios::binary);
+    if (!f)
+      return false;
+    std::fill(flash.begin(), flash.end(), 0xff);
+    f.read(reinterpret_cast<char*>(flash.data()), flash.size());
+    return true;
+  }
+
+  bool Samd21::saveFlash(const std::string& path) const {
+    std::ofstream f(path, std::ios::binary);
+    f.write(reinterpret_cast<const char*>(flash.data()), flash.size());
+    return bool(f);
+  }
+
+
+  /* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+  // The bus
+
+  Access Samd21::read(uint32_t addr, uint32_t& data, Time now) {
+    data = 0;
+
+    if (inFlash(addr)) {
+      data = getWord(&flash[addr]);
+    } else if (inUserRow(addr)) {
+      data = getWord(&userRow[addr - userRowAddr]);
+    } else if (addr >= nvmAuxStart && addr < nvmAuxEnd) {
+      data = 0xffffffff;    // calibration, and the like
+      for (int i = 0; i < 4; ++i)
+        if (addr == serialAddrs[i])
+          data = serial[i];
+    } else if (addr >= ramAddr && addr < ramAddr + ram.size()) {
+      data = getWord(&ram[addr - ramAddr]);
+      if (mailboxAddr && addr == mailboxAddr && running(now))
+        data = mailboxValue;
+    } else if (addr >= NVMCTRL && addr < NVMCTRL + 0x100) {
+      data = nvmRead(addr - NVMCTRL, now);
+    } else if (addr >= DSU && addr < DSU_END) {
+      data = dsuRead(addr & 0xff, now);
+    } else if (addr >= peripheralsStart && addr < peripheralsEnd) {
+      // not modelled
+    } else if (addr >= ppbStart && addr < ppbEnd) {
+      data = scsRead(addr);
+    } else {
+      stats.busErrors += 1;
+      return Access::error;
+    }
+    return Access::ok;
+  }
+
+  Access Samd21::write(uint32_t addr, uint32_t data, Time now) {
+    if (inFlash(addr) || inUserRow(addr)) {
+      loadPageBuffer(addr, data, now);
+    } else if (addr >= nvmAuxStart && addr < nvmAuxEnd) {
+      // read only
+    } else if (addr >= ramAddr && addr < ramAddr + ram.size()) {
+      putWord(&ram[addr - ramAddr], data);
+    } else if (addr >= NVMCTRL && addr < NVMCTRL + 0x100) {
+      nvmWrite(addr - NVMCTRL, data, now);
+    } else if (addr >= DSU && addr < DSU_END) {
+      dsuWrite(addr & 0xff, data, now);
+    } else if (addr >= peripheralsStart && addr < peripheralsEnd) {
+      // not modelled
+    } else if (addr >= ppbStart && addr < ppbEnd) {
+      scsWrite(addr, data, now);
+    } else {
+      stats.busErrors += 1;
+      return Access::error;
+    }
+    return Access::ok;
+  }
+
+  Time Samd21::readyAt(uint32_t addr, Time now) {
+    // the NVM stalls the bus while it is busy
+    if (inFlash(addr) || inUserRow(addr))
+      return std::max(now, std::max(nvmBusyUntil, dsuBusyUntil));
+    return now;
+  }
+
+  Time Samd21::accessTime(uint32_t addr) {
+    return inFlash(addr) || inUserRow(addr)
+      ? timing.flashAccess : timing.busAccess;
+  }
+
+
+  /* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+  // Resets
+
+  void Samd21::resetPin(bool asserted, bool swclk, Time now) {
+    if (asserted) {
+      inReset = true;
+      return;
+    }
+    if (!inReset)
+      return;
+
+    // Held in reset extension, if SWCLK is low as reset is released
+    inReset = false;
+    resetExtension = !swclk;
+    ctrlB = 0;
+    nvmStatus = 0;
+    nvmError = false;
+    nvmBusyUntil = now;
+    statusA = 0;
+    dsuBusyUntil = now;
+    coreReset(now);
+  }
+
+  void Samd21::powerCycle(Time now) {
+    std::fill(ram.begin(), ram.end(), 0);
+    dhcsr = 0;
+    demcr = 0;
+    inReset = false;
+    resetExtension = false;
+    resetPin(true, true, now);
+    resetPin(false, true, now);
+  }
+
+  void Samd21::coreReset(Time now) {
+    loadFuses();
+    memset(pageBuffer, 0xff, sizeof(pageBuffer));
+    resetSeen = true;
+    halted = (demcr & VC_CORERESET) && (dhcsr & C_DEBUGEN);
+    if (halted)
+      dhcsr |= C_HALT;
+    runAt = now + timing.bootTime;
+  }
+
+  void Samd21::loadFuses() {
+    auto bootprot = userRow[0] & 7;
+    bootProtect = bootprot == 7 ? 0 : 512 << (6 - bootprot);
+    regionLocks = userRow[6] | userRow[7] << 8;
+  }
+
+  bool Samd21::protectedAddr(uint32_t byteAddr) const {
+    auto region = byteAddr / (flash.size() / 16);
+    return byteAddr < bootProtect || !(regionLocks & (1 << region));
+  }
+
+
+  /* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+  // NVMCTRL
+
+  uint32_t Samd21::nvmRead(uint32_t reg, Time now) {
+    switch (reg) {
+      case NVM_CTRLB:   return ctrlB;
+      case NVM_PARAM:   return (flash.size() / flashPage) | 3 << 16;
+      case NVM_INTFLAG: return (nvmReady(now) ? 1 : 0) | (nvmError ? 2 : 0);
+      case NVM_STATUS:  return nvmStatus | (securityBit ? STATUS_SB : 0);
+      case NVM_ADDR:    return nvmAddr;
+      case NVM_LOCK:    return regionLocks;
+      default:          return 0;
+    }
+  }
+
+  void Samd21::nvmWrite(uint32_t reg, uint32_t data, Time now) {
+    switch (reg) {
+      case NVM_CTRLA:
+        if (((data >> 8) & 0xff) != CMDEX_KEY || !nvmReady(now))
+          nvmFail(STATUS_PROGE);
+        else
+          nvmCommand(data & 0x7f, now);
+        break;
+
+      case NVM_CTRLB:   ctrlB = data;                       break;
+      case NVM_INTFLAG: if (data & 2) nvmError = false;     break;
+      case NVM_STATUS:  nvmStatus &= ~(data & 0x1e);        break;
+      case NVM_ADDR:    nvmAddr = data & 0x7fffff;          break;
+        // wide enough for the user row, at 0x804000, as it is given
+      default:          break;
+    }
+  }
+
+  void Samd21::nvmFail(uint32_t statusBit) {
+    nvmStatus |= statusBit;
+    nvmError = true;
+    stats.nvmErrors += 1;
+  }
+
+  void Samd21::nvmCommand(uint32_t cmd, Time now) {
+    auto byteAddr = nvmAddr * 2;
+
+    switch (cmd) {
+      case CMD_ER: {
+        if (!inFlash(byteAddr))         return nvmFail(STATUS_NVME);
+        if (protectedAddr(byteAddr))    return nvmFail(STATUS_LOCKE);
+        auto row = byteAddr & ~(flashRow - 1);
+        memset(&flash[row], 0xff, flashRow);
+        nvmBusyUntil = now + timing.rowErase;
+        stats.rowErases += 1;
+        break;
+      }
+
+      case CMD_WP: {
+        if (!inFlash(byteAddr))         return nvmFail(STATUS_NVME);
+        if (protectedAddr(byteAddr))    return nvmFail(STATUS_LOCKE);
+        auto page = byteAddr & ~(flashPage - 1);
+        for (uint32_t i = 0; i < flashPage; i += 4)
+          programWord(&flash[page + i], &pageBuffer[i]);
+        memset(pageBuffer, 0xff, sizeof(pageBuffer));
+        nvmStatus &= ~STATUS_LOAD;
+        nvmBusyUntil = now + timing.pageWrite;
+        stats.pageWrites += 1;
+        break;
+      }
+
+      case CMD_EAR:
+        if (!inUserRow(byteAddr))       return nvmFail(STATUS_NVME);
+        memset(userRow, 0xff, sizeof(userRow));
+        nvmBusyUntil = now + timing.rowErase;
+        stats.rowErases += 1;
+        break;
+
+      case CMD_WAP: {
+        if (!inUserRow(byteAddr))       return nvmFail(STATUS_NVME);
+        auto page = (byteAddr - userRowAddr) & ~(flashPage - 1);
+        for (uint32_t i = 0; i < flashPage; i += 4)
+          programWord(&userRow[page + i], &pageBuffer[i]);
+        memset(pageBuffer, 0xff, sizeof(pageBuffer));
+        nvmStatus &= ~STATUS_LOAD;
+        nvmBusyUntil = now + timing.pageWrite;
+        stats.pageWrites += 1;
+        break;
+      }
+
+      case CMD_LR:
+      case CMD_UR: {
+        if (!inFlash(byteAddr))         return nvmFail(STATUS_NVME);
+        auto bit = 1 << (byteAddr / (flash.size() / 16));
+        if (cmd == CMD_LR)  regionLocks &= ~bit;
+        else                regionLocks |= bit;
+        break;
+      }
+
+      case CMD_PBC:
+        memset(pageBuffer, 0xff, sizeof(pageBuffer));
+        nvmStatus &= ~STATUS_LOAD;
+        break;
+
+      case CMD_SSB:
+        securityBit = true;
+        break;
+
+      default:
+        break;    // not modelled
+    }
+  }
+
+  void Samd21::loadPageBuffer(uint32_t addr, uint32_t data, Time now) {
+    auto offset = addr % flashPage;
+    putWord(&pageBuffer[offset], data);
+    nvmStatus |= STATUS_LOAD;
+    nvmAddr = addr / 2;
+
+    // Without manual write, filling the buffer writes the page
+    if (!(ctrlB & CTRLB_MANW) && offset == flashPage - 4)
+      nvmCommand(inUserRow(addr) ? CMD_WAP : CMD_WP, now);
+  }
+
+
+  /* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+  // DSU
+
+  uint32_t Samd21::dsuRead(uint32_t reg, Time now) {
+    switch (reg) {
+      case DSU_CTRLSTAT: {
+        uint32_t a = statusA;
+        if (now >= dsuBusyUntil)  a |= STATUSA_DONE;
+        if (resetExtension)       a |= STATUSA_CRSTEXT;
+        uint32_t b = STATUSB_DBGPRES | (securityBit ? STATUSB_PROT : 0);
+        return a << 8 | b << 16;
+      }
+      case DSU_ADDR:    return dsuAddr;
+      case DSU_LENGTH:  return dsuLength;
+      case DSU_DATA:    return dsuData;
+      case DSU_DID:     return deviceId;
+      default:          return 0;
+    }
+  }
+
+  void Samd21::dsuWrite(uint32_t reg, uint32_t data, Time now) {
+    switch (reg) {
+      case DSU_CTRLSTAT: {
+        auto clear = (data >> 8) & 0xff;
+        statusA &= ~clear;
+        if ((clear & STATUSA_CRSTEXT) && resetExtension) {
+          resetExtension = false;
+          runAt = now + timing.bootTime;
+        }
+
+        if (data & CTRL_SWRST) {
+          statusA = 0;
+          dsuAddr = dsuLength = dsuData = 0;
+        }
+
+        if (data & CTRL_CE) {
+          std::fill(flash.begin(), flash.end(), 0xff);
+          securityBit = false;
+          statusA &= ~(STATUSA_DONE | STATUSA_BERR);
+          dsuBusyUntil = now + timing.chipErase;
+          stats.chipErases += 1;
+        }
+
+        if (data & CTRL_CRC) {
+          auto start = dsuAddr & ~3u;
+          auto len = dsuLength & ~3u;
+          const uint8_t* p = NULL;
+          if (start + len <= flash.size())
+            p = &flash[start];
+          else if (start >= ramAddr && start + len <= ramAddr + ram.size())
+            p = &ram[start - ramAddr];
+
+          statusA &= ~(STATUSA_DONE | STATUSA_BERR);
+          if (p) {
+            // The DSU doesn't invert the result, so this undoes crc32's
+            dsuData = ~crc32(p, len, ~dsuData);
+            dsuBusyUntil = now + len * timing.crcPerByte;
+          } else {
+            statusA |= STATUSA_BERR;
+          }
+        }
+        break;
+      }
+
+      case DSU_ADDR:    dsuAddr = data;     break;
+      case DSU_LENGTH:  dsuLength = data;   break;
+      case DSU_DATA:    dsuData = data;     break;
+      default:          break;
+    }
+  }
+
+
+  /* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+  // The core's debug registers
+
+  uint32_t Samd21::scsRead(uint32_t addr) {
+    switch (addr) {
+      case CPUID:   return 0x410CC601;
+      case AIRCR:   return 0xFA050000;
+      case DCRDR:   return dcrdr;
+      case DEMCR:   return demcr;
+
+      case DHCSR: {
+        uint32_t v = dhcsr | S_REGRDY | (halted ? S_HALT : 0);
+        if (resetSeen) {
+          v |= S_RESET_ST;
+          resetSeen = false;
+        }
+        return v;
+      }
+
+      default:      return 0;
+    }
+  }
+
+  void Samd21::scsWrite(uint32_t addr, uint32_t data, Time now) {
+    switch (addr) {
+      case AIRCR:
+        if ((data >> 16) == 0x05FA && (data & (1 << 2))) {
+          // SYSRESETREQ resets all but the debug logic
+          ctrlB = 0;
+          nvmStatus = 0;
+          coreReset(now);
+        }
+        break;
+
+      case DHCSR:
+        if ((data >> 16) != 0xA05F)
+          break;    // needs the key
+        dhcsr = data & 0xf;
+        halted = (dhcsr & C_DEBUGEN) && (dhcsr & C_HALT);
+        break;
+
+      case DCRSR:   break;    // registers aren't modelled
+      case DCRDR:   dcrdr = data;     break;
+      case DEMCR:   demcr = data;     break;
+      default:      break;
+    }
+  }
+
+}
@@ -0,0 +1,130 @@
+#ifndef _SAMD21_SIM_H_
+#define _SAMD21_SIM_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "swd_sim.h"
+
+// A SAMD21, as much of one as the programmer sees over SWD: flash and its
+// page buffer, the user row, RAM, the NVMCTRL and DSU peripherals, and the
+// debug registers of the Cortex-M0+ core.
+//
+// NVM operations take as long as the Timing says, and while one is going on
+// NVMCTRL isn't READY, and accesses to flash stall the bus, as on the chip.
+// Boot protection and region locks are enforced, and are loaded from the
+// user row at reset. Other peripherals read as 0, and ignore writes.
+
+namespace SwdSim {
+
+  class Samd21 : public Bus {
+  public:
+    struct Timing {
+      // NVM times are below the datasheet's maximums (2.5ms a page, 6ms a
+      // row), which can be set to check the worst case
+      Time busAccess    = 60;         // an AHB access to RAM or peripherals
+      Time flashAccess  = 100;        // with wait states
+      Time pageWrite    = 1 * ms;
+      Time rowErase     = 4 * ms;
+      Time chipErase    = 240 * ms;
+      Time crcPerByte   = 25;         // the DSU, at 48MHz
+      Time bootTime     = 20 * ms;    // from reset to the firmware running
+    };
+
+    struct Stats {
+      uint64_t pageWrites;
+      uint64_t rowErases;
+      uint64_t chipErases;
+      uint64_t nvmErrors;     // commands refused, or locked regions
+      uint64_t busErrors;
+    };
+
+    static const uint32_t flashPage = 64;
+    static const uint32_t flashRow = 4 * flashPage;
+    static const uint32_t userRowAddr = 0x00804000;
+
+    Samd21(uint32_t flashSize = 256 * 1024, uint32_t deviceId = 0x10010305);
+      // the default is a SAMD21G18A, revision D
+
+    Timing timing;
+    Stats stats;
+
+    std::vector<uint8_t> flash;
+    std::vector<uint8_t> ram;
+    uint8_t userRow[flashRow];
+    uint32_t serial[4];       // the 128 bit serial number
+
+    uint32_t mailboxAddr = 0;
+    uint32_t mailboxValue = 0;
+      // if set, the firmware, once running, writes this word to RAM, as
+      // for TARGET_RUN_MAILBOX
+
+    bool running(Time now) const;
+      // out of reset, not halted, and booted
+
+    bool loadFlash(const std::string& path);
+    bool saveFlash(const std::string& path) const;
+
+    Access read(uint32_t addr, uint32_t& data, Time now);
+    Access write(uint32_t addr, uint32_t data, Time now);
+    Time readyAt(uint32_t addr, Time now);
+    Time accessTime(uint32_t addr);
+    void resetPin(bool asserted, bool swclk, Time now);
+    void powerCycle(Time now);
+
+  private:
+    const uint32_t deviceId;
+
+    // NVMCTRL
+    uint32_t ctrlB = 0;
+    uint32_t nvmStatus = 0;
+    bool nvmError = false;
+    uint32_t nvmAddr = 0;       // in 16 bit words, as the chip has it
+    uint16_t regionLocks = 0xffff;
+    uint32_t bootProtect = 0;   // bytes
+    bool securityBit = false;
+    uint8_t pageBuffer[flashPage];
+    Time nvmBusyUntil = 0;
+
+    // DSU
+    uint8_t statusA = 0;
+    uint32_t dsuAddr = 0;
+    uint32_t dsuLength = 0;
+    uint32_t dsuData = 0;
+    Time dsuBusyUntil = 0;
+
+    // The core
+    bool inReset = false;
+    bool resetExtension = false;    // CRSTEXT
+    uint32_t dhcsr = 0;             // the C_ bits
+    uint32_t demcr = 0;
+    uint32_t dcrdr = 0;
+    bool halted = false;
+    bool resetSeen = false;         // S_RESET_ST
+    Time runAt = 0;
+
+    void coreReset(Time now);
+    void loadFuses();
+    bool nvmReady(Time now) const { return now >= nvmBusyUntil; }
+    bool protectedAddr(uint32_t byteAddr) const;
+    bool inFlash(uint32_t addr) const { return addr < flash.size(); }
+    bool inUserRow(uint32_t addr) const
+      { return addr >= userRowAddr && addr < userRowAddr + flashRow; }
+
+    uint32_t nvmRead(uint32_t reg, Time now);
+    void nvmWrite(uint32_t reg, uint32_t data, Time now);
+    void nvmCommand(uint32_t cmd, Time now);
+    void nvmFail(uint32_t statusBit);
+    void loadPageBuffer(uint32_t addr, uint32_t data, Time now);
+
+    uint32_t dsuRead(uint32_t reg, Time now);
+    void dsuWrite(uint32_t reg, uint32_t data, Time now);
+
+    uint32_t scsRead(uint32_t addr);
+    void scsWrite(uint32_t addr, uint32_t data, Time now);
+  };
+
+}
+
+#endif // _SAMD21_SIM_H_
@@ -0,0 +1,130 @@
+// Arduino's pin and time calls, for a host build of the DAP stand-in in
+// dap/: the programmer's side of the wire to the simulated target. And the
+// board's USB serial port, which is stdout, or for stream_sim, a pty.
+//
+// Each pin call takes SwdSim::pinTime of simulated time, standing in for
+// the cost of the call on the programmer, so the SWD clock rate comes out
+// close to that on the hardware. Reading the clock takes a microsecond, so
+// that a loop waiting on it, as FlashManager::run() does while Flasher has
+// nothing to send, gets to the end of it. The bit-bang layer's own delay
+// loops take no simulated time.
+
+#include <Arduino.h>
+
+#include <sys/ioctl.h>
+#include <unistd.h>
+
+#include "swd_sim.h"
+
+
+namespace {
+
+  using namespace SwdSim;
+
+  Time simTime = 0;
+
+  Target* target = NULL;
+  uint32_t swclkPin = ~0u;
+  uint32_t swdioPin = ~0u;
+  uint32_t swrstPin = ~0u;
+
+  bool swclk = false;
+  bool swdio = false;
+  bool swdioOutput = false;
+  bool swrst = true;
+}
+
+namespace SwdSim {
+
+  Time pinTime = 250;
+
+  void wire(Target& t, int clk, int dio, int rst) {
+    target = &t;
+    swclkPin = clk;
+    swdioPin = dio;
+    swrstPin = rst;
+  }
+
+  Time now() { return simTime; }
+  void wait(Time t) { simTime += t; }
+
+}
+
+void pinMode(uint32_t pin, uint32_t mode) {
+  simTime += pinTime;
+  if (pin == swdioPin) {
+    swdioOutput = mode == OUTPUT;
+  } else if (pin == swrstPin && mode != OUTPUT && !swrst) {
+    swrst = true;   // let go of, it is pulled up
+    if (target)
+      target->resetPin(false, swclk, simTime);
+  }
+}
+
+void digitalWrite(uint32_t pin, uint32_t value) {
+  simTime += pinTime;
+  bool level = value != LOW;
+
+  if (pin == swclkPin) {
+    if (level && !swclk && target)
+      target->clock(swdioOutput, swdio, simTime);
+    swclk = level;
+  } else if (pin == swdioPin) {
+    swdio = level;
+  } else if (pin == swrstPin) {
+    if (level != swrst && target)
+      target->resetPin(!level, swclk, simTime);
+    swrst = level;
+  }
+}
+
+int digitalRead(uint32_t pin) {
+  simTime += pinTime;
+  if (pin == swdioPin) {
+    if (swdioOutput)
+      return swdio ? HIGH : LOW;
+    return !target || target->swdio() ? HIGH : LOW;
+  }
+  if (pin == swclkPin)
+    return swclk ? HIGH : LOW;
+  return HIGH;
+}
+
+Serial_ Serial;
+
+size_t Serial_::write(const uint8_t* buf, size_t len) {
+  if (fd < 0)
+    return fwrite(buf, 1, len, stdout);
+  auto n = ::write(fd, buf, len);
+  return n < 0 ? 0 : n;
+}
+
+int Serial_::available() {
+  int n = 0;
+  if (fd >= 0 && ioctl(fd, FIONREAD, &n) < 0)
+    n = 0;
+  return n + (peeked >= 0 ? 1 : 0);
+}
+
+int Serial_::read() {
+  if (peeked >= 0) {
+    int c = peeked;
+    peeked = -1;
+    return c;
+  }
+  uint8_t c;
+  if (fd < 0 || available() <= 0 || ::read(fd, &c, 1) != 1)
+    return -1;
+  return c;
+}
+
+int Serial_::peek() {
+  if (peeked < 0)
+    peeked = read();
+  return peeked;
+}
+
+unsigned long millis() { simTime += 1 * us; return simTime / ms; }
+unsigned long micros() { simTime += 1 * us; return simTime / us; }
+void delay(unsigned long t) { simTime += t * ms; }
+void delayMicroseconds(unsigned int t) { simTime += t * us; }
@@ -0,0 +1,175 @@
+// Flashes an image into a simulated SAMD21 with the programmer's own
+// Flasher, and reports how long it took and what the SWD link saw along
+// the way.
+//
+//    sim_flash [--faults script] [--trace] [--pin-ns n] [--out flash.bin]
+//              [--known] image.bin
+//
+// Everything Flasher does is as on the board: connecting with a hardware
+// reset, planning and writing the fuses, programming and verifying a page
+// at a time, retrying pages and waiting for a target that went away, and
+// releasing the target to run. --known flashes the target a second time,
+// as if it had come back to the programmer, so that it is confirmed by the
+// DSU's CRC rather than flashed again.
+//
+// With --faults, the image is also flashed into another target, with no
+// faults, and what recovering from the faults cost is reported against that:
+// the time, and the retries, reconnects and errors that took it.
+//
+// The exit status is 0 if Flasher reports success, and the simulated flash
+// ends up holding the image.
+
+#include <cstdio>
+#include <cstring>
+#include <fstream>
+#include <iterator>
+#include <string>
+#include <vector>
+
+#include "samd21_sim.h"
+#include "sim_programmer.h"
+#include "swd_sim.h"
+
+
+namespace {
+
+  using namespace SwdSim;
+
+  void report(const char* title, const FlashStats& f) {
+    auto ms = [](uint32_t us) { return us / 1000.0; };
+    printf("%s: %s%s, %.1fms\n", title,
+      f.success ? "pass" : "fail", f.confirmed ? ", confirmed" : "",
+      ms(f.totalTime));
+    printf("  phases: connect %.1f, fuses %.1f, program %.1f, verify %.1f,"
+      " finish %.1f ms\n",
+      ms(f.connectTime), ms(f.fuseTime), ms(f.programTime),
+      ms(f.verifyTime), ms(f.finishTime));
+    printf("  rows:   %u erased, %u written\n", f.rowsErased, f.rowsWritten);
+    printf("  link:   %u swd errors, %u retries, %u reconnects, clock %u\n",
+      f.swdErrors, f.retries, f.reconnects, f.swdClock);
+  }
+
+  FlashStats cleanRun(const std::vector<uint8_t>& image) {
+    // the same image, into a target of its own, with no faults
+    Samd21 chip;
+    chip.serial[3] ^= 1;    // not known to the programmer from this run
+    Target target(chip);
+    SimProgrammer::attach(target);
+    SimProgrammer::MemoryImage source(image);
+    SimProgrammer::Console console;
+    console.quiet = true;
+    SimProgrammer::flash(console, source);
+    return console.last;
+  }
+
+  void reportRecovery(const FlashStats& clean, const FlashStats& f) {
+    auto ms = [](uint32_t us) { return us / 1000.0; };
+    printf("recovery: %+.1fms over a clean run of %.1fms,"
+      " for %u retries, %u reconnects, %u swd errors\n",
+      ms(f.totalTime) - ms(clean.totalTime), ms(clean.totalTime),
+      f.retries, f.reconnects, f.swdErrors);
+    printf("  phases: connect %+.1f, fuses %+.1f, program %+.1f,"
+      " verify %+.1f, finish %+.1f ms\n",
+      ms(f.connectTime) - ms(clean.connectTime),
+      ms(f.fuseTime) - ms(clean.fuseTime),
+      ms(f.programTime) - ms(clean.programTime),
+      ms(f.verifyTime) - ms(clean.verifyTime),
+      ms(f.finishTime) - ms(clean.finishTime));
+  }
+
+  void usage() {
+    fprintf(stderr,
+      "usage: sim_flash [--faults script] [--trace] [--pin-ns n]"
+      " [--out flash.bin] [--known] image.bin\n");
+  }
+}
+
+int main(int argc, char** argv) {
+  std::string faultPath, outPath, imagePath;
+  bool trace = false;
+  bool known = false;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--faults" && i + 1 < argc)        faultPath = argv[++i];
+    else if (arg == "--out" && i + 1 < argc)      outPath = argv[++i];
+    else if (arg == "--pin-ns" && i + 1 < argc)   pinTime = atoi(argv[++i]);
+    else if (arg == "--trace")                    trace = true;
+    else if (arg == "--known")                    known = true;
+    else if (arg[0] != '-' && imagePath.empty())  imagePath = arg;
+    else { usage(); return 2; }
+  }
+  if (imagePath.empty()) {
+    usage();
+    return 2;
+  }
+
+  std::ifstream f(imagePath, std::ios::binary);
+  if (!f) {
+    fprintf(stderr, "%s: can't read\n", imagePath.c_str());
+    return 2;
+  }
+  std::vector<uint8_t> image((std::istreambuf_iterator<char>(f)),
+                             std::istreambuf_iterator<char>());
+
+  Samd21 chip;
+  Target target(chip);
+  target.trace = trace;
+  if (!faultPath.empty()) {
+    std::string error;
+    if (!target.script.load(faultPath, error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 2;
+    }
+  }
+  if (image.empty() || image.size() > chip.flash.size()) {
+    fprintf(stderr, "%s: image must be 1 to %zu bytes\n",
+      imagePath.c_str(), chip.flash.size());
+    return 2;
+  }
+
+  SimProgrammer::attach(target);
+  SimProgrammer::MemoryImage source(image);
+  SimProgrammer::Console console;
+
+  SimProgrammer::flash(console, source);
+  auto first = console.last;
+  bool ok = first.success;
+  if (known && ok) {
+    SimProgrammer::flash(console, source);
+    ok = console.last.success;
+  }
+
+  // after, as the script's times are from the start of the run
+  bool faults = !faultPath.empty();
+  FlashStats clean = { };
+  if (faults)
+    clean = cleanRun(image);
+
+  bool matches = memcmp(chip.flash.data(), image.data(), image.size()) == 0;
+  if (!outPath.empty())
+    chip.saveFlash(outPath);
+
+  printf("\n");
+  printf("image:  %zu bytes, target %08x\n", image.size(), first.deviceId);
+  report("flash", first);
+  if (known && first.success)
+    report("again", console.last);
+  if (faults && first.success && clean.success)
+    reportRecovery(clean, first);
+  printf("result: %s, flash %s the image\n",
+    ok ? "pass" : "fail", matches ? "matches" : "doesn't match");
+
+  auto& s = target.stats;
+  auto& c = chip.stats;
+  printf("swd:    %llu requests, %llu WAIT, %llu FAULT, %llu unanswered, "
+    "%llu line resets, %llu faults injected\n",
+    (unsigned long long)s.requests, (unsigned long long)s.waits,
+    (unsigned long long)s.faults, (unsigned long long)s.noResponse,
+    (unsigned long long)s.lineResets, (unsigned long long)s.injected);
+  printf("nvm:    %llu rows erased, %llu pages written, %llu errors\n",
+    (unsigned long long)c.rowErases, (unsigned long long)c.pageWrites,
+    (unsigned long long)c.nvmErrors);
+
+  return ok && matches ? 0 : 1;
+}
@@ -0,0 +1,67 @@
+#include "sim_programmer.h"
+
+#include <cstdio>
+#include <cstring>
+
+#include "config.h"
+#include "crc32.h"
+#include "flash_manager.h"
+
+
+namespace {
+
+  using namespace SwdSim;
+
+  const uint32_t flashSlice = 5000;   // µs, as in multi-flash.ino
+
+}
+
+namespace SimProgrammer {
+
+  Time loopTime = 1 * ms;
+
+  void attach(Target& target) {
+    wire(target, TARGET_SWCLK, TARGET_SWDIO, TARGET_SWRST);
+  }
+
+  void run() {
+    FlashManager::run(flashSlice);
+  }
+
+  bool flash(Interface& intf, ImageSource& image) {
+    if (!FlashManager::start(intf, image))
+      return false;
+
+    // Time only moves on when the pins do, or it is waited for: Flasher's
+    // own waits, for a target to come back, or to start, need the loop's.
+    while (FlashManager::busy()) {
+      run();
+      wait(loopTime);
+    }
+    return true;
+  }
+
+
+  uint32_t MemoryImage::imageCrc() {
+    return crc32(data.data(), data.size());
+  }
+
+  int MemoryImage::readNextBlock(uint8_t* buf, size_t blockSize) {
+    auto n = min(blockSize, data.size() - at);
+    memcpy(buf, data.data() + at, n);
+    at += n;
+    return n;
+  }
+
+
+  void Console::startMsg(const char* msg)   { print("start", msg); }
+  void Console::statusMsg(const char* msg)  { print("status", msg); }
+  void Console::errorMsg(const char* msg)   { print("error", msg); }
+
+  void Console::print(const char* kind, const char* msg) {
+    if (quiet && strcmp(kind, "error") != 0)
+      return;
+    printf("%10.3fs  %-6s  %s\n", now() / 1e9, kind, msg);
+  }
+
+}
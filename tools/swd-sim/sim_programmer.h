@@ -0,0 +1,71 @@
+#ifndef _SIM_PROGRAMMER_H_
+#define _SIM_PROGRAMMER_H_
+
+#include <cstdint>
+#include <vector>
+
+#include "image_source.h"
+#include "interface.h"
+#include "swd_sim.h"
+
+// The programmer, on the host: its own flash_manager.cpp, built against the
+// DAP stand-in in dap/, flashing the simulated target, with what it calls
+// that isn't simulated stubbed out in firmware_host.cpp. So what is run
+// here is Flasher itself: its connect, fuse planning, retries, reconnects
+// and release, not a copy of them.
+//
+// The tools that flash the simulated target go through this: sim_flash,
+// stream_sim, and tools/station-sim.
+
+namespace SimProgrammer {
+
+  void attach(SwdSim::Target&);
+    // wires the target to the programmer's SWD pins, from config.h
+
+  extern SwdSim::Time loopTime;
+    // the rest of each pass of the sketch's loop(), besides flashing: the
+    // interfaces and USB; 1ms by default
+
+  void run();
+    // FlashManager's slice of a pass of the sketch's loop
+  bool flash(Interface&, ImageSource&);
+    // runs FlashManager as the sketch does, a slice each pass of the loop,
+    // until it is done; false if it didn't start
+
+
+  class MemoryImage : public ImageSource {
+    // an image held in memory, read as FilesToFlash reads the drive
+  public:
+    MemoryImage(const std::vector<uint8_t>& data) : data(data) { }
+
+    size_t imageSize() { return data.size(); }
+    uint32_t imageCrc();
+
+    void rewind() { at = 0; }
+    int readNextBlock(uint8_t* buf, size_t blockSize);
+
+  private:
+    const std::vector<uint8_t>& data;
+    size_t at = 0;
+  };
+
+
+  class Console : public InterfaceBase {
+    // prints messages, with the simulated time, and keeps the last stats
+  public:
+    bool quiet = false;   // only errors are printed
+
+    void startMsg(const char* msg);
+    void statusMsg(const char* msg);
+    void errorMsg(const char* msg);
+    void stats(const FlashStats& s) { last = s; }
+
+    FlashStats last = { };
+
+  private:
+    void print(const char* kind, const char* msg);
+  };
+
+}
+
+#endif // _SIM_PROGRAMMER_H_
@@ -0,0 +1,155 @@
+// The programmer, built with MF_STREAM, on the host: its USB serial port is
+// a pty, and jobs streamed to it by tools/stream-flash.py are flashed into a
+// simulated SAMD21, by intf_stream.cpp and Flasher, as on the board.
+//
+//    stream_sim [--faults script] [--pin-ns n] [--out flash.bin] [--jobs n]
+//
+// The first line printed is "port <path>", the pty for the host to open;
+// stream-flash.py --sim runs this, and opens it. Messages go to the host over
+// the port, through intf_serial.cpp, as they would from the board. Each job
+// is reported here when it is done: how it went, in simulated time, and if
+// the target's flash holds the image. With --jobs, it stops after that many,
+// and writes the flash to --out; otherwise it runs until it is killed.
+//
+// Simulated time runs ahead of real time, except while there is nothing from
+// the host: then each pass of the loop waits for it, for as long as the pass
+// takes, so that the programmer's time out, for data it has asked for,
+// means what it does on the board.
+
+#include <fcntl.h>
+#include <poll.h>
+#include <termios.h>
+#include <unistd.h>
+
+#include <cstdio>
+#include <cstdlib>
+#include <string>
+
+#include "crc32.h"
+#include "flash_manager.h"
+#include "intf_serial.h"
+#include "intf_stream.h"
+#include "samd21_sim.h"
+#include "serial_out.h"
+#include "sim_programmer.h"
+#include "swd_sim.h"
+
+
+namespace {
+
+  using namespace SwdSim;
+
+  bool openPort(int& master) {
+    // The far end is made raw here, so that nothing the programmer sends
+    // before the host opens it is echoed back as if from the host; and is
+    // kept open, so the port outlives the host closing it.
+    master = posix_openpt(O_RDWR | O_NOCTTY);
+    if (master < 0 || grantpt(master) < 0 || unlockpt(master) < 0)
+      return false;
+    int slave = open(ptsname(master), O_RDWR | O_NOCTTY);
+    if (slave < 0)
+      return false;
+    termios t;
+    tcgetattr(slave, &t);
+    cfmakeraw(&t);
+    tcsetattr(slave, TCSANOW, &t);
+    return true;
+  }
+
+  void keepPace(int fd) {
+    // waits up to a loop pass of real time for the host
+    if (Serial.available() > 0)
+      return;
+    pollfd p = { fd, POLLIN, 0 };
+    poll(&p, 1, SimProgrammer::loopTime / ms);
+  }
+
+  void report(const FlashStats& s, const Samd21& chip) {
+    bool holds = s.imageSize <= chip.flash.size()
+      && crc32(chip.flash.data(), s.imageSize) == s.imageCrc;
+    printf("job: %s%s, %zu bytes, %.1fms, %u retries, %u reconnects;"
+      " flash %s the image\n",
+      s.success ? "pass" : "fail", s.confirmed ? ", confirmed" : "",
+      s.imageSize, s.totalTime / 1000.0, s.retries, s.reconnects,
+      holds ? "holds" : "doesn't hold");
+    fflush(stdout);
+  }
+
+  void usage() {
+    fprintf(stderr,
+      "usage: stream_sim [--faults script] [--pin-ns n] [--out flash.bin]"
+      " [--jobs n]\n");
+  }
+}
+
+int main(int argc, char** argv) {
+  std::string faultPath, outPath;
+  int jobs = 0;
+
+  for (int i = 1; i < argc; ++i) {
+    std::string arg = argv[i];
+    if (arg == "--faults" && i + 1 < argc)        faultPath = argv[++i];
+    else if (arg == "--out" && i + 1 < argc)      outPath = argv[++i];
+    else if (arg == "--pin-ns" && i + 1 < argc)   pinTime = atoi(argv[++i]);
+    else if (arg == "--jobs" && i + 1 < argc)     jobs = atoi(argv[++i]);
+    else { usage(); return 2; }
+  }
+
+  Samd21 chip;
+  Target target(chip);
+  if (!faultPath.empty()) {
+    std::string error;
+    if (!target.script.load(faultPath, error)) {
+      fprintf(stderr, "%s\n", error.c_str());
+      return 2;
+    }
+  }
+
+  int port;
+  if (!openPort(port)) {
+    perror("stream_sim: can't open a pty");
+    return 2;
+  }
+  Serial.port(port);
+  printf("port %s\n", ptsname(port));
+  fflush(stdout);
+
+  SimProgrammer::attach(target);
+  SimProgrammer::Console results;
+  results.quiet = true;
+  InterfaceList interfaces({ &serialInterface, &streamInterface, &results });
+  interfaces.setup();
+
+  // As the sketch's loop(), with only the stream to start jobs
+  int done = 0;
+  while (jobs == 0 || done < jobs) {
+    switch (interfaces.loop()) {
+      case Event::streamFlash:
+        if (!FlashManager::start(interfaces, streamImage))
+          streamCancel("busy");
+        break;
+
+      case Event::linkBench:
+        interfaces.errorMsg("the link bench isn't simulated");
+        break;
+
+      default:
+        break;
+    }
+
+    if (FlashManager::busy()) {
+      SimProgrammer::run();
+      if (!FlashManager::busy()) {
+        report(results.last, chip);
+        done += 1;
+      }
+    }
+    keepPace(port);
+    wait(SimProgrammer::loopTime);
+  }
+
+  serialOut.pump();
+  if (!outPath.empty())
+    chip.saveFlash(outPath);
+  return 0;
+}
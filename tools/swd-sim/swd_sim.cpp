@@ -0,0 +1,629 @@
+#include "swd_sim.h"
+
+#include <cstdio>
+#include <cstdlib>
+#include <fstream>
+#include <sstream>
+
+
+namespace {
+
+  using namespace SwdSim;
+
+  const int ackOk = 1;
+  const int ackWait = 2;
+  const int ackFault = 4;
+
+  const uint32_t dpidr = 0x0BC11477;    // SW-DP v1, as on a Cortex-M0+
+  const uint32_t apIdr = 0x04770031;    // AHB-AP, as on a Cortex-M0+
+  const uint32_t apBase = 0xE00FF003;   // the ROM table
+
+  // DP registers, by address
+  const int DP_IDR_ABORT = 0x0;
+  const int DP_CTRL_STAT = 0x4;
+  const int DP_SELECT_RESEND = 0x8;
+  const int DP_RDBUFF = 0xC;
+
+  // ABORT
+  const uint32_t DAPABORT = 1 << 0;
+  const uint32_t STKCMPCLR = 1 << 1;
+  const uint32_t STKERRCLR = 1 << 2;
+  const uint32_t WDERRCLR = 1 << 3;
+  const uint32_t ORUNERRCLR = 1 << 4;
+
+  // CTRL/STAT
+  const uint32_t STICKYORUN = 1 << 1;
+  const uint32_t STICKYCMP = 1 << 4;
+  const uint32_t STICKYERR = 1 << 5;
+  const uint32_t WDATAERR = 1 << 7;
+  const uint32_t CDBGPWRUPREQ = 1 << 28;
+  const uint32_t CDBGPWRUPACK = 1 << 29;
+  const uint32_t CSYSPWRUPREQ = 1 << 30;
+  const uint32_t CSYSPWRUPACK = 1u << 31;
+  const uint32_t stickyBits = STICKYORUN | STICKYCMP | STICKYERR | WDATAERR;
+  const uint32_t ctrlWritable = 0x5f000f0d;   // the request and mode bits
+
+  // MEM-AP registers, by bank and address
+  const int AP_CSW = 0x00;
+  const int AP_TAR = 0x04;
+  const int AP_DRW = 0x0C;
+  const int AP_BD0 = 0x10;
+  const int AP_BD3 = 0x1C;
+  const int AP_BASE = 0xF8;
+  const int AP_IDR = 0xFC;
+
+  const uint32_t cswDeviceEn = 1 << 6;
+  const uint32_t cswWritable = 0x0f000f37;
+
+  bool parity(uint32_t v) {
+    v ^= v >> 16;
+    v ^= v >> 8;
+    v ^= v >> 4;
+    v ^= v >> 2;
+    v ^= v >> 1;
+    return v & 1;
+  }
+
+  uint64_t number(const std::string& s, bool& ok) {
+    char* end;
+    auto v = strtoull(s.c_str(), &end, 0);
+    ok = !s.empty() && *end == '\0';
+    return v;
+  }
+}
+
+namespace SwdSim {
+
+  const char* ackName(int ack) {
+    switch (ack) {
+      case ackOk:     return "OK";
+      case ackWait:   return "WAIT";
+      case ackFault:  return "FAULT";
+      default:        return "none";
+    }
+  }
+
+
+  /* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+  // Fault scripts
+
+  bool FaultScript::load(const std::string& path, std::string& error) {
+    std::ifstream f(path);
+    if (!f) {
+      error = path + ": can't read";
+      return false;
+    }
+    std::stringstream text;
+    text << f.rdbuf();
+    if (!parse(text.str(), error)) {
+      error = path + ": " + error;
+      return false;
+    }
+    return true;
+  }
+
+  bool FaultScript::parse(const std::string& text, std::string& error) {
+    std::istringstream lines(text);
+    std::string line;
+    int lineNo = 0;
+    while (std::getline(lines, line)) {
+      lineNo += 1;
+      auto hash = line.find('#');
+      if (hash != std::string::npos)
+        line.erase(hash);
+
+      std::istringstream words(line);
+      std::string trigger, at, kind, arg;
+      if (!(words >> trigger))
+        continue;
+      words >> at >> kind >> arg;
+
+      auto fail = [&](const char* why) {
+        error = "line " + std::to_string(lineNo) + ": " + why;
+        return false;
+      };
+
+      Fault f = {};
+      if      (trigger == "request")  f.trigger = Fault::Trigger::request;
+      else if (trigger == "every")    f.trigger = Fault::Trigger::every;
+      else if (trigger == "time")     f.trigger = Fault::Trigger::time;
+      else if (trigger == "addr")     f.trigger = Fault::Trigger::addr;
+      else return fail("unknown trigger");
+
+      bool ok;
+      f.at = number(at, ok);
+      if (!ok) return fail("bad trigger value");
+      if (f.trigger == Fault::Trigger::every && f.at == 0)
+        return fail("every needs a period");
+
+      bool needsArg = false;
+      if      (kind == "parity")      f.kind = Fault::Kind::parity;
+      else if (kind == "corrupt")     f.kind = Fault::Kind::corrupt;
+      else if (kind == "fault")       f.kind = Fault::Kind::fault;
+      else if (kind == "reset")       f.kind = Fault::Kind::reset;
+      else if (kind == "wait")        { f.kind = Fault::Kind::wait; needsArg = true; }
+      else if (kind == "noack")       { f.kind = Fault::Kind::noack; needsArg = true; }
+      else if (kind == "disconnect")  { f.kind = Fault::Kind::disconnect; needsArg = true; }
+      else return fail("unknown fault");
+
+      if (needsArg) {
+        f.arg = number(arg, ok);
+        if (!ok) return fail("fault needs a count or time");
+      } else if (!arg.empty()) {
+        return fail("unexpected argument");
+      }
+
+      faults.push_back(f);
+    }
+    return true;
+  }
+
+
+  /* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+  // The wire
+
+  Target::Target(Bus& bus) : bus(bus) {
+    stats = {};
+  }
+
+  bool Target::swdio() const {
+    if (wire == Wire::respond && outAt < out.size())
+      return out[outAt];
+    return true;    // not driven, so pulled up
+  }
+
+  void Target::clock(bool hostDrives, bool hostBit, Time now) {
+    bool line = hostDrives ? hostBit : swdio();
+
+    if (!attached_ || now < disconnectedUntil) {
+      wire = Wire::lost;
+      return;
+    }
+
+    // A line reset is 50 or more 1s, whatever state the wire is in. A
+    // target driving the line doesn't see the host's 1s, though.
+    if (wire != Wire::respond) {
+      if (line) {
+        if (++ones == 50)
+          lineReset();
+      } else {
+        ones = 0;
+      }
+    }
+
+    switch (wire) {
+      case Wire::lost:
+        break;    // until a line reset
+
+      case Wire::reset:
+        // then at least two idle cycles
+        if (line)
+          zeros = 0;
+        else if (++zeros >= 2)
+          wire = Wire::idle;
+        break;
+
+      case Wire::idle:
+        if (line) {
+          wire = Wire::request;
+          shift = 1;
+          bits = 1;
+        }
+        break;
+
+      case Wire::request:
+        shift |= (line ? 1 : 0) << bits;
+        if (++bits == 8)
+          decode(now);
+        break;
+
+      case Wire::respond:
+        // the first cycle is turnaround, and the last turns it back
+        if (++outAt >= out.size()) {
+          out.clear();
+          outAt = 0;
+          if (rnw || ackOk != requestAck) {
+            wire = Wire::idle;
+          } else {
+            wire = Wire::writeData;
+            shift = 0;
+            bits = 0;
+          }
+        }
+        break;
+
+      case Wire::writeData:
+        if (bits < 32) {
+          shift |= (line ? 1u : 0u) << bits;
+          bits += 1;
+        } else {
+          finishWrite(shift, parity(shift) == line, now);
+          wire = Wire::idle;
+        }
+        break;
+    }
+  }
+
+  void Target::lineReset() {
+    wire = Wire::reset;
+    zeros = 0;
+    idRequired = true;
+    out.clear();
+    outAt = 0;
+    stats.lineResets += 1;
+    if (trace)
+      fprintf(stderr, "swd: line reset\n");
+  }
+
+  void Target::resetPin(bool asserted, bool swclk, Time now) {
+    if (attached_)
+      bus.resetPin(asserted, swclk, now);
+  }
+
+  void Target::attach(bool attached, Time now) {
+    if (attached && !attached_) {
+      bus.powerCycle(now);
+      ctrlStat = 0;
+      select = 0;
+      csw = 0;
+      tar = 0;
+      apBusyUntil = 0;
+    }
+    attached_ = attached;
+    wire = Wire::lost;
+  }
+
+
+  /* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+  // Requests
+
+  void Target::decode(Time now) {
+    bool start  = shift & 0x01;
+    apNdp       = shift & 0x02;
+    rnw         = shift & 0x04;
+    reg         = (shift >> 1) & 0x0C;
+    bool par    = shift & 0x20;
+    bool stop   = shift & 0x40;
+    bool park   = shift & 0x80;
+    requestAt = now;
+
+    stats.requests += 1;
+    checkFaults(now, false, 0);
+
+    if (!attached_ || now < disconnectedUntil) {
+      noResponse();   // it was disconnected by the fault just injected
+      return;
+    }
+    if (!start || stop || !park || par != parity((shift >> 1) & 0x0F)) {
+      noResponse();   // a protocol error: the host must reset the line
+      return;
+    }
+    if (noackLeft > 0) {
+      noackLeft -= 1;
+      noResponse();
+      return;
+    }
+    if (idRequired && (apNdp || !rnw || reg != DP_IDR_ABORT)) {
+      noResponse();
+      return;
+    }
+
+    if (waitLeft > 0) {
+      waitLeft -= 1;
+      respond(ackWait, false, 0);
+      return;
+    }
+
+    bool alwaysAllowed = !apNdp
+      && ((rnw && (reg == DP_IDR_ABORT || reg == DP_CTRL_STAT))
+          || (!rnw && reg == DP_IDR_ABORT));
+    if (sticky() && !alwaysAllowed) {
+      respond(ackFault, false, 0);
+      return;
+    }
+
+    if (!rnw) {
+      // AP writes wait for the last AP access; the data comes later
+      if (apNdp && now < apBusyUntil) {
+        respond(ackWait, false, 0);
+        return;
+      }
+      respond(ackOk, false, 0);
+      return;
+    }
+
+    uint32_t data;
+    if (apNdp) {
+      if (!apRead(reg, data, now)) {
+        respond(ackWait, false, 0);
+        return;
+      }
+    } else {
+      if (reg == DP_RDBUFF && now < apBusyUntil) {
+        respond(ackWait, false, 0);
+        return;
+      }
+      data = dpRead(reg);
+    }
+    lastRead = data;
+    respond(ackOk, true, data);
+  }
+
+  void Target::respond(int ack, bool withData, uint32_t data) {
+    requestAck = ack;
+    switch (ack) {
+      case ackOk:     stats.ok += 1;      break;
+      case ackWait:   stats.waits += 1;   break;
+      case ackFault:  stats.faults += 1;  break;
+    }
+
+    bool p = parity(data);
+    if (withData && corruptIn > 0 && --corruptIn == 0) {
+      data ^= 1u << (requestAt % 32);
+      p = parity(data);
+    }
+    if (withData && parityIn > 0 && --parityIn == 0)
+      p = !p;
+
+    if (trace)
+      fprintf(stderr, "swd: %s %s %X -> %s %08x\n",
+        apNdp ? "AP" : "DP", rnw ? "read " : "write", reg, ackName(ack),
+        withData ? data : 0);
+
+    // The turnaround cycle, the ACK, any data and parity, then the
+    // turnaround back.
+    out.clear();
+    out.push_back(true);
+    for (int i = 0; i < 3; ++i)
+      out.push_back(ack & (1 << i));
+    if (withData) {
+      for (int i = 0; i < 32; ++i)
+        out.push_back(data & (1u << i));
+      out.push_back(p);
+    }
+    out.push_back(true);
+    outAt = 0;
+    wire = Wire::respond;
+  }
+
+  void Target::noResponse() {
+    stats.noResponse += 1;
+    if (trace)
+      fprintf(stderr, "swd: %s %s %X -> no response\n",
+        apNdp ? "AP" : "DP", rnw ? "read " : "write", reg);
+    wire = Wire::lost;
+  }
+
+  void Target::finishWrite(uint32_t data, bool parityOk, Time now) {
+    if (!parityOk) {
+      stats.writeParity += 1;
+      ctrlStat |= WDATAERR;
+      return;
+    }
+    if (trace)
+      fprintf(stderr, "swd:   data %08x\n", data);
+
+    if (apNdp) {
+      apWrite(reg, data, now);
+    } else {
+      dpWrite(reg, data, now);
+    }
+  }
+
+
+  /* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+  // The DP
+
+  bool Target::sticky() const {
+    return ctrlStat & stickyBits;
+  }
+
+  uint32_t Target::dpRead(int a) {
+    switch (a) {
+      case DP_IDR_ABORT:
+        idRequired = false;
+        return dpidr;
+
+      case DP_CTRL_STAT: {
+        if (select & 0xf)
+          return 0;   // the other banks aren't modelled
+        uint32_t v = ctrlStat;
+        if (v & CDBGPWRUPREQ) v |= CDBGPWRUPACK;
+        if (v & CSYSPWRUPREQ) v |= CSYSPWRUPACK;
+        return v;
+      }
+
+      case DP_SELECT_RESEND:
+        return lastRead;
+
+      case DP_RDBUFF:
+      default:
+        return readBuffer;
+    }
+  }
+
+  void Target::dpWrite(int a, uint32_t data, Time now) {
+    switch (a) {
+      case DP_IDR_ABORT:
+        if (data & DAPABORT)    apBusyUntil = now;
+        if (data & STKCMPCLR)   ctrlStat &= ~STICKYCMP;
+        if (data & STKERRCLR)   ctrlStat &= ~STICKYERR;
+        if (data & WDERRCLR)    ctrlStat &= ~WDATAERR;
+        if (data & ORUNERRCLR)  ctrlStat &= ~STICKYORUN;
+        break;
+
+      case DP_CTRL_STAT:
+        if ((select & 0xf) == 0)
+          ctrlStat = (ctrlStat & ~ctrlWritable) | (data & ctrlWritable);
+        break;
+
+      case DP_SELECT_RESEND:
+        select = data;
+        break;
+
+      default:
+        break;    // RDBUFF is read only
+    }
+  }
+
+
+  /* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+  // The MEM-AP
+
+  bool Target::apAccessOk(Time now) {
+    if (!(ctrlStat & CDBGPWRUPREQ)) {
+      ctrlStat |= STICKYERR;    // the debug domain is powered down
+      return false;
+    }
+    return true;
+  }
+
+  uint32_t Target::memAddr(int a) const {
+    if (a >= AP_BD0 && a <= AP_BD3)
+      return (tar & ~0xfu) | (a - AP_BD0);
+    return tar & ~0x3u;
+  }
+
+  void Target::incrementTar() {
+    // only single increment is modelled; it wraps at 1k, as on an M0+
+    if (((csw >> 4) & 3) == 1)
+      tar = (tar & ~0x3ffu) | ((tar + 4) & 0x3ffu);
+  }
+
+  bool Target::apRead(int a, uint32_t& data, Time now) {
+    // Returns false to answer WAIT. AP reads are posted: the data returned
+    // is from the previous one, and this one's is read later, from RDBUFF
+    // or with the next AP read.
+    if (now < apBusyUntil)
+      return false;
+
+    stats.apReads += 1;
+    data = readBuffer;
+    a |= (select >> 4 & 0xf) << 4;
+    bool isMem = a == AP_DRW || (a >= AP_BD0 && a <= AP_BD3);
+
+    if ((select >> 24) != 0) {
+      readBuffer = 0;   // there is only AP 0
+      return true;
+    }
+    if (!apAccessOk(now)) {
+      readBuffer = 0;
+      return true;
+    }
+
+    switch (a) {
+      case AP_CSW:  readBuffer = csw | cswDeviceEn; break;
+      case AP_TAR:  readBuffer = tar;     break;
+      case AP_BASE: readBuffer = apBase;  break;
+      case AP_IDR:  readBuffer = apIdr;   break;
+      default:      readBuffer = 0;       break;
+    }
+
+    if (isMem) {
+      auto addr = memAddr(a);
+      checkFaults(now, true, addr, true);
+      auto startAt = bus.readyAt(addr, now);
+      uint32_t v = 0;
+      if (bus.read(addr, v, startAt) != Access::ok)
+        ctrlStat |= STICKYERR;
+      readBuffer = v;
+      apBusyUntil = startAt + bus.accessTime(addr);
+      if (a == AP_DRW)
+        incrementTar();
+    }
+    return true;
+  }
+
+  bool Target::apWrite(int a, uint32_t data, Time now) {
+    stats.apWrites += 1;
+    a |= (select >> 4 & 0xf) << 4;
+
+    if ((select >> 24) != 0)
+      return true;
+    if (!apAccessOk(now))
+      return false;
+
+    switch (a) {
+      case AP_CSW:
+        csw = data & cswWritable;
+        return true;
+
+      case AP_TAR:
+        tar = data;
+        return true;
+
+      case AP_DRW:
+      case AP_BD0: case AP_BD0 + 4: case AP_BD0 + 8: case AP_BD3: {
+        auto addr = memAddr(a);
+        checkFaults(now, true, addr);
+        auto startAt = bus.readyAt(addr, now);
+        if (bus.write(addr, data, startAt) != Access::ok)
+          ctrlStat |= STICKYERR;
+        apBusyUntil = startAt + bus.accessTime(addr);
+        if (a == AP_DRW)
+          incrementTar();
+        return true;
+      }
+
+      default:
+        return true;    // read only
+    }
+  }
+
+
+  /* -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- -- */
+  // Injecting faults
+
+  void Target::checkFaults(Time now, bool hasAddr, uint32_t addr,
+    bool postedRead)
+  {
+    for (auto& f : script.faults) {
+      bool fire = false;
+      switch (f.trigger) {
+        case Fault::Trigger::request:
+          fire = !hasAddr && !f.fired && stats.requests == f.at;
+          break;
+        case Fault::Trigger::every:
+          fire = !hasAddr && stats.requests % f.at == 0;
+          break;
+        case Fault::Trigger::time:
+          fire = !hasAddr && !f.fired && now >= f.at * ms;
+          break;
+        case Fault::Trigger::addr:
+          fire = hasAddr && !f.fired && addr == f.at;
+          break;
+      }
+      if (fire)
+        inject(f, now, postedRead);
+    }
+  }
+
+  void Target::inject(Fault& f, Time now, bool postedRead) {
+    f.fired = true;
+    stats.injected += 1;
+    if (trace)
+      fprintf(stderr, "swd: injecting fault %d\n", static_cast<int>(f.kind));
+
+    switch (f.kind) {
+      // A posted read's data comes back with the next response
+      case Fault::Kind::parity:   parityIn = postedRead ? 2 : 1;    break;
+      case Fault::Kind::corrupt:  corruptIn = postedRead ? 2 : 1;   break;
+      case Fault::Kind::wait:     waitLeft = f.arg;                 break;
+      case Fault::Kind::fault:    ctrlStat |= STICKYERR;            break;
+      case Fault::Kind::noack:    noackLeft = f.arg;                break;
+
+      case Fault::Kind::disconnect:
+        // comes back as if just plugged in
+        disconnectedUntil = now + f.arg * ms;
+        attach(false, now);
+        attach(true, disconnectedUntil);
+        break;
+
+      case Fault::Kind::reset:
+        bus.resetPin(true, true, now);
+        bus.resetPin(false, true, now);
+        break;
+    }
+  }
+
+}
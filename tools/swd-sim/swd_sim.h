@@ -0,0 +1,201 @@
+#ifndef _SWD_SIM_H_
+#define _SWD_SIM_H_
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+// An SWD target, simulated on the host, for Adafruit_DAP's bit-bang layer to
+// talk to.
+//
+// The wire is clocked a bit at a time, as the programmer's pins would drive
+// it, and the target answers as an ARM SW-DP with a MEM-AP behind it would:
+// line resets, request parity, OK, WAIT and FAULT acknowledgements, posted
+// AP reads, sticky errors and ABORT. Memory accesses go on to a Bus, which
+// is the chip itself; see samd21_sim.h.
+//
+// Time is simulated, in ns. It only moves on when the programmer clocks the
+// wire or waits (see sim_arduino.cpp), so a run is the same every time, and
+// doesn't depend on how fast the host is.
+
+namespace SwdSim {
+
+  typedef uint64_t Time;    // ns
+
+  const Time us = 1000;
+  const Time ms = 1000 * us;
+
+  enum struct Access {
+    ok,
+    error,      // a bus error, which sets STICKYERR
+  };
+
+  class Bus {
+  public:
+    virtual ~Bus() { }
+
+    virtual Access read(uint32_t addr, uint32_t& data, Time now) = 0;
+    virtual Access write(uint32_t addr, uint32_t data, Time now) = 0;
+      // word accesses; addr is aligned
+
+    virtual Time readyAt(uint32_t addr, Time now) { return now; }
+      // when an access to addr can start, if the bus there is stalled
+    virtual Time accessTime(uint32_t addr) { return 0; }
+      // how long an access takes, once started
+
+    virtual void resetPin(bool asserted, bool swclk, Time now) = 0;
+      // SWCLK low when reset is released holds the core in reset extension
+    virtual void powerCycle(Time now) = 0;
+      // the target was disconnected, and is back
+  };
+
+
+  // Faults to inject, from a script. Each line is a trigger and a fault:
+  //
+  //    request 1200 parity       the 1200th request
+  //    every 500 wait 3          every 500th request
+  //    time 250 disconnect 40    the first request after 250ms
+  //    addr 0x00002000 fault     the first AP access to that address
+  //
+  // and the faults are:
+  //
+  //    parity          the parity bit of the read data is wrong
+  //    corrupt         a bit of the read data is flipped, with good parity
+  //    wait <n>        the next n requests are answered WAIT
+  //    fault           a sticky error is set, so requests are answered FAULT
+  //    noack <n>       the next n requests aren't answered at all
+  //    disconnect <ms> the target is gone for that long, and comes back
+  //                    powered up afresh
+  //    reset           the target resets itself, as on a brown out
+  //
+  // Blank lines, and anything after a #, are ignored.
+
+  struct Fault {
+    enum struct Trigger { request, every, time, addr };
+    enum struct Kind { parity, corrupt, wait, fault, noack, disconnect, reset };
+
+    Trigger   trigger;
+    uint64_t  at;       // request number, period, ms, or address
+    Kind      kind;
+    uint64_t  arg;      // count, or ms
+    bool      fired;
+  };
+
+  class FaultScript {
+  public:
+    bool load(const std::string& path, std::string& error);
+    bool parse(const std::string& text, std::string& error);
+    void add(const Fault& f) { faults.push_back(f); }
+
+    std::vector<Fault> faults;
+  };
+
+
+  struct Stats {
+    uint64_t requests;
+    uint64_t ok;
+    uint64_t waits;
+    uint64_t faults;
+    uint64_t noResponse;      // bad requests, and while disconnected
+    uint64_t writeParity;     // write data that arrived with bad parity
+    uint64_t lineResets;
+    uint64_t apReads;
+    uint64_t apWrites;
+    uint64_t injected;        // faults from the script that fired
+  };
+
+
+  class Target {
+  public:
+    Target(Bus& bus);
+
+    void clock(bool hostDrives, bool hostBit, Time now);
+      // a rising edge of SWCLK; the host's bit, if it is driving SWDIO
+    bool swdio() const;
+      // the line, as the host would read it while SWCLK is low
+    void resetPin(bool asserted, bool swclk, Time now);
+
+    void attach(bool attached, Time now);
+      // a target not attached answers nothing; on attaching it has just
+      // powered up
+    bool attached() const { return attached_; }
+
+    FaultScript script;
+    Stats stats;
+    bool trace = false;   // print each transaction to stderr
+
+  private:
+    Bus& bus;
+    bool attached_ = true;
+
+    // The wire
+    enum struct Wire { idle, request, respond, writeData, lost, reset };
+    Wire wire = Wire::lost;   // until the first line reset
+    int ones = 0;             // host 1s in a row, for line reset
+    int zeros = 0;            // idle cycles after a line reset
+    uint32_t shift = 0;
+    int bits = 0;
+    std::vector<bool> out;    // bits to drive, one per cycle
+    size_t outAt = 0;
+
+    // The request being answered
+    bool apNdp = false;
+    bool rnw = false;
+    int reg = 0;
+    int requestAck = 0;
+    Time requestAt = 0;
+
+    // The DP
+    bool idRequired = true;     // after a line reset, only DPIDR may be read
+    uint32_t ctrlStat = 0;
+    uint32_t select = 0;
+    uint32_t readBuffer = 0;    // the result of the last AP read
+    uint32_t lastRead = 0;      // for RESEND
+    Time apBusyUntil = 0;
+
+    // The MEM-AP
+    uint32_t csw = 0;
+    uint32_t tar = 0;
+
+    // Injected faults in effect
+    uint64_t waitLeft = 0;
+    uint64_t noackLeft = 0;
+    Time disconnectedUntil = 0;
+    int parityIn = 0;     // spoil the data of the nth response from now
+    int corruptIn = 0;
+
+    void lineReset();
+    void decode(Time now);
+    void respond(int ack, bool withData, uint32_t data);
+    void noResponse();
+    void finishWrite(uint32_t data, bool parityOk, Time now);
+
+    bool sticky() const;
+    uint32_t dpRead(int a);
+    void dpWrite(int a, uint32_t data, Time now);
+    bool apRead(int a, uint32_t& data, Time now);
+    bool apWrite(int a, uint32_t data, Time now);
+    bool apAccessOk(Time now);
+    uint32_t memAddr(int a) const;
+    void incrementTar();
+
+    void checkFaults(Time now, bool hasAddr, uint32_t addr,
+      bool postedRead = false);
+    void inject(Fault& f, Time now, bool postedRead);
+  };
+
+  const char* ackName(int ack);
+
+
+  // The programmer's side, in sim_arduino.cpp: Arduino's pinMode(),
+  // digitalWrite() and digitalRead() on these pins drive the target, and
+  // millis(), micros() and the delays use simulated time.
+
+  void wire(Target&, int swclk, int swdio, int swrst);
+  Time now();
+  void wait(Time);
+  extern Time pinTime;    // for each pin call; 250ns by default
+
+}
+
+#endif // _SWD_SIM_H_
@@ -0,0 +1,291 @@
+// Checks the simulated target on the wire: the DAP stand-in in dap/ talks to
+// a fresh simulated SAMD21 for each check, with faults injected as a script
+// would, and what it gets back, and what the target counted, is compared
+// with what an ARM SW-DP, and the chip, would do.
+//
+//    wire_check [--trace]
+//
+// Each check prints a line, ok or FAIL; the exit status is 1 if any failed.
+// Run it after changing swd_sim.cpp, samd21_sim.cpp, or dap/.
+
+#include <cstdio>
+#include <cstring>
+#include <string>
+#include <vector>
+
+#include <Adafruit_DAP.h>
+
+#include "samd21_sim.h"
+#include "swd_sim.h"
+
+
+namespace {
+
+  using namespace SwdSim;
+
+  enum { SWCLK = 1, SWDIO = 2, SWRST = 3 };
+
+  // CMSIS-DAP transfer requests, as for dap_read_reg() and dap_write_reg()
+  const uint8_t DP_ABORT = 0x00;
+  const uint8_t DP_IDCODE = 0x00;
+  const uint8_t DP_CTRL_STAT = 0x04;
+  const uint8_t DP_RDBUFF = 0x0C;
+  const uint8_t AP_TAR = 0x01 | 0x04;
+  const uint8_t AP_DRW = 0x01 | 0x0C;
+
+  const uint32_t DPIDR = 0x0bc11477;    // the M0+'s SW-DP
+  const uint32_t STICKYERR = 1 << 5;
+  const uint32_t RAM = 0x20000000;
+
+  bool trace = false;
+  std::string lastError;
+  void onError(const char* text) { lastError = text; }
+
+  // A simulated SAMD21 on the programmer's pins, and the DAP to talk to it
+  struct Bench {
+    Samd21 chip;
+    Target target;
+    Adafruit_DAP_SAM dap;
+
+    Bench() : target(chip) {
+      target.trace = trace;
+      wire(target, SWCLK, SWDIO, SWRST);
+      dap.begin(SWCLK, SWDIO, SWRST, onError);
+      dap.dap_connect();
+      lastError.clear();
+    }
+
+    bool connect() {
+      return dap.dap_reset_link() && dap.dap_target_prepare();
+    }
+
+    void inject(Fault::Trigger trigger, uint64_t at, Fault::Kind kind,
+      uint64_t arg = 0)
+    {
+      target.script.add({ trigger, at, kind, arg, false });
+    }
+
+    void injectNext(Fault::Kind kind, uint64_t arg = 0) {
+      // on the next request on the wire
+      inject(Fault::Trigger::request, target.stats.requests + 1, kind, arg);
+    }
+  };
+
+  std::string failure;
+  bool expect(bool cond, const char* what) {
+    if (!cond && failure.empty())
+      failure = what;
+    return cond;
+  }
+
+
+  void lineReset() {
+    Bench b;
+    uint32_t id = 0;
+    expect(!b.dap.dap_read_reg(DP_IDCODE, &id),
+      "answered before a line reset");
+    expect(lastError == "invalid response (no ACK)",
+      "no ACK not reported");
+    expect(b.dap.dap_reset_link(), "no DPIDR after a line reset");
+    expect(b.dap.dap_read_reg(DP_IDCODE, &id) && id == DPIDR,
+      "wrong DPIDR");
+    expect(b.target.stats.lineResets == 2,
+      "not 2 line resets, either side of the JTAG to SWD sequence");
+  }
+
+  void noAck() {
+    // the SW-DP is then locked out, as after a protocol error, until a line
+    // reset
+    Bench b;
+    b.connect();
+    b.injectNext(Fault::Kind::noack, 1);
+    uint32_t id;
+    expect(!b.dap.dap_read_reg(DP_IDCODE, &id), "answered");
+    expect(lastError == "invalid response (no ACK)", "no ACK not reported");
+    expect(!b.dap.dap_read_reg(DP_IDCODE, &id),
+      "answered before a line reset");
+    expect(b.connect(), "didn't connect again");
+  }
+
+  void waitRetried() {
+    Bench b;
+    b.connect();
+    auto waits = b.target.stats.waits;
+    b.injectNext(Fault::Kind::wait, 3);
+    uint32_t id;
+    expect(b.dap.dap_read_reg(DP_IDCODE, &id) && id == DPIDR,
+      "WAIT not retried");
+    expect(b.target.stats.waits - waits == 3, "not 3 WAITs");
+  }
+
+  void waitGivenUp() {
+    Bench b;
+    b.connect();
+    b.dap.dap_transfer_configure(0, 8, 0);
+    b.injectNext(Fault::Kind::wait, 20);
+    uint32_t id;
+    expect(!b.dap.dap_read_reg(DP_IDCODE, &id), "WAIT retried past 8");
+    expect(lastError == "invalid response (WAIT)", "WAIT not reported");
+  }
+
+  void readParity() {
+    // a posted read's spoilt data comes with the RDBUFF read after it
+    Bench b;
+    b.connect();
+    b.dap.dap_write_word(RAM + 4, 0x12345678);
+    b.inject(Fault::Trigger::addr, RAM + 4, Fault::Kind::parity);
+    b.dap.dap_read_word(RAM + 4);
+    expect(lastError == "parity error", "parity error not seen");
+    lastError.clear();
+    expect(b.dap.dap_read_word(RAM + 4) == 0x12345678 && lastError.empty(),
+      "not read again");
+  }
+
+  void readCorrupt() {
+    // a flipped bit, with good parity, isn't seen on the wire
+    Bench b;
+    b.connect();
+    b.dap.dap_write_word(RAM, 0x12345678);
+    b.inject(Fault::Trigger::addr, RAM, Fault::Kind::corrupt);
+    auto v = b.dap.dap_read_word(RAM);
+    expect(lastError.empty(), "reported");
+    expect(v != 0x12345678, "not corrupted");
+    expect(b.dap.dap_read_word(RAM) == 0x12345678, "still corrupt");
+  }
+
+  void stickyFault() {
+    // a bus error sets STICKYERR, and AP requests are answered FAULT until
+    // ABORT clears it; the DP still answers
+    Bench b;
+    b.connect();
+    b.inject(Fault::Trigger::addr, RAM + 8, Fault::Kind::fault);
+    b.dap.dap_read_word(RAM + 8);
+    lastError.clear();
+    b.dap.dap_read_word(RAM);
+    expect(lastError == "invalid response (FAULT)", "FAULT not reported");
+    uint32_t status = 0;
+    expect(b.dap.dap_read_reg(DP_CTRL_STAT, &status)
+      && (status & STICKYERR), "STICKYERR not set");
+    expect(b.dap.dap_write_reg(DP_ABORT, 0x1e), "ABORT refused");
+    expect(b.dap.dap_read_reg(DP_CTRL_STAT, &status)
+      && !(status & STICKYERR), "STICKYERR not cleared");
+    lastError.clear();
+    b.dap.dap_read_word(RAM);
+    expect(lastError.empty(), "still FAULT after ABORT");
+  }
+
+  void disconnect() {
+    // gone for 2ms, then back as if just plugged in: a line reset is needed
+    Bench b;
+    b.connect();
+    b.injectNext(Fault::Kind::disconnect, 2);
+    uint32_t id;
+    expect(!b.dap.dap_read_reg(DP_IDCODE, &id), "answered while gone");
+    wait(3 * ms);
+    expect(!b.dap.dap_read_reg(DP_IDCODE, &id),
+      "answered before a line reset");
+    expect(b.connect(), "didn't connect again");
+    uint32_t did;
+    expect(b.dap.select(&did), "not selected");
+  }
+
+  void postedBlock() {
+    // a block read, over a 1k TAR wrap, is posted reads ending with RDBUFF
+    Bench b;
+    b.connect();
+    std::vector<uint8_t> out(512), in(512);
+    for (size_t i = 0; i < out.size(); ++i)
+      out[i] = i * 7 + 1;
+    auto at = RAM + 1024 - 128;
+    expect(b.dap.dap_write_block(at, out.data(), out.size()), "write failed");
+    expect(b.dap.dap_read_block(at, in.data(), in.size()), "read failed");
+    expect(in == out, "read back differs");
+    uint32_t word, first, posted;
+    memcpy(&word, out.data(), 4);
+    expect(b.dap.dap_write_reg(AP_TAR, at)
+      && b.dap.dap_read_reg(AP_DRW, &first)
+      && b.dap.dap_read_reg(DP_RDBUFF, &posted), "DRW read failed");
+    expect(first != word && posted == word, "DRW read wasn't posted");
+  }
+
+  void rowProgram() {
+    Bench b;
+    b.connect();
+    uint32_t did;
+    expect(b.dap.select(&did), "not selected");
+    expect(b.dap.target_device.flash_size == b.chip.flash.size(),
+      "wrong device");
+    b.dap.program_start();
+    uint8_t row[256], back[256];
+    for (size_t i = 0; i < sizeof(row); ++i)
+      row[i] = i ^ 0x5a;
+    b.dap.programBlock(0x400, row);
+    b.dap.readBlock(0x400, back);
+    expect(lastError.empty(), "errors");
+    expect(memcmp(row, back, sizeof(row)) == 0, "read back differs");
+    expect(memcmp(row, &b.chip.flash[0x400], sizeof(row)) == 0,
+      "flash differs");
+    expect(b.chip.stats.rowErases == 1 && b.chip.stats.pageWrites == 4,
+      "not 1 row erased, 4 pages written");
+    expect(b.chip.stats.nvmErrors == 0, "NVM errors");
+  }
+
+  void fuses() {
+    Bench b;
+    b.connect();
+    uint32_t did;
+    b.dap.select(&did);
+    b.dap.fuseRead();
+    b.dap._USER_ROW.bit.BOOTPROT = 2;
+    b.dap.fuseWrite();
+    b.dap.fuseRead();
+    expect(lastError.empty(), "errors");
+    expect(b.dap._USER_ROW.bit.BOOTPROT == 2, "BOOTPROT not written");
+    expect((b.chip.userRow[0] & 7) == 2, "user row not written");
+    expect(b.chip.stats.nvmErrors == 0, "NVM errors");
+  }
+
+
+  struct Check {
+    const char* name;
+    void (*run)();
+  };
+
+  const Check checks[] = {
+    { "line reset",             lineReset },
+    { "request not answered",   noAck },
+    { "WAIT retried",           waitRetried },
+    { "WAIT given up",          waitGivenUp },
+    { "read parity",            readParity },
+    { "read corrupt",           readCorrupt },
+    { "sticky FAULT",           stickyFault },
+    { "disconnect",             disconnect },
+    { "posted block read",      postedBlock },
+    { "row program",            rowProgram },
+    { "fuses",                  fuses },
+  };
+}
+
+int main(int argc, char** argv) {
+  for (int i = 1; i < argc; ++i) {
+    if (strcmp(argv[i], "--trace") == 0)
+      trace = true;
+    else {
+      fprintf(stderr, "usage: wire_check [--trace]\n");
+      return 2;
+    }
+  }
+
+  int failed = 0;
+  for (auto& c : checks) {
+    failure.clear();
+    c.run();
+    if (failure.empty())
+      printf("ok    %s\n", c.name);
+    else {
+      printf("FAIL  %s: %s\n", c.name, failure.c_str());
+      failed += 1;
+    }
+  }
+  return failed ? 1 : 0;
+}
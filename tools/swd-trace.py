@@ -0,0 +1,130 @@
+#!/usr/bin/env python3
+"""Show the SWD trace a Multi-Flash programmer built with MF_SWD_TRACE saved.
+
+When an SWD error is reported while flashing, the programmer writes the last
+transactions it made to swd-trace.bin on its drive. Copy that file off, or
+read it from the mounted drive:
+
+    tools/swd-trace.py /Volumes/MULTIFLASH/swd-trace.bin
+
+Each transaction is one call into the DAP library. The error's own entry
+comes just before the call it was reported in, which is marked with the
+number of errors. Times are from the first transaction in the trace.
+
+The file is little endian. A 512 byte header block:
+
+    0   magic       8 bytes, "MFSWDTR1"
+    8   seq         u32, traces saved since the programmer powered up
+    12  saved_at    u32, ms since power up, at the error
+    16  count       u32, entries
+    20  error_index u32, the entry for the error
+    24  entry_size  u32, 16
+    28  reserved    u32
+    32  text        64 bytes, the error, NUL terminated
+
+then the entries, oldest first, each:
+
+    0   at      u32, µs, when the call started
+    4   addr    u32
+    8   data    u32
+    12  took    u16, µs, 65535 if longer
+    14  op      u8
+    15  errors  u8, reported during the call
+"""
+
+import argparse
+import struct
+import sys
+
+
+OPS = [
+    'clock', 'error', 'connect', 'select', 'readWord', 'writeWord',
+    'readBlock', 'programBlock', 'fuseRead', 'fuseWrite', 'resetLink',
+]
+
+# what the programmer reads and writes by address
+NAMES = {
+    0x41002018: 'DSU_DID',
+    0x41002100: 'DSU_CTRLSTAT',
+    0xE000EDF0: 'DHCSR',
+    0xE000EDFC: 'DEMCR',
+    0xE000ED0C: 'AIRCR',
+    0x0080A00C: 'serial 0',
+    0x0080A040: 'serial 1',
+    0x0080A044: 'serial 2',
+    0x0080A048: 'serial 3',
+    0x008061FC: 'serial 0',
+    0x00806010: 'serial 1',
+    0x00806014: 'serial 2',
+    0x00806018: 'serial 3',
+}
+
+HEADER = struct.Struct('<8sIIIIII64s')
+ENTRY = struct.Struct('<IIIHBB')
+
+
+def describe(op, addr, data):
+    if op == 'clock':
+        return 'SWD clock now %d' % data   # as given to the DAP library
+    if op == 'error':
+        return ''
+    if op == 'select':
+        return 'device id %08x' % data
+    if op in ('readWord', 'writeWord'):
+        name = NAMES.get(addr, '')
+        return '%08x %-12s %s %08x' % (
+            addr, name, '->' if op == 'readWord' else '<-', data)
+    if op in ('readBlock', 'programBlock'):
+        return '%08x %d bytes' % (addr, data)
+    if op in ('fuseRead', 'fuseWrite'):
+        return 'low word %08x' % data
+    return ''
+
+
+def main():
+    parser = argparse.ArgumentParser(
+        description='Show the SWD trace saved by a Multi-Flash programmer.')
+    parser.add_argument('file', help='swd-trace.bin, from the drive')
+    args = parser.parse_args()
+
+    with open(args.file, 'rb') as f:
+        raw = f.read()
+
+    if len(raw) < 512 or raw[:8] != b'MFSWDTR1':
+        if raw[:1] in (b'', b'\0'):
+            print('no trace saved yet')
+            return 0
+        sys.exit('%s is not a Multi-Flash SWD trace' % args.file)
+
+    (_, seq, savedAt, count, errorIndex, entrySize, _, text) = \
+        HEADER.unpack_from(raw, 0)
+    text = text.split(b'\0', 1)[0].decode('ascii', 'replace')
+    if entrySize != ENTRY.size:
+        sys.exit('entries are %d bytes, expected %d' % (entrySize, ENTRY.size))
+
+    print('trace %d, saved at %.3fs: %s' % (seq, savedAt / 1000.0, text))
+    print('%d transactions\n' % count)
+
+    entries = [ENTRY.unpack_from(raw, 512 + i * ENTRY.size)
+               for i in range(count)
+               if 512 + (i + 1) * ENTRY.size <= len(raw)]
+    if not entries:
+        return 0
+
+    firstAt = entries[0][0]
+    print('%4s %11s %8s  %-12s %s' % ('', 'at µs', 'took µs', 'op', ''))
+    for i, (at, addr, data, took, op, errors) in enumerate(entries):
+        name = OPS[op] if op < len(OPS) else 'op %d' % op
+        mark = '>>' if i == errorIndex else '  '
+        tookText = '%8s' % ('' if name in ('clock', 'error') else
+                            '>65535' if took == 0xffff else took)
+        note = describe(name, addr, data)
+        if errors:
+            note += '  ** %d error%s' % (errors, '' if errors == 1 else 's')
+        print('%s%3d %11d %s  %-12s %s' %
+              (mark, i, (at - firstAt) & 0xffffffff, tookText, name, note))
+    return 0
+
+
+if __name__ == '__main__':
+    sys.exit(main())